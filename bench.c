@@ -0,0 +1,331 @@
+/* Gromit -- a program for painting on the screen
+ * Copyright (C) 2000 Simon Budig <Simon.Budig@unix-ag.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+
+/*
+ * Microbenchmarks for the code that runs on every motion or state
+ * change event. "make bench" builds them, running them needs a display
+ * since the tools own GCs. Every benchmark is repeated BENCH_REPS
+ * times, the best and the median repetition get reported in ns per
+ * operation.
+ */
+
+#include <glib/gstdio.h>
+
+/* everything in gromit.c is fair game, except for its main () */
+#define main gromit_main
+#include "gromit.c"
+#undef main
+
+#define BENCH_REPS        15
+#define BENCH_TOOLS       500
+#define BENCH_STROKE      20000
+
+typedef struct
+{
+  const gchar *name;
+  gint         n;                        /* operations per repetition */
+  void       (*run)   (GromitData *data, gint n);
+  void       (*reset) (GromitData *data);  /* untimed, after each run */
+} Bench;
+
+static gchar     *bench_config = NULL;
+static GPtrArray *bench_parsed = NULL;
+static volatile gint bench_sink;
+
+
+/* a config with BENCH_TOOLS tools, templates and device mappings */
+static gchar *
+bench_config_write (void)
+{
+  static const gchar *scopes[] = { "", "[SHIFT]", "[CONTROL]", "[META]",
+                                   "[1]", "[3]", "[1 SHIFT]",
+                                   "[3 SHIFT CONTROL]" };
+  GString *config = g_string_new ("# generated by the gromit benchmarks\n");
+  GError  *error = NULL;
+  gchar   *filename;
+  gint     fd, i;
+
+  for (i = 0; i < BENCH_TOOLS; i++)
+    {
+      switch (i % 4)
+        {
+        case 0:
+          g_string_append_printf (config,
+                                  "\"tool %d\" = PEN (size=%d color=\"#%06X\");\n",
+                                  i, 1 + i % 30, (i * 0x10101) & 0xFFFFFF);
+          break;
+        case 1:
+          g_string_append_printf (config,
+                                  "\"tool %d\" = \"tool %d\" (arrowsize=1.5);\n",
+                                  i, i - 1);
+          break;
+        case 2:
+          g_string_append_printf (config,
+                                  "\"tool %d\" = HIGHLIGHTER (size=%d "
+                                  "color=\"yellow\" opacity=0.4);\n",
+                                  i, 10 + i % 20);
+          break;
+        default:
+          g_string_append_printf (config,
+                                  "\"tool %d\" = ERASER (size=%d);\n",
+                                  i, 20 + i % 60);
+          break;
+        }
+
+      g_string_append_printf (config, "\"Pen%d\"%s = \"tool %d\";\n",
+                              i / G_N_ELEMENTS (scopes),
+                              scopes[i % G_N_ELEMENTS (scopes)], i);
+    }
+
+  for (i = 0; i < G_N_ELEMENTS (scopes); i++)
+    g_string_append_printf (config, "\"Core Pointer\"%s = \"tool %d\";\n",
+                            scopes[i], i);
+
+  fd = g_file_open_tmp ("gromit-bench-XXXXXX", &filename, &error);
+  if (fd < 0)
+    {
+      g_printerr ("Unable to create the config: %s\n", error->message);
+      exit (1);
+    }
+  close (fd);
+
+  if (!g_file_set_contents (filename, config->str, config->len, &error))
+    {
+      g_printerr ("Unable to write %s: %s\n", filename, error->message);
+      exit (1);
+    }
+
+  g_string_free (config, TRUE);
+
+  return filename;
+}
+
+
+/* just what the benchmarked functions need of setup_main_app () */
+static void
+bench_setup (GromitData *data)
+{
+  setup_client_app (data);
+  gtk_widget_realize (data->win);
+
+  data->cm = gdk_screen_get_default_colormap (data->screen);
+  data->white = g_malloc (sizeof (GdkColor));
+  data->black = g_malloc (sizeof (GdkColor));
+  data->red   = g_malloc (sizeof (GdkColor));
+  gdk_color_parse ("#FFFFFF", data->white);
+  gdk_colormap_alloc_color (data->cm, data->white, FALSE, TRUE);
+  gdk_color_parse ("#000000", data->black);
+  gdk_colormap_alloc_color (data->cm, data->black, FALSE, TRUE);
+  gdk_color_parse ("#FF0000", data->red);
+  gdk_colormap_alloc_color (data->cm, data->red,  FALSE, TRUE);
+
+  data->paint_cursor = gdk_cursor_new_for_display (data->display, GDK_PENCIL);
+  data->erase_cursor = gdk_cursor_new_for_display (data->display, GDK_CIRCLE);
+  data->empty_shape = gdk_pixmap_new (NULL, 1, 1, 1);
+
+  data->coordlist = NULL;
+  data->default_pen = gromit_paint_context_new (data, GROMIT_PEN,
+                                                data->red, 7, 0, 1.0);
+  data->default_eraser = gromit_paint_context_new (data, GROMIT_ERASER,
+                                                   data->red, 75, 0, 1.0);
+  data->cur_context = data->default_pen;
+  data->state = 0;
+  data->device = NULL;
+
+  data->tool_config = g_hash_table_new (g_str_hash, g_str_equal);
+  parse_config_file (data, bench_config);
+}
+
+
+static void
+bench_select_tool (GromitData *data, gint n)
+{
+  static const guint states[] = {
+    0, GDK_SHIFT_MASK, GDK_CONTROL_MASK, GDK_MOD1_MASK,
+    GDK_BUTTON1_MASK, GDK_BUTTON3_MASK, GDK_BUTTON1_MASK | GDK_SHIFT_MASK,
+    GDK_BUTTON3_MASK | GDK_SHIFT_MASK | GDK_CONTROL_MASK,
+    GDK_BUTTON2_MASK | GDK_MOD1_MASK
+  };
+  GdkDevice *device = gdk_display_get_core_pointer (data->display);
+  gint       i;
+
+  for (i = 0; i < n; i++)
+    gromit_select_tool (data, device, states[i % G_N_ELEMENTS (states)]);
+}
+
+
+static void
+bench_select_tool_reset (GromitData *data)
+{
+  gdk_flush ();
+}
+
+
+static void
+bench_coord_list (GromitData *data, gint n)
+{
+  gint i;
+
+  for (i = 0; i < n; i++)
+    gromit_coord_list_prepend (data, i & 1023, i >> 10, 7);
+
+  gromit_coord_list_free (data);
+}
+
+
+/* a slow stroke: the search has to walk a few hundred points back */
+static void
+bench_arrow_param (GromitData *data, gint n)
+{
+  gint   i, width;
+  gfloat direction;
+
+  for (i = 0; i < n; i++)
+    if (gromit_coord_list_get_arrow_param (data, 21, &width, &direction))
+      bench_sink += width;
+}
+
+
+static gboolean
+bench_tool_remove (gpointer key, gpointer value, gpointer user_data)
+{
+  g_free (key);
+  gromit_paint_context_free (value);
+  return TRUE;
+}
+
+
+static void
+bench_parse_config (GromitData *data, gint n)
+{
+  GHashTable *tools = data->tool_config;
+  gint        i;
+
+  for (i = 0; i < n; i++)
+    {
+      data->tool_config = g_hash_table_new (g_str_hash, g_str_equal);
+      parse_config_file (data, bench_config);
+      g_ptr_array_add (bench_parsed, data->tool_config);
+    }
+
+  data->tool_config = tools;
+}
+
+
+static void
+bench_parse_config_reset (GromitData *data)
+{
+  GHashTable *tools;
+  guint       i;
+
+  for (i = 0; i < bench_parsed->len; i++)
+    {
+      tools = g_ptr_array_index (bench_parsed, i);
+      g_hash_table_foreach_remove (tools, bench_tool_remove, NULL);
+      g_hash_table_destroy (tools);
+    }
+  g_ptr_array_set_size (bench_parsed, 0);
+  gdk_flush ();
+}
+
+
+static int
+bench_compare (const void *a, const void *b)
+{
+  gdouble da = *(const gdouble *) a, db = *(const gdouble *) b;
+
+  return da < db ? -1 : da > db;
+}
+
+
+static void
+bench_run (GromitData *data, const Bench *bench)
+{
+  GTimer  *timer = g_timer_new ();
+  gdouble  times[BENCH_REPS];
+  gint     rep;
+
+  /* warm up the caches and the allocator */
+  bench->run (data, bench->n);
+  if (bench->reset)
+    bench->reset (data);
+
+  for (rep = 0; rep < BENCH_REPS; rep++)
+    {
+      g_timer_start (timer);
+      bench->run (data, bench->n);
+      g_timer_stop (timer);
+      times[rep] = g_timer_elapsed (timer, NULL) * 1e9 / bench->n;
+
+      if (bench->reset)
+        bench->reset (data);
+    }
+
+  qsort (times, BENCH_REPS, sizeof (gdouble), bench_compare);
+  g_print ("%-28s %12.1f %12.1f\n",
+           bench->name, times[0], times[BENCH_REPS / 2]);
+
+  g_timer_destroy (timer);
+}
+
+
+int
+main (int argc, char **argv)
+{
+  static const Bench benches[] = {
+    { "select_tool",                 100000, bench_select_tool,
+                                             bench_select_tool_reset },
+    { "coord_list_prepend+free",    1000000, bench_coord_list, NULL },
+    { "coord_list_get_arrow_param",   10000, bench_arrow_param, NULL },
+    { "parse_config (500 tools)",         5, bench_parse_config,
+                                             bench_parse_config_reset },
+  };
+  GromitData *data;
+  gint        i;
+
+  gtk_init (&argc, &argv);
+  data = g_malloc (sizeof (GromitData));
+
+  bench_config = bench_config_write ();
+  bench_parsed = g_ptr_array_new ();
+  bench_setup (data);
+
+  /* the most recent point comes first, it moves a pixel every 16 events */
+  for (i = 0; i < BENCH_STROKE; i++)
+    gromit_coord_list_prepend (data, 100 + i / 16, 100 + i % 3, 7);
+
+  g_print ("%-28s %12s %12s\n", "ns/op", "best", "median");
+
+  for (i = 0; i < G_N_ELEMENTS (benches); i++)
+    {
+      /* only the arrow benchmark works on the long stroke */
+      GList *stroke = data->coordlist;
+
+      if (benches[i].run != bench_arrow_param)
+        data->coordlist = NULL;
+      bench_run (data, &benches[i]);
+      data->coordlist = stroke;
+    }
+
+  gromit_coord_list_free (data);
+  g_unlink (bench_config);
+  g_free (bench_config);
+
+  return 0;
+}
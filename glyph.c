@@ -0,0 +1,234 @@
+/* Gromit -- a program for painting on the screen
+ * Copyright (C) 2000 Simon Budig <Simon.Budig@unix-ag.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include <string.h>
+#include <pango/pangocairo.h>
+
+#include "glyph.h"
+
+#define GROMIT_ATLAS_WIDTH 1024
+
+/* "name size" -> GromitFont */
+static GHashTable *gromit_fonts = NULL;
+
+
+GromitFont *
+gromit_font_get (const gchar *name, gint size)
+{
+  GromitFont           *font;
+  PangoFontMetrics     *metrics;
+  cairo_font_options_t *options;
+  gchar                *key;
+
+  if (!gromit_fonts)
+    gromit_fonts = g_hash_table_new (g_str_hash, g_str_equal);
+
+  key = g_strdup_printf ("%s %d", name, size);
+  font = g_hash_table_lookup (gromit_fonts, key);
+  if (font)
+    {
+      g_free (key);
+      return font;
+    }
+
+  font = g_malloc (sizeof (GromitFont));
+
+  font->name = g_strdup (name);
+  font->size = size;
+
+  /* the glyphs end up in bitmaps anyway, let the hinting take care */
+  font->context = pango_font_map_create_context (pango_cairo_font_map_get_default ());
+  options = cairo_font_options_create ();
+  cairo_font_options_set_antialias (options, CAIRO_ANTIALIAS_NONE);
+  pango_cairo_context_set_font_options (font->context, options);
+  cairo_font_options_destroy (options);
+
+  font->desc = pango_font_description_from_string (name);
+  pango_font_description_set_absolute_size (font->desc, size * PANGO_SCALE);
+
+  metrics = pango_context_get_metrics (font->context, font->desc, NULL);
+  font->height = PANGO_PIXELS (pango_font_metrics_get_ascent (metrics) +
+                               pango_font_metrics_get_descent (metrics));
+  pango_font_metrics_unref (metrics);
+
+  font->glyphs = g_hash_table_new (g_direct_hash, g_direct_equal);
+
+  font->atlas = NULL;
+  font->atlas_gc = NULL;
+  font->atlas_width = MAX (GROMIT_ATLAS_WIDTH, 4 * size);
+  font->atlas_height = 0;
+  font->shelf_x = 0;
+  font->shelf_y = 0;
+  font->shelf_height = 0;
+
+  g_hash_table_insert (gromit_fonts, key, font);
+
+  return font;
+}
+
+
+static void
+gromit_font_grow_atlas (GromitFont *font, gint height)
+{
+  GdkBitmap *atlas;
+
+  atlas = gdk_pixmap_new (NULL, font->atlas_width, height, 1);
+
+  if (!font->atlas_gc)
+    font->atlas_gc = gdk_gc_new (atlas);
+
+  if (font->atlas)
+    {
+      gdk_draw_drawable (atlas, font->atlas_gc, font->atlas, 0, 0, 0, 0,
+                         font->atlas_width, font->atlas_height);
+      g_object_unref (font->atlas);
+    }
+
+  font->atlas = atlas;
+  font->atlas_height = height;
+}
+
+
+/* simple shelf packing, glyphs are never removed */
+static void
+gromit_font_pack (GromitFont *font, GromitGlyph *glyph)
+{
+  GdkBitmap *bitmap;
+  gint       needed;
+
+  if (font->shelf_x + glyph->width > font->atlas_width)
+    {
+      font->shelf_y += font->shelf_height;
+      font->shelf_x = 0;
+      font->shelf_height = 0;
+    }
+
+  needed = font->shelf_y + glyph->height;
+  if (needed > font->atlas_height)
+    gromit_font_grow_atlas (font, MAX (needed, 2 * font->atlas_height));
+
+  glyph->atlas_x = font->shelf_x;
+  glyph->atlas_y = font->shelf_y;
+
+  bitmap = gdk_bitmap_create_from_data (NULL, (gchar *) glyph->bits,
+                                        glyph->width, glyph->height);
+  gdk_draw_drawable (font->atlas, font->atlas_gc, bitmap, 0, 0,
+                     glyph->atlas_x, glyph->atlas_y,
+                     glyph->width, glyph->height);
+  g_object_unref (bitmap);
+
+  font->shelf_x += glyph->width + 1;
+  font->shelf_height = MAX (font->shelf_height, glyph->height + 1);
+}
+
+
+static GromitGlyph *
+gromit_font_render (GromitFont *font, gunichar c)
+{
+  GromitGlyph     *glyph;
+  PangoLayout     *layout;
+  PangoRectangle   ink, logical;
+  cairo_surface_t *surface;
+  cairo_t         *cr;
+  GdkRectangle     span;
+  guchar          *pixels, *row, *bits;
+  gchar            utf8[6];
+  gint             len, stride, x, y, start;
+
+  len = g_unichar_to_utf8 (c, utf8);
+  layout = pango_layout_new (font->context);
+  pango_layout_set_font_description (layout, font->desc);
+  pango_layout_set_text (layout, utf8, len);
+  pango_layout_get_pixel_extents (layout, &ink, &logical);
+
+  glyph = g_malloc (sizeof (GromitGlyph));
+
+  glyph->x_offset = ink.x;
+  glyph->y_offset = ink.y;
+  glyph->width = MAX (ink.width, 0);
+  glyph->height = MAX (ink.height, 0);
+  glyph->advance = logical.width;
+  glyph->bytes_per_line = (glyph->width + 7) / 8;
+  glyph->bits = g_malloc0 (MAX (glyph->bytes_per_line * glyph->height, 1));
+  glyph->region = gdk_region_new ();
+  glyph->atlas_x = 0;
+  glyph->atlas_y = 0;
+
+  if (glyph->width > 0 && glyph->height > 0)
+    {
+      surface = cairo_image_surface_create (CAIRO_FORMAT_A8,
+                                            glyph->width, glyph->height);
+      cr = cairo_create (surface);
+      cairo_move_to (cr, -ink.x, -ink.y);
+      pango_cairo_show_layout (cr, layout);
+      cairo_destroy (cr);
+      cairo_surface_flush (surface);
+
+      pixels = cairo_image_surface_get_data (surface);
+      stride = cairo_image_surface_get_stride (surface);
+
+      for (y = 0; y < glyph->height; y++)
+        {
+          row = pixels + y * stride;
+          bits = glyph->bits + y * glyph->bytes_per_line;
+          start = -1;
+
+          for (x = 0; x <= glyph->width; x++)
+            {
+              if (x < glyph->width && row[x] >= 128)
+                {
+                  bits[x >> 3] |= 1 << (x & 7);
+                  if (start < 0)
+                    start = x;
+                }
+              else if (start >= 0)
+                {
+                  span.x = start;
+                  span.y = y;
+                  span.width = x - start;
+                  span.height = 1;
+                  gdk_region_union_with_rect (glyph->region, &span);
+                  start = -1;
+                }
+            }
+        }
+
+      cairo_surface_destroy (surface);
+      gromit_font_pack (font, glyph);
+    }
+
+  g_object_unref (layout);
+
+  return glyph;
+}
+
+
+GromitGlyph *
+gromit_font_glyph (GromitFont *font, gunichar c)
+{
+  GromitGlyph *glyph;
+
+  glyph = g_hash_table_lookup (font->glyphs, GUINT_TO_POINTER (c));
+  if (!glyph)
+    {
+      glyph = gromit_font_render (font, c);
+      g_hash_table_insert (font->glyphs, GUINT_TO_POINTER (c), glyph);
+    }
+
+  return glyph;
+}
@@ -0,0 +1,74 @@
+/* Gromit -- a program for painting on the screen
+ * Copyright (C) 2000 Simon Budig <Simon.Budig@unix-ag.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __GROMIT_GLYPH_H__
+#define __GROMIT_GLYPH_H__
+
+#include <glib.h>
+#include <gdk/gdk.h>
+
+/*
+ * A glyph cache for the TEXT tool. Every glyph gets rasterized once
+ * per font and size into a 1 bpp bitmap (aliased, like all of Gromit's
+ * drawing). The bitmaps are kept client side for the raster and region
+ * code and packed into a server side atlas, so drawing a glyph is just
+ * a fill through a clip mask.
+ */
+
+#define GROMIT_DEFAULT_FONT "Sans"
+
+typedef struct
+{
+  gint       x_offset;      /* of the bitmap, relative to the pen */
+  gint       y_offset;      /* position at the top of the line */
+  gint       width;
+  gint       height;
+  gint       advance;
+
+  guchar    *bits;          /* LSB first, like XBM data */
+  gint       bytes_per_line;
+  GdkRegion *region;        /* the set bits, at 0, 0 */
+
+  gint       atlas_x;
+  gint       atlas_y;
+} GromitGlyph;
+
+typedef struct
+{
+  gchar                *name;
+  gint                  size;
+  gint                  height;      /* of a line */
+
+  PangoContext         *context;
+  PangoFontDescription *desc;
+  GHashTable           *glyphs;      /* gunichar -> GromitGlyph */
+
+  GdkBitmap            *atlas;
+  GdkGC                *atlas_gc;
+  gint                  atlas_width;
+  gint                  atlas_height;
+  gint                  shelf_x;
+  gint                  shelf_y;
+  gint                  shelf_height;
+} GromitFont;
+
+
+GromitFont  *gromit_font_get   (const gchar *name, gint size);
+GromitGlyph *gromit_font_glyph (GromitFont *font, gunichar c);
+
+#endif /* __GROMIT_GLYPH_H__ */
@@ -22,12 +22,29 @@
 #include <gdk/gdkx.h>
 #include <gtk/gtk.h>
 
+#include <X11/extensions/XShm.h>
+#include <X11/extensions/Xfixes.h>
+#include <X11/extensions/Xrender.h>
+#include <X11/extensions/shape.h>
+
 #include <errno.h>
 #include <fcntl.h>
 #include <string.h>
 #include <unistd.h>
 #include <math.h>
 #include <stdlib.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+
+#include "raster.h"
+#include "stroke.h"
+#include "worker.h"
+#include "glyph.h"
+#include "stream.h"
+#include "render.h"
+#include "trace.h"
+#include "tiles.h"
+#include "session.h"
 
 int debug = 0;
 
@@ -55,32 +72,144 @@ int debug = 0;
 #define GA_TOGGLE     gdk_atom_intern ("Gromit/toggle", FALSE)
 #define GA_VISIBILITY gdk_atom_intern ("Gromit/visibility", FALSE)
 #define GA_CLEAR      gdk_atom_intern ("Gromit/clear", FALSE)
+#define GA_NEXTPAGE   gdk_atom_intern ("Gromit/nextpage", FALSE)
+#define GA_PREVPAGE   gdk_atom_intern ("Gromit/prevpage", FALSE)
+#define GA_FREEZE     gdk_atom_intern ("Gromit/freeze", FALSE)
 
+/* "Gromit/page1", "Gromit/page2", ... select a page directly */
+#define GA_PAGE_PREFIX "Gromit/page"
+
+#define GROMIT_DEFAULT_PAGES 9
+
+/* the predicted tail never gets longer than this */
+#define GROMIT_PREDICT_MAX_DISTANCE 64
+
+/* seconds a hidden window keeps its buffers */
+#define GROMIT_DEFAULT_IDLE_RELEASE 60
+
+/* ms the windows below get to redraw before the screen gets frozen */
+#define GROMIT_FREEZE_DELAY 100
+
+/* tools of the publisher a mirror keeps, they live as long as strokes */
+#define GROMIT_MIRROR_MAX_TOOLS 256
+
+/* line width GCs kept per tool, see gromit_paint_context_gc () */
+#define GROMIT_GC_BUCKETS 32
+
+/* a page gets redrawn from its strokes in idle slices of this many ms,
+ * in tiles of this size, the ones near the pointer first */
+#define GROMIT_REDRAW_SLICE 4
+#define GROMIT_REDRAW_TILE 128
+
+/* the X server round trip gets measured at most every that many ms.
+ * Above the high mark (smoothed, in ms) the quality goes down a level,
+ * below the low mark up again, but a level is kept for the hold time */
+#define GROMIT_LATENCY_INTERVAL 500
+#define GROMIT_LATENCY_HIGH 30
+#define GROMIT_LATENCY_LOW 8
+#define GROMIT_QUALITY_HOLD 2000
+#define GROMIT_QUALITY_MAX 3
+
+/* room around the painted area of a window that is not grabbing */
+#define GROMIT_WINDOW_MARGIN 64
+/* and what it grows by beyond that, to grow less often */
+#define GROMIT_WINDOW_SLACK 256
 
-typedef enum
-{
-  GROMIT_PEN,
-  GROMIT_ERASER,
-  GROMIT_RECOLOR
-} GromitPaintType;
 
 typedef struct
 {
   GromitPaintType type;
   guint           width;
   gfloat          arrowsize;
+  gfloat          opacity;
+  gchar          *font;
   GdkColor       *fg_color;
   GdkGC          *paint_gc;
   GdkGC          *shape_gc;
+  GdkGC          *paint_gcs[GROMIT_GC_BUCKETS];
+  GdkGC          *shape_gcs[GROMIT_GC_BUCKETS];
   gdouble         pressure;
 } GromitPaintContext;
 
+/*
+ * The backing store of an annotation page. The current page lives in
+ * the corresponding fields of GromitData, switching pages just swaps
+ * them. The buffers only exist while the page is realized, the strokes
+ * are kept all the time and are used to redraw the page.
+ */
+
 typedef struct
 {
-  gint x;
-  gint y;
-  gint width;
-} GromitStrokeCoordinate;
+  GdkPixmap       *pixmap;
+  GdkBitmap       *shape;
+  GromitRaster    *raster;
+  XImage          *shm_image;
+  XShmSegmentInfo  shm_info;
+  XImage          *shape_image;
+  GdkRegion       *painted_region;
+  GdkRegion       *grid_region;
+  GdkRegion       *grid_pending;
+  XserverRegion    shape_region;
+  Picture          picture;
+  GList           *strokes;
+  guint            painted;
+} GromitPage;
+
+
+/* The stroke state of one input device. Like the pages, the record of
+ * the device that sent the last event lives in GromitData itself.
+ */
+typedef struct
+{
+  GdkDevice          *device;
+  guint               state;
+  GromitPaintContext *cur_context;
+  gdouble             lastx;
+  gdouble             lasty;
+  guint32             motion_time;
+  GList              *coordlist;
+  guint               maxwidth;
+  GromitStroke       *cur_stroke;
+  gdouble             predict_x;
+  gdouble             predict_y;
+  guint32             predict_time;
+  gdouble             velocity_x;
+  gdouble             velocity_y;
+  GdkRegion          *highlight_region;
+  GtkWidget          *preview;
+  gboolean            previewing;
+  gint                anchor_x;
+  gint                anchor_y;
+  gint                fix_x;
+  gint                fix_y;
+} GromitPointer;
+
+
+/*
+ * A page being redrawn from its strokes in the background. Each tile
+ * queues the strokes touching it, oldest first. A stroke is drawn when
+ * it is at the head of all of its queues, so that overlapping strokes
+ * keep their order.
+ */
+typedef struct
+{
+  GPtrArray        *strokes;         /* oldest first */
+  GQueue           *tiles;           /* of stroke indices */
+  gint              cols;
+  gint              rows;
+  guint             left;
+  gint              current;         /* the stroke being drawn or -1 */
+  GromitStrokeIter  iter;
+  GdkRectangle      dirty;           /* drawn since the last slice */
+  GTimer           *timer;
+  guint             idle_id;
+  GromitPointer    *previous;        /* the state to go back to */
+  GromitPointer     outside;         /* the same if there was no device yet */
+
+  gboolean          parallel;        /* tiles rendered by the tile pool */
+  GromitRaster     *raster;
+  guint32           outline;         /* of the arrowheads */
+} GromitRedraw;
 
 
 typedef struct
@@ -112,6 +241,7 @@ typedef struct
   GHashTable  *tool_config;
 
   GdkBitmap   *shape;
+  GdkBitmap   *empty_shape;
   GdkGC       *shape_gc;
   GdkGCValues *shape_gcv;
   GdkColor    *transparent;
@@ -126,6 +256,7 @@ typedef struct
   guint        state;
 
   guint        timeout_id;
+  guint        shape_id;
   guint        modified;
   guint        delayed;
   guint        maxwidth;
@@ -135,35 +266,158 @@ typedef struct
   guint        client;
   guint        painted;
   guint        hidden;
+
+  GdkRectangle win_rect;        /* where the window is on the screen */
+  GdkRectangle painted_box;     /* holds everything painted so far */
+
+  gboolean         client_render;
+  GromitRaster    *raster;
+  XImage          *shm_image;
+  XShmSegmentInfo  shm_info;
+  GC               raster_gc;
+  XImage          *shape_image;
+  GC               shape_xgc;
+  GdkRectangle     shape_dirty;
+
+  gchar           *session_path;
+  GromitSession   *session;
+  GdkRectangle     session_dirty;    /* not in the session file yet */
+
+  gboolean         region_shape;
+  GdkRegion       *painted_region;
+  GdkRegion       *shape_add;
+  GdkRegion       *shape_sub;
+  XserverRegion    shape_region;
+  gint             shape_grid;
+  GdkRegion       *grid_region;
+  GdkRegion       *grid_pending;     /* blocks to bring back, see below */
+  GdkBitmap       *grid_mask;        /* the grid without --region-shape */
+  GdkRectangle     grid_dirty;
+  GdkRegion       *grid_erased;
+  GdkRectangle     shape_erased;     /* in data->shape, not committed yet */
+
+  GromitPage      *pages;
+  guint            n_pages;
+  guint            cur_page;
+
+  GList           *strokes;        /* newest first */
+  GromitStroke    *cur_stroke;
+  gboolean         replaying;
+  GromitRedraw    *redraw;           /* NULL unless the page is redrawn */
+  guint            idle_release;
+  guint            idle_release_id;
+
+  gboolean         geometry_thread;
+  GromitWorker    *worker;
+  guint            render_threads;   /* 0 is one per core */
+  GromitTilePool  *tile_pool;
+
+  gboolean         adaptive;         /* follow the X server latency */
+  guint            quality;          /* 0 is full, see gromit_quality_sample () */
+  gdouble          latency;          /* smoothed round trip in ms */
+  gint64           latency_time;     /* of the last sample */
+  gint64           quality_time;     /* of the last change */
+  guint            reshape_ticks;
+
+  guint            predict;          /* ms to look ahead, 0 is off */
+  gdouble          predict_x;
+  gdouble          predict_y;
+  guint32          predict_time;
+  gdouble          velocity_x;       /* pixels per ms */
+  gdouble          velocity_y;
+  gboolean         predicted;
+  GdkRectangle     predict_rect;
+  GdkPixmap       *predict_under;
+  GdkBitmap       *predict_shape_under;
+  gboolean         shape_stale;
+
+  gboolean         xrender;
+  Picture          picture;
+  GdkGC           *backdrop_gc;
+  GdkRegion       *highlight_region;
+
+  GromitStroke    *text_stroke;      /* the label being typed */
+  gint             text_pen_x;
+  gint             text_pen_y;
+  GtkWidget       *caret;
+
+  GtkWidget       *preview;          /* rubber band of the shape tools */
+  GdkGC           *preview_gc;
+  gboolean         previewing;
+  gint             anchor_x;
+  gint             anchor_y;
+  gint             fix_x;            /* see gromit_pointer_fix () */
+  gint             fix_y;
+
+  GHashTable      *pointers;         /* GdkDevice/stream -> GromitPointer */
+  GromitPointer   *pointer;          /* the one loaded into the fields */
+
+  gchar           *publish_path;
+  gchar           *mirror_path;
+  GromitStream    *publisher;
+  GromitStream    *mirror;
+  GromitStroke    *published_stroke; /* the last one sent to the mirrors */
+  GHashTable      *mirror_tools;
+
+  gboolean         frozen;           /* showing a still image of the screen */
+  guint            freeze_id;
+  GdkPixmap       *backdrop;
+  GdkGC           *frozen_gc;
+
+  gchar           *trace_path;
+  gchar           *replay_path;
+  GromitTrace     *trace;            /* recording the input */
+  GromitTrace     *replay;           /* feeding recorded input */
+  GdkEvent        *replay_event;     /* the one being handled */
+  GdkEvent        *replay_next;
+  gboolean         replay_fast;
+  guint            replay_count;
+  GTimer          *replay_timer;
 } GromitData;
 
 
 /* I need a prototype...  */
 void gromit_release_grab (GromitData *data);
 void gromit_acquire_grab (GromitData *data);
+void gromit_page_realize (GromitData *data);
+void gromit_release_pages (GromitData *data);
+void gromit_text_end (GromitData *data);
+void gromit_publish_page (GromitData *data);
+void gromit_unfreeze (GromitData *data);
+void gromit_shape_cancel (GromitData *data);
 
 GromitPaintContext *
 gromit_paint_context_new (GromitData *data, GromitPaintType type,
-                          GdkColor *fg_color, guint width, guint arrowsize)
+                          GdkColor *fg_color, guint width, guint arrowsize,
+                          gfloat opacity)
 {
   GromitPaintContext *context;
   GdkGCValues   shape_gcv;
+  gint          i;
 
   context = g_malloc (sizeof (GromitPaintContext));
 
   context->type = type;
   context->width = width;
   context->arrowsize = arrowsize;
+  context->opacity = opacity;
+  context->font = NULL;
   context->fg_color = fg_color;
 
+  for (i = 0; i < GROMIT_GC_BUCKETS; i++)
+    {
+      context->paint_gcs[i] = NULL;
+      context->shape_gcs[i] = NULL;
+    }
+
   if (type == GROMIT_ERASER)
     {
       context->paint_gc = NULL;
     }
   else
     {
-      /* GROMIT_PEN || GROMIT_RECOLOR */
-      context->paint_gc = gdk_gc_new (data->pixmap);
+      /* pens, highlighters, text and the shape tools */
+      context->paint_gc = gdk_gc_new (data->root);
       gdk_gc_set_foreground (context->paint_gc, fg_color);
       gdk_gc_set_line_attributes (context->paint_gc, width, GDK_LINE_SOLID,
                                   GDK_CAP_ROUND, GDK_JOIN_ROUND);
@@ -175,14 +429,14 @@ gromit_paint_context_new (GromitData *data, GromitPaintType type,
     }
   else
     {
-      /* GROMIT_PEN || GROMIT_ERASER */
-      context->shape_gc = gdk_gc_new (data->shape);
+      /* everything but GROMIT_RECOLOR */
+      context->shape_gc = gdk_gc_new (data->empty_shape);
       gdk_gc_get_values (context->shape_gc, &shape_gcv);
 
       if (type == GROMIT_ERASER)
          gdk_gc_set_foreground (context->shape_gc, &(shape_gcv.foreground));
       else
-         /* GROMIT_PEN */
+         /* pens, highlighters, text and the shape tools */
          gdk_gc_set_foreground (context->shape_gc, &(shape_gcv.background));
       gdk_gc_set_line_attributes (context->shape_gc, width, GDK_LINE_SOLID,
                                   GDK_CAP_ROUND, GDK_JOIN_ROUND);
@@ -204,22 +458,83 @@ gromit_paint_context_print (gchar *name, GromitPaintContext *context)
       g_printerr ("Eraser,  "); break;
     case GROMIT_RECOLOR:
       g_printerr ("Recolor, "); break;
+    case GROMIT_HIGHLIGHTER:
+      g_printerr ("Highlighter, "); break;
+    case GROMIT_TEXT:
+      g_printerr ("Text,    "); break;
+    case GROMIT_LINE:
+      g_printerr ("Line,    "); break;
+    case GROMIT_RECT:
+      g_printerr ("Rect,    "); break;
+    case GROMIT_ELLIPSE:
+      g_printerr ("Ellipse, "); break;
     default:
       g_printerr ("UNKNOWN, "); break;
   }
 
   g_printerr ("width: %3d, ", context->width);
   g_printerr ("arrowsize: %.2f, ", context->arrowsize);
+  g_printerr ("opacity: %.2f, ", context->opacity);
   g_printerr ("color: #%02X%02X%02X\n", context->fg_color->red >> 8,
               context->fg_color->green >> 8, context->fg_color->blue >> 8);
 }
 
 
+/*
+ * Pressure sensitive strokes change the line width with almost every
+ * event. Instead of changing the line attributes of one GC for every
+ * segment, each tool keeps a GC per width bucket: exact below 16 pixels,
+ * rounded up to multiples of 4 above. Only lines wider than the last
+ * bucket still change the base GC.
+ */
+GdkGC *
+gromit_paint_context_gc (GromitData *data, GromitPaintContext *context,
+                         gboolean shape, guint width)
+{
+  GdkGC **cache = shape ? context->shape_gcs : context->paint_gcs;
+  GdkGC  *base = shape ? context->shape_gc : context->paint_gc;
+  guint   bucket;
+
+  if (width >= 16)
+    width = (width + 3) & ~3;
+  bucket = width < 16 ? width : 12 + width / 4;
+
+  if (bucket >= GROMIT_GC_BUCKETS)
+    {
+      gdk_gc_set_line_attributes (base, width, GDK_LINE_SOLID,
+                                  GDK_CAP_ROUND, GDK_JOIN_ROUND);
+      return base;
+    }
+
+  if (!cache[bucket])
+    {
+      cache[bucket] = gdk_gc_new (shape ? data->empty_shape : data->root);
+      gdk_gc_copy (cache[bucket], base);
+      gdk_gc_set_line_attributes (cache[bucket], width, GDK_LINE_SOLID,
+                                  GDK_CAP_ROUND, GDK_JOIN_ROUND);
+    }
+
+  return cache[bucket];
+}
+
+
 void
 gromit_paint_context_free (GromitPaintContext *context)
 {
-  g_object_unref (context->paint_gc);
-  g_object_unref (context->shape_gc);
+  gint i;
+
+  for (i = 0; i < GROMIT_GC_BUCKETS; i++)
+    {
+      if (context->paint_gcs[i])
+        g_object_unref (context->paint_gcs[i]);
+      if (context->shape_gcs[i])
+        g_object_unref (context->shape_gcs[i]);
+    }
+
+  if (context->paint_gc)
+    g_object_unref (context->paint_gc);
+  if (context->shape_gc)
+    g_object_unref (context->shape_gc);
   g_free (context);
 }
 
@@ -307,346 +622,4196 @@ gromit_coord_list_get_arrow_param (GromitData *data,
 }
 
 
-void
-gromit_hide_window (GromitData *data)
+/*
+ * Client side rendering: the strokes are rasterized into data->raster,
+ * which lives in a MIT-SHM segment. Only the dirty rectangles get
+ * uploaded to data->pixmap, the coverage gets packed into data->shape
+ * when the shape is committed in reshape().
+ */
+
+/* allocate the client side buffers of the current page */
+gboolean
+gromit_raster_alloc (GromitData *data)
 {
-  if (!data->hidden)
+  Display   *dpy = GDK_DISPLAY_XDISPLAY (data->display);
+  GdkVisual *visual = gdk_screen_get_system_visual (data->screen);
+  XImage    *image;
+  gint       bytes_per_line;
+  gchar     *bits;
+
+  image = XShmCreateImage (dpy, GDK_VISUAL_XVISUAL (visual), visual->depth,
+                           ZPixmap, NULL, &data->shm_info,
+                           data->width, data->height);
+  if (!image)
     {
-      if (data->hard_grab)
-        data->hidden = 2;
-      else
-        data->hidden = 1;
-      gromit_release_grab (data);
-      gtk_widget_hide (data->win);
+      g_printerr ("Unable to create a shared image\n");
+      return FALSE;
+    }
+
+  if (image->bits_per_pixel != 32)
+    {
+      g_printerr ("Client side rendering needs a 32 bpp visual\n");
+      XDestroyImage (image);
+      return FALSE;
     }
-}
 
+  data->shm_info.shmid = shmget (IPC_PRIVATE,
+                                 image->bytes_per_line * image->height,
+                                 IPC_CREAT | 0600);
+  if (data->shm_info.shmid < 0)
+    {
+      g_printerr ("shmget failed: %s\n", g_strerror (errno));
+      XDestroyImage (image);
+      return FALSE;
+    }
 
-void
-gromit_show_window (GromitData *data)
-{
-  gint oldstatus = data->hidden;
+  data->shm_info.shmaddr = image->data = shmat (data->shm_info.shmid, NULL, 0);
+  data->shm_info.readOnly = False;
 
-  if (data->hidden)
+  gdk_error_trap_push ();
+  XShmAttach (dpy, &data->shm_info);
+  XSync (dpy, False);
+
+  /* the segment vanishes as soon as both sides have detached */
+  shmctl (data->shm_info.shmid, IPC_RMID, NULL);
+
+  if (gdk_error_trap_pop ())
     {
-      gtk_widget_show (data->win);
-      data->hidden = 0;
-      if (oldstatus == 2)
-        gromit_acquire_grab (data);
+      /* e.g. a remote display */
+      g_printerr ("Unable to attach the shared memory segment\n");
+      shmdt (data->shm_info.shmaddr);
+      image->data = NULL;
+      XDestroyImage (image);
+      return FALSE;
     }
-  gdk_window_raise (data->win->window);
+
+  data->shm_image = image;
+  data->raster = gromit_raster_new (data->width, data->height,
+                                    (guint32 *) image->data,
+                                    image->bytes_per_line / 4);
+  gromit_raster_clear (data->raster, data->black->pixel);
+
+  /* client side copy of the shape bitmap */
+  bytes_per_line = (data->width + 7) / 8;
+  bits = g_malloc0 (bytes_per_line * data->height);
+  data->shape_image = XCreateImage (dpy, GDK_VISUAL_XVISUAL (visual), 1,
+                                    XYPixmap, 0, bits,
+                                    data->width, data->height,
+                                    8, bytes_per_line);
+  data->shape_image->bitmap_bit_order = LSBFirst;
+  data->shape_image->byte_order = LSBFirst;
+  XInitImage (data->shape_image);
+
+  data->shape_dirty.width = data->shape_dirty.height = 0;
+
+  return TRUE;
 }
 
 
+/* the counterpart of gromit_raster_alloc () */
 void
-gromit_toggle_visibility (GromitData *data)
+gromit_raster_destroy (GromitData *data)
 {
-  if (data->hidden)
-    gromit_show_window (data);
-  else
-    gromit_hide_window (data);
+  Display *dpy = GDK_DISPLAY_XDISPLAY (data->display);
+
+  XShmDetach (dpy, &data->shm_info);
+  XDestroyImage (data->shm_image);
+  shmdt (data->shm_info.shmaddr);
+  gromit_raster_free (data->raster);
+
+  g_free (data->shape_image->data);
+  data->shape_image->data = NULL;
+  XDestroyImage (data->shape_image);
+
+  data->raster = NULL;
+  data->shm_image = NULL;
+  data->shape_image = NULL;
 }
 
 
-void
-gromit_release_grab (GromitData *data)
+gboolean
+gromit_client_render_setup (GromitData *data)
 {
-  if (data->hard_grab)
+  Display *dpy = GDK_DISPLAY_XDISPLAY (data->display);
+
+  if (!XShmQueryExtension (dpy))
     {
-      data->hard_grab = 0;
-      gdk_display_pointer_ungrab (data->display, GDK_CURRENT_TIME);
-      /* inherit cursor from root window */
-      gdk_window_set_cursor (data->win->window, NULL);
+      g_printerr ("Client side rendering needs the MIT-SHM extension\n");
+      return FALSE;
     }
 
-  if (!data->painted)
-    gromit_hide_window (data);
+  data->raster_gc = XCreateGC (dpy, GDK_WINDOW_XID (data->root), 0, NULL);
+  data->shape_xgc = XCreateGC (dpy, GDK_PIXMAP_XID (data->empty_shape),
+                               0, NULL);
+
+  if (debug)
+    g_printerr ("Client side rendering, %s mask packing\n",
+                gromit_raster_pack_kernel ());
+
+  return TRUE;
 }
 
 
-void
-gromit_acquire_grab (GromitData *data)
+GromitRasterOp
+gromit_raster_op (GromitPaintContext *context)
 {
-  GdkGrabStatus result;
+  if (context->type == GROMIT_ERASER)
+    return GROMIT_RASTER_ERASE;
+  else if (context->type == GROMIT_RECOLOR)
+    return GROMIT_RASTER_RECOLOR;
+  else
+    return GROMIT_RASTER_PAINT;
+}
 
-  gromit_show_window (data);
-  if (!data->hard_grab)
-    {
-      result = gdk_pointer_grab (data->area->window, FALSE,
-                                 GROMIT_MOUSE_EVENTS, 0,
-                                 NULL /* data->paint_cursor */,
-                                 GDK_CURRENT_TIME);
 
-      switch (result)
-      {
-        case GDK_GRAB_SUCCESS:
-           data->hard_grab = 1;
-           break;
-        case GDK_GRAB_ALREADY_GRABBED:
-           g_printerr ("Grabbing Pointer failed: %s\n", "AlreadyGrabbed");
-           break;
-        case GDK_GRAB_INVALID_TIME:
-           g_printerr ("Grabbing Pointer failed: %s\n", "GrabInvalidTime");
-           break;
-        case GDK_GRAB_NOT_VIEWABLE:
-           g_printerr ("Grabbing Pointer failed: %s\n", "GrabNotViewable");
-           break;
-        case GDK_GRAB_FROZEN:
-           g_printerr ("Grabbing Pointer failed: %s\n", "GrabFrozen");
-           break;
-        default:
-           g_printerr ("Grabbing Pointer failed: %s\n", "Unknown error");
-      }
+void gromit_worker_finish (GromitData *data);
 
-      if (data->cur_context->type == GROMIT_ERASER)
-         gdk_window_set_cursor (data->win->window, data->erase_cursor);
-      else
-         gdk_window_set_cursor (data->win->window, data->paint_cursor);
-    }
+/*
+ * With --session, what changes in the raster of the current page gets
+ * collected in session_dirty and copied into the session file whenever
+ * the shape is committed.
+ */
+
+void
+gromit_persist_dirty (GromitData *data, GdkRectangle *rect)
+{
+  if (data->session && data->raster)
+    gromit_rect_union (&data->session_dirty, rect);
 }
 
 
-gint
-reshape (gpointer user_data)
+void
+gromit_persist_flush (GromitData *data)
 {
-  GromitData *data = (GromitData *) user_data;
-
-  if (data->modified)
+  if (data->session && data->raster && data->session_dirty.width > 0)
     {
-      if (gtk_events_pending () && data->delayed < 5)
-        {
-          data->delayed++ ;
-        }
-      else
-        {
-          gtk_widget_shape_combine_mask (data->win, data->shape, 0,0);
-          data->modified = 0;
-          data->delayed = 0;
-        }
+      gromit_worker_finish (data);
+      gromit_session_store (data->session, data->cur_page, data->raster,
+                            &data->session_dirty);
     }
-  return 1;
+  data->session_dirty.width = data->session_dirty.height = 0;
 }
 
 
+/* the raster of the current page is complete */
 void
-gromit_toggle_grab (GromitData *data)
+gromit_persist_done (GromitData *data)
 {
-  if (data->hard_grab) {
-    gtk_timeout_remove (data->timeout_id);
-    gromit_release_grab (data);
-  } else {
-    data->timeout_id = gtk_timeout_add (20, reshape, data);
-    gromit_acquire_grab (data);
-  }
+  gromit_persist_flush (data);
+  if (data->session && data->raster)
+    gromit_session_done (data->session, data->cur_page);
 }
 
 
 void
-gromit_clear_screen (GromitData *data)
+gromit_raster_put (GromitData *data, GdkRectangle *rect)
 {
-  gdk_gc_set_foreground (data->shape_gc, data->transparent);
-  gdk_draw_rectangle (data->shape, data->shape_gc, 1,
-                      0, 0, data->width, data->height);
-  gtk_widget_shape_combine_mask (data->win, data->shape, 0,0);
-  if (!data->hard_grab)
-    gromit_hide_window (data);
-  data->painted = 0;
+  if (rect->width <= 0 || rect->height <= 0)
+    return;
+
+  /* No XSync here: the server might read the segment while we are
+   * already painting the next segment into it. Since we only ever
+   * write newer content, that is harmless - the next upload of the
+   * same area fixes it up anyway.
+   */
+  XShmPutImage (GDK_DISPLAY_XDISPLAY (data->display),
+                GDK_PIXMAP_XID (data->pixmap), data->raster_gc,
+                data->shm_image,
+                rect->x, rect->y, rect->x, rect->y,
+                rect->width, rect->height, False);
 }
 
 
 void
-gromit_select_tool (GromitData *data, GdkDevice *device, guint state)
+gromit_raster_upload (GromitData *data, GdkRectangle *rect)
 {
-  guint buttons = 0, modifier = 0, len = 0;
-  guint req_buttons = 0, req_modifier = 0;
-  guint i, j, success = 0;
-  GromitPaintContext *context = NULL;
-  guchar *name;
+  gromit_raster_put (data, rect);
+  gromit_persist_dirty (data, rect);
+}
 
-  if (device)
-    {
-      len = strlen (device->name);
-      name = g_strndup (device->name, len + 3);
 
-      /* Extract Button/Modifiers from state (see GdkModifierType) */
-      req_buttons = (state >> 8) & 31;
+/*
+ * Returns FALSE if the coverage did not change the shape at all, e.g.
+ * when painting over already painted areas.
+ */
 
-      req_modifier = (state >> 1) & 7;
-      if (state & GDK_SHIFT_MASK) req_modifier |= 1;
+gboolean
+gromit_raster_commit_rect (GromitData *data, GdkRectangle *rect)
+{
+  GdkRectangle  changed;
 
-      name [len] = 124;
-      name [len+3] = 0;
+  if (rect->width <= 0 || rect->height <= 0)
+    return FALSE;
 
-      /*  0, 1, 3, 7, 15, 31 */
-      context = NULL;
-      i=-1;
-      do
-        {
-          i++;
-          buttons = req_buttons & ((1 << i)-1);
-          j=-1;
-          do
-            {
-              j++;
-              modifier = req_modifier & ((1 << j)-1);
-              name [len+1] = buttons + 64;
-              name [len+2] = modifier + 48;
-              context = g_hash_table_lookup (data->tool_config, name);
-              if (context)
-                {
-                  data->cur_context = context;
-                  success = 1;
-                }
-            }
-          while (j<=3 && req_modifier >= (1 << j));
-        }
-      while (i<=5 && req_buttons >= (1 << i));
+  gromit_worker_finish (data);
 
-      g_free (name);
+  gromit_raster_pack_mask (data->raster, rect,
+                           (guchar *) data->shape_image->data,
+                           data->shape_image->bytes_per_line, &changed);
 
-      if (!success)
-        {
-          if (device->source == GDK_SOURCE_ERASER)
-            data->cur_context = data->default_eraser;
-          else
-            data->cur_context = data->default_pen;
-        }
-    }
-  else
-    {
-      g_printerr ("ERROR: Attempt to select nonexistent device!\n");
-      data->cur_context = data->default_pen;
-    }
+  if (changed.width <= 0)
+    return FALSE;
 
-  if (data->cur_context->type == GROMIT_ERASER)
-    gdk_window_set_cursor (data->win->window, data->erase_cursor);
-  else
-    gdk_window_set_cursor (data->win->window, data->paint_cursor);
+  XPutImage (GDK_DISPLAY_XDISPLAY (data->display),
+             GDK_PIXMAP_XID (data->shape), data->shape_xgc,
+             data->shape_image,
+             changed.x, changed.y, changed.x, changed.y,
+             changed.width, changed.height);
 
-  data->state = state;
-  data->device = device;
+  return TRUE;
 }
 
 
-void
-gromit_draw_line (GromitData *data, gint x1, gint y1,
-                  gint x2, gint y2)
+gboolean
+gromit_raster_commit_shape (GromitData *data)
 {
-  GdkRectangle rect;
-  static gint prev_x1=0, prev_y1=0, prev_x2=0, prev_y2=0;
-
-  if (debug) fprintf(stderr, "line (%d,%d) (%d,%d)\n", x1, y1, x2, y2);
+  GdkRectangle *rect = &data->shape_dirty;
+  gboolean      changed;
 
-  // strange left-corner line bugfix
-  if (x1) prev_x1 = x1; else x1 = prev_x1;
-  if (y1) prev_y1 = y1; else y1 = prev_y1;
-  if (x2) prev_x2 = x2; else x2 = prev_x2;
-  if (y2) prev_y2 = y2; else y2 = prev_y2;
+  gromit_persist_dirty (data, rect);
+  changed = gromit_raster_commit_rect (data, rect);
+  rect->width = rect->height = 0;
 
-  rect.x = MIN (x1,x2) - data->maxwidth / 2;
-  rect.y = MIN (y1,y2) - data->maxwidth / 2;
-  rect.width = ABS (x1-x2) + data->maxwidth;
-  rect.height = ABS (y1-y2) + data->maxwidth;
+  return changed;
+}
 
-  if (data->cur_context->paint_gc)
-    gdk_gc_set_line_attributes (data->cur_context->paint_gc,
-                                data->maxwidth, GDK_LINE_SOLID,
-                                GDK_CAP_ROUND, GDK_JOIN_ROUND);
-  if (data->cur_context->shape_gc)
-    gdk_gc_set_line_attributes (data->cur_context->shape_gc,
-                                data->maxwidth, GDK_LINE_SOLID,
-                                GDK_CAP_ROUND, GDK_JOIN_ROUND);
 
-  if (data->cur_context->paint_gc)
-    gdk_draw_line (data->pixmap, data->cur_context->paint_gc,
-                   x1, y1, x2, y2);
+/*
+ * Region based shaping (--region-shape): instead of drawing into the
+ * shape bitmap (which the server has to convert into a region on every
+ * reshape) the painted area is tracked as a client side region. The
+ * spans added or erased since the last commit are collected in
+ * shape_add/shape_sub and applied to the server side region as a delta.
+ */
+
+gboolean
+gromit_region_shape_setup (GromitData *data)
+{
+  Display *dpy = GDK_DISPLAY_XDISPLAY (data->display);
+  gint     event_base, error_base, major = 0, minor = 0;
+
+  if (!XFixesQueryExtension (dpy, &event_base, &error_base) ||
+      !XFixesQueryVersion (dpy, &major, &minor) || major < 2)
+    {
+      g_printerr ("Region based shaping needs XFixes 2.0\n");
+      return FALSE;
+    }
+
+  data->shape_add = gdk_region_new ();
+  data->shape_sub = gdk_region_new ();
+
+  return TRUE;
+}
+
+
+/*
+ * Keep shape_add and shape_sub disjoint, then the order in which they
+ * get applied does not matter.
+ */
+
+void
+gromit_region_add (GromitData *data, GdkRegion *region, gboolean erase)
+{
+  if (erase)
+    {
+      GdkRectangle box;
+
+      gdk_region_subtract (data->shape_add, region);
+      gdk_region_union (data->shape_sub, region);
+
+      /* the coverage of the raster changes without an upload */
+      gdk_region_get_clipbox (region, &box);
+      gromit_persist_dirty (data, &box);
+    }
+  else
+    {
+      gdk_region_subtract (data->shape_sub, region);
+      gdk_region_union (data->shape_add, region);
+    }
+  data->modified = 1;
+}
+
+
+XRectangle *
+gromit_region_to_xrects (GdkRegion *region, gint *nrects)
+{
+  GdkRectangle  *rects;
+  XRectangle    *xrects;
+  gint           i;
+
+  gdk_region_get_rectangles (region, &rects, nrects);
+  xrects = g_new (XRectangle, MAX (*nrects, 1));
+  for (i = 0; i < *nrects; i++)
+    {
+      xrects[i].x = rects[i].x;
+      xrects[i].y = rects[i].y;
+      xrects[i].width = rects[i].width;
+      xrects[i].height = rects[i].height;
+    }
+
+  g_free (rects);
+
+  return xrects;
+}
+
+
+XserverRegion
+gromit_region_to_xfixes (Display *dpy, GdkRegion *region)
+{
+  XRectangle    *xrects;
+  XserverRegion  xregion;
+  gint           nrects;
+
+  xrects = gromit_region_to_xrects (region, &nrects);
+  xregion = XFixesCreateRegion (dpy, xrects, nrects);
+  g_free (xrects);
+
+  return xregion;
+}
+
+
+static gint
+gromit_grid_floor (gint v, gint grid)
+{
+  return (v >= 0 ? v / grid : - ((grid - 1 - v) / grid)) * grid;
+}
+
+
+/* the blocks of the shape grid touched by region */
+GdkRegion *
+gromit_region_snap (GdkRegion *region, gint grid)
+{
+  GdkRegion    *blocks = gdk_region_new ();
+  GdkRectangle *rects, block;
+  gint          i, nrects;
+
+  gdk_region_get_rectangles (region, &rects, &nrects);
+
+  for (i = 0; i < nrects; i++)
+    {
+      block.x = gromit_grid_floor (rects[i].x, grid);
+      block.y = gromit_grid_floor (rects[i].y, grid);
+      block.width = gromit_grid_floor (rects[i].x + rects[i].width
+                                       + grid - 1, grid) - block.x;
+      block.height = gromit_grid_floor (rects[i].y + rects[i].height
+                                        + grid - 1, grid) - block.y;
+      gdk_region_union_with_rect (blocks, &block);
+    }
+
+  g_free (rects);
+
+  return blocks;
+}
+
+
+void gromit_highlight_backdrop (GromitData *data, GdkRegion *area);
+
+void gromit_shape_later (GromitData *data);
+void gromit_commit_shape (GromitData *data);
+
+/*
+ * With a shape grid the window shape only changes in whole blocks. A
+ * block is dropped when something in it gets erased, newly covered
+ * blocks get the screen copied into their unpainted pixels so the
+ * coarse shape does not show up as a halo. Dropped blocks that still hold
+ * paint come back a moment later, as newly covered blocks: by then the
+ * screen below shows through where the eraser went.
+ */
+static void
+gromit_region_flush_grid (GromitData *data)
+{
+  Display       *dpy = GDK_DISPLAY_XDISPLAY (data->display);
+  XserverRegion  delta;
+  GdkRegion     *blocks, *dropped = NULL;
+
+  if (!gdk_region_empty (data->grid_pending))
+    {
+      gdk_region_intersect (data->grid_pending, data->painted_region);
+      gdk_region_subtract (data->grid_pending, data->shape_sub);
+      gdk_region_union (data->shape_add, data->grid_pending);
+      gdk_region_destroy (data->grid_pending);
+      data->grid_pending = gdk_region_new ();
+    }
+
+  if (!gdk_region_empty (data->shape_sub))
+    {
+      dropped = gromit_region_snap (data->shape_sub, data->shape_grid);
+      gdk_region_subtract (data->grid_region, dropped);
+      delta = gromit_region_to_xfixes (dpy, dropped);
+      XFixesSubtractRegion (dpy, data->shape_region, data->shape_region, delta);
+      XFixesDestroyRegion (dpy, delta);
+    }
+
+  /* under load, new blocks get coarser, see gromit_quality_sample () */
+  if (!gdk_region_empty (data->shape_add))
+    {
+      blocks = gromit_region_snap (data->shape_add,
+                                   data->shape_grid << data->quality);
+      gdk_region_subtract (blocks, data->grid_region);
+
+      /* the screen still shows the erased paint there, the block comes
+       * back with the pending ones
+       */
+      if (dropped)
+        gdk_region_subtract (blocks, dropped);
+      if (!gdk_region_empty (blocks))
+        {
+          gromit_highlight_backdrop (data, blocks);
+          gdk_region_union (data->grid_region, blocks);
+          delta = gromit_region_to_xfixes (dpy, blocks);
+          XFixesUnionRegion (dpy, data->shape_region, data->shape_region, delta);
+          XFixesDestroyRegion (dpy, delta);
+        }
+      gdk_region_destroy (blocks);
+    }
+
+  gdk_region_union (data->painted_region, data->shape_add);
+  gdk_region_destroy (data->shape_add);
+  data->shape_add = gdk_region_new ();
+
+  gdk_region_subtract (data->painted_region, data->shape_sub);
+  gdk_region_destroy (data->shape_sub);
+  data->shape_sub = gdk_region_new ();
+
+  if (dropped)
+    {
+      gdk_region_intersect (dropped, data->painted_region);
+      if (!gdk_region_empty (dropped))
+        {
+          gdk_region_union (data->grid_pending, dropped);
+          gromit_shape_later (data);
+        }
+      gdk_region_destroy (dropped);
+    }
+}
+
+
+/*
+ * The shape grid works on the shape mask as well: the window then gets
+ * a copy of data->shape in which every block with paint in it is set as
+ * a whole. grid_dirty collects where data->shape changed, grid_erased
+ * where something got erased, just like shape_add and shape_sub.
+ * shape_erased is kept without a grid as well, for the highlighter.
+ */
+
+void
+gromit_grid_dirty (GromitData *data, GdkRectangle *rect, gboolean erase)
+{
+  if (erase)
+    gromit_rect_union (&data->shape_erased, rect);
+
+  if (!data->grid_mask)
+    return;
+
+  gromit_rect_union (&data->grid_dirty, rect);
+  if (erase)
+    gdk_region_union_with_rect (data->grid_erased, rect);
+}
+
+
+/* the blocks of area (aligned to the grid) that have paint in them */
+static GdkRegion *
+gromit_grid_scan (GromitData *data, GdkRectangle *area)
+{
+  GdkRegion    *blocks = gdk_region_new ();
+  GdkRectangle  block;
+  XImage       *image;
+  gint          grid = data->shape_grid;
+  gint          x, y, x2, y2;
+  gboolean      painted;
+
+  image = XGetImage (GDK_DISPLAY_XDISPLAY (data->display),
+                     GDK_PIXMAP_XID (data->shape),
+                     area->x, area->y, area->width, area->height,
+                     1, XYPixmap);
+  if (!image)
+    return blocks;
+
+  block.width = block.height = grid;
+  for (block.y = 0; block.y < area->height; block.y += grid)
+    for (block.x = 0; block.x < area->width; block.x += grid)
+      {
+        x2 = MIN (block.x + grid, area->width);
+        y2 = MIN (block.y + grid, area->height);
+        painted = FALSE;
+
+        for (y = block.y; y < y2 && !painted; y++)
+          for (x = block.x; x < x2 && !painted; x++)
+            painted = XGetPixel (image, x, y) != data->transparent->pixel;
+
+        if (painted)
+          {
+            GdkRectangle rect = { area->x + block.x, area->y + block.y,
+                                  grid, grid };
+
+            gdk_region_union_with_rect (blocks, &rect);
+          }
+      }
+
+  XDestroyImage (image);
+
+  return blocks;
+}
+
+
+/* redraws area of the grid mask from the blocks of the current page */
+static void
+gromit_grid_draw (GromitData *data, GdkRectangle *area)
+{
+  GdkRegion    *blocks = gdk_region_rectangle (area);
+  GdkRectangle *rects;
+  gint          i, nrects;
+
+  gdk_region_intersect (blocks, data->grid_region);
+  gdk_region_get_rectangles (blocks, &rects, &nrects);
+
+  gdk_gc_set_foreground (data->shape_gc, data->transparent);
+  gdk_draw_rectangle (data->grid_mask, data->shape_gc, TRUE,
+                      area->x, area->y, area->width, area->height);
+  gdk_gc_set_foreground (data->shape_gc, data->opaque);
+  for (i = 0; i < nrects; i++)
+    gdk_draw_rectangle (data->grid_mask, data->shape_gc, TRUE,
+                        rects[i].x, rects[i].y,
+                        rects[i].width, rects[i].height);
+  gdk_gc_set_foreground (data->shape_gc, data->transparent);
+
+  g_free (rects);
+  gdk_region_destroy (blocks);
+}
+
+
+/*
+ * Brings the blocks of the current page up to date with data->shape.
+ * Newly covered blocks get the screen copied into their unpainted
+ * pixels. Erased blocks are dropped, those with paint left come back a
+ * moment later, when the screen below shows through where the eraser
+ * went, see gromit_region_flush_grid ().
+ */
+void
+gromit_grid_update (GromitData *data)
+{
+  GdkRectangle  all = { 0, 0, data->width, data->height };
+  GdkRectangle  area, pending;
+  GdkRegion    *blocks, *kept, *fresh, *scanned;
+  gint          grid = data->shape_grid;
+
+  if (!data->grid_mask || !data->shape)
+    return;
+
+  gdk_region_get_clipbox (data->grid_pending, &pending);
+  gromit_rect_union (&data->grid_dirty, &pending);
+
+  area.x = gromit_grid_floor (data->grid_dirty.x, grid);
+  area.y = gromit_grid_floor (data->grid_dirty.y, grid);
+  area.width = gromit_grid_floor (data->grid_dirty.x + data->grid_dirty.width
+                                  + grid - 1, grid) - area.x;
+  area.height = gromit_grid_floor (data->grid_dirty.y + data->grid_dirty.height
+                                   + grid - 1, grid) - area.y;
+  data->grid_dirty.width = data->grid_dirty.height = 0;
+
+  kept = gromit_region_snap (data->grid_erased, grid);
+  gdk_region_destroy (data->grid_erased);
+  data->grid_erased = gdk_region_new ();
+
+  if (!gdk_rectangle_intersect (&area, &all, &area))
+    {
+      gdk_region_destroy (kept);
+      return;
+    }
+
+  blocks = gromit_grid_scan (data, &area);
+
+  gdk_region_intersect (kept, blocks);
+  gdk_region_subtract (blocks, kept);
+  gdk_region_destroy (data->grid_pending);
+  data->grid_pending = kept;
+  if (!gdk_region_empty (kept))
+    gromit_shape_later (data);
+
+  fresh = gdk_region_copy (blocks);
+  gdk_region_subtract (fresh, data->grid_region);
+  if (!gdk_region_empty (fresh))
+    gromit_highlight_backdrop (data, fresh);
+  gdk_region_destroy (fresh);
+
+  scanned = gdk_region_rectangle (&area);
+  gdk_region_subtract (data->grid_region, scanned);
+  gdk_region_union (data->grid_region, blocks);
+  gdk_region_destroy (scanned);
+  gdk_region_destroy (blocks);
+
+  gromit_grid_draw (data, &area);
+
+  if (debug)
+    {
+      GdkRectangle *rects;
+      gint          nrects;
+
+      gdk_region_get_rectangles (data->grid_region, &rects, &nrects);
+      g_printerr ("Shape grid: %d rectangles\n", nrects);
+      g_free (rects);
+    }
+}
+
+
+/* the mask for the window, with all the grid mask is redrawn as a whole */
+GdkBitmap *
+gromit_shape_mask (GromitData *data, gboolean all)
+{
+  GdkRectangle screen = { 0, 0, data->width, data->height };
+
+  if (!data->grid_mask)
+    return data->shape;
+
+  gromit_grid_update (data);
+  if (all)
+    gromit_grid_draw (data, &screen);
+
+  return data->grid_mask;
+}
+
+
+/* apply the pending deltas to the regions of the current page */
+void
+gromit_region_flush (GromitData *data)
+{
+  Display       *dpy = GDK_DISPLAY_XDISPLAY (data->display);
+  XserverRegion  delta;
+
+  if (data->shape_grid)
+    {
+      gromit_region_flush_grid (data);
+      return;
+    }
+
+  if (!gdk_region_empty (data->shape_add))
+    {
+      delta = gromit_region_to_xfixes (dpy, data->shape_add);
+      XFixesUnionRegion (dpy, data->shape_region, data->shape_region, delta);
+      XFixesDestroyRegion (dpy, delta);
+      gdk_region_union (data->painted_region, data->shape_add);
+      gdk_region_destroy (data->shape_add);
+      data->shape_add = gdk_region_new ();
+    }
+
+  if (!gdk_region_empty (data->shape_sub))
+    {
+      delta = gromit_region_to_xfixes (dpy, data->shape_sub);
+      XFixesSubtractRegion (dpy, data->shape_region, data->shape_region, delta);
+      XFixesDestroyRegion (dpy, delta);
+      gdk_region_subtract (data->painted_region, data->shape_sub);
+      gdk_region_destroy (data->shape_sub);
+      data->shape_sub = gdk_region_new ();
+    }
+}
+
+
+void
+gromit_region_commit (GromitData *data)
+{
+  Display *dpy = GDK_DISPLAY_XDISPLAY (data->display);
+
+  gromit_region_flush (data);
+
+  XFixesSetWindowShapeRegion (dpy, GDK_WINDOW_XID (data->win->window),
+                              ShapeBounding,
+                              -data->win_rect.x, -data->win_rect.y,
+                              data->shape_region);
+
+  if (debug)
+    {
+      GdkRectangle *rects;
+      gint          nrects;
+
+      gdk_region_get_rectangles (data->shape_grid ? data->grid_region
+                                                  : data->painted_region,
+                                 &rects, &nrects);
+      g_printerr ("shape region: %d rectangles\n", nrects);
+      g_free (rects);
+    }
+}
+
+
+/* drop the pending deltas */
+void
+gromit_region_clear (GromitData *data)
+{
+  gdk_region_destroy (data->shape_add);
+  gdk_region_destroy (data->shape_sub);
+  data->shape_add = gdk_region_new ();
+  data->shape_sub = gdk_region_new ();
+}
+
+
+/*
+ * The HIGHLIGHTER tool blends its color over what is on the screen with
+ * XRender, all on the server side. Where the page is not painted yet the
+ * pixmap first gets a copy of the screen underneath. Every pixel of a
+ * stroke gets blended only once: highlight_region keeps track of what
+ * the current stroke already covers.
+ */
+
+gboolean
+gromit_highlighting (GromitData *data)
+{
+  return (data->cur_context->type == GROMIT_HIGHLIGHTER &&
+          data->picture != None && !data->raster);
+}
+
+
+void
+gromit_highlight_reset (GromitData *data)
+{
+  if (data->highlight_region)
+    gdk_region_destroy (data->highlight_region);
+  data->highlight_region = NULL;
+}
+
+
+/* copy the screen (or the frozen image of it) into the unpainted
+ * parts of area
+ */
+void
+gromit_highlight_backdrop (GromitData *data, GdkRegion *area)
+{
+  GdkDrawable *source = data->frozen ? data->backdrop : data->root;
+  GdkRectangle rect;
+
+  gdk_region_get_clipbox (area, &rect);
+
+  if (data->region_shape)
+    {
+      GdkRegion *backdrop = gdk_region_copy (area);
+
+      /* painted_region still holds what is erased but not committed,
+       * the window covers that part of the screen
+       */
+      gdk_region_subtract (backdrop, data->painted_region);
+      gdk_region_subtract (backdrop, data->shape_add);
+
+      gdk_gc_set_clip_region (data->backdrop_gc, backdrop);
+      gdk_draw_drawable (data->pixmap, data->backdrop_gc, source,
+                         rect.x, rect.y, rect.x, rect.y,
+                         rect.width, rect.height);
+      gdk_gc_set_clip_region (data->backdrop_gc, NULL);
+
+      gdk_region_destroy (backdrop);
+    }
+  else
+    {
+      /* the inverted shape is the unpainted part */
+      GdkBitmap *clip = gdk_pixmap_new (NULL, rect.width, rect.height, 1);
+
+      gdk_draw_drawable (clip, data->shape_gc, data->shape,
+                         rect.x, rect.y, 0, 0, rect.width, rect.height);
+      gdk_gc_set_function (data->shape_gc, GDK_INVERT);
+      gdk_draw_rectangle (clip, data->shape_gc, TRUE,
+                          0, 0, rect.width, rect.height);
+      gdk_gc_set_function (data->shape_gc, GDK_COPY);
+
+      gdk_gc_set_clip_mask (data->backdrop_gc, clip);
+      gdk_gc_set_clip_origin (data->backdrop_gc, rect.x, rect.y);
+      gdk_draw_drawable (data->pixmap, data->backdrop_gc, source,
+                         rect.x, rect.y, rect.x, rect.y,
+                         rect.width, rect.height);
+      gdk_gc_set_clip_mask (data->backdrop_gc, NULL);
+
+      g_object_unref (clip);
+    }
+}
+
+
+/* whether delta has something erased that the window still shows */
+gboolean
+gromit_highlight_stale (GromitData *data, GdkRegion *delta)
+{
+  GdkRegion    *erased;
+  GdkRectangle  rect;
+  gboolean      stale;
+
+  if (data->region_shape)
+    {
+      erased = gdk_region_copy (delta);
+      gdk_region_intersect (erased, data->shape_sub);
+      stale = !gdk_region_empty (erased);
+      gdk_region_destroy (erased);
+      return stale;
+    }
+
+  gdk_region_get_clipbox (delta, &rect);
+  return gdk_rectangle_intersect (&rect, &data->shape_erased, &rect);
+}
+
+
+/* takes over delta */
+void
+gromit_highlight (GromitData *data, GdkRegion *delta)
+{
+  GromitPaintContext *context = data->cur_context;
+  XRenderColor        color;
+  XRectangle         *rects;
+  gint                nrects;
+
+  if (data->highlight_region)
+    gdk_region_subtract (delta, data->highlight_region);
+  else
+    data->highlight_region = gdk_region_new ();
+
+  if (!gdk_region_empty (delta))
+    {
+      gdk_region_union (data->highlight_region, delta);
+
+      /* the screen is the backdrop, it must not show erased paint */
+      if (!data->frozen && gromit_highlight_stale (data, delta))
+        {
+          gromit_commit_shape (data);
+          XSync (GDK_DISPLAY_XDISPLAY (data->display), False);
+        }
+      gromit_highlight_backdrop (data, delta);
+
+      /* premultiplied */
+      color.red = context->fg_color->red * context->opacity;
+      color.green = context->fg_color->green * context->opacity;
+      color.blue = context->fg_color->blue * context->opacity;
+      color.alpha = 0xffff * context->opacity;
+
+      rects = gromit_region_to_xrects (delta, &nrects);
+      XRenderFillRectangles (GDK_DISPLAY_XDISPLAY (data->display),
+                             PictOpOver, data->picture, &color,
+                             rects, nrects);
+      g_free (rects);
+    }
+
+  gdk_region_destroy (delta);
+}
+
+
+void
+gromit_highlight_line (GromitData *data, gint x1, gint y1,
+                       gint x2, gint y2)
+{
+  GdkRegion *delta = gdk_region_new ();
+
+  gromit_line_spans (x1, y1, x2, y2, data->maxwidth,
+                     gromit_region_span, delta);
+  gromit_highlight (data, delta);
+}
+
+
+/*
+ * The buffers and the shape are in screen coordinates, the window only
+ * covers data->win_rect of the screen. These refresh a rectangle of the
+ * screen in the window, NULL means all of it.
+ */
+
+void
+gromit_area_draw (GromitData *data, GdkRectangle *rect)
+{
+  GdkRectangle area = *rect;
+
+  area.x -= data->win_rect.x;
+  area.y -= data->win_rect.y;
+  gtk_widget_draw (data->area, &area);
+}
+
+
+void
+gromit_area_invalidate (GromitData *data, GdkRectangle *rect)
+{
+  GdkRectangle area;
+
+  if (!rect)
+    {
+      gdk_window_invalidate_rect (data->area->window, NULL, FALSE);
+      return;
+    }
+
+  area = *rect;
+  area.x -= data->win_rect.x;
+  area.y -= data->win_rect.y;
+  gdk_window_invalidate_rect (data->area->window, &area, FALSE);
+}
+
+
+/*
+ * With --geometry-thread the rasterization of the client side rendering
+ * happens on a worker thread (see worker.c). The finished batches come
+ * back here to be uploaded.
+ */
+
+guint
+gromit_work_flags (GromitData *data)
+{
+  GromitPaintContext *context = data->cur_context;
+  guint               flags = 0;
+
+  if (context->paint_gc)
+    flags |= GROMIT_WORK_PAINT;
+  if (context->shape_gc)
+    flags |= data->region_shape ? GROMIT_WORK_REGION : GROMIT_WORK_SHAPE;
+  if (context->type == GROMIT_ERASER)
+    flags |= GROMIT_WORK_ERASE;
+
+  return flags;
+}
+
+
+void
+gromit_worker_result (GromitWorkResult *result, gpointer user_data)
+{
+  GromitData *data = (GromitData *) user_data;
+
+  if (result->paint_dirty.width > 0)
+    {
+      gromit_raster_upload (data, &result->paint_dirty);
+      gromit_area_draw (data, &result->paint_dirty);
+    }
+
+  if (result->shape_dirty.width > 0)
+    {
+      gromit_rect_union (&data->shape_dirty, &result->shape_dirty);
+      data->modified = 1;
+    }
+
+  if (result->shape_add)
+    {
+      gromit_region_add (data, result->shape_add, FALSE);
+      gdk_region_destroy (result->shape_add);
+    }
+
+  if (result->shape_sub)
+    {
+      gromit_region_add (data, result->shape_sub, TRUE);
+      gdk_region_destroy (result->shape_sub);
+    }
+}
+
+
+/*
+ * The results get uploaded from the raster, which the worker would
+ * still be writing with the next batch: wait for it to catch up. This
+ * runs when the main loop is idle, so it hardly waits for anything.
+ */
+gboolean
+gromit_worker_notify (gpointer user_data)
+{
+  GromitData *data = (GromitData *) user_data;
+
+  gromit_worker_finish (data);
+
+  return FALSE;
+}
+
+
+/*
+ * The buffers of the current page are about to change hands, or get
+ * read: the worker must not be writing them meanwhile.
+ */
+void
+gromit_worker_finish (GromitData *data)
+{
+  if (data->worker)
+    gromit_worker_sync (data->worker, gromit_worker_result, data);
+}
+
+
+/*
+ * Motion prediction (--predict): the line gets extended along the
+ * current pen velocity by a provisional segment. What it covers is
+ * saved and put back before the next real segment gets drawn. With
+ * client side rendering the raster still holds the real content, so
+ * only the server side copies have to be restored. Otherwise the saved
+ * part goes into pixmaps that are kept, sized for the longest tail.
+ */
+
+void
+gromit_predict_clear (GromitData *data)
+{
+  GdkRectangle *rect = &data->predict_rect;
+
+  if (!data->predicted)
+    return;
+
+  if (data->raster)
+    {
+      gromit_worker_finish (data);
+      gromit_raster_upload (data, rect);
+      if (!data->region_shape)
+        XPutImage (GDK_DISPLAY_XDISPLAY (data->display),
+                   GDK_PIXMAP_XID (data->shape), data->shape_xgc,
+                   data->shape_image,
+                   rect->x, rect->y, rect->x, rect->y,
+                   rect->width, rect->height);
+    }
+  else
+    {
+      gdk_draw_drawable (data->pixmap,
+                         data->area->style->fg_gc[GTK_WIDGET_STATE (data->area)],
+                         data->predict_under, 0, 0, rect->x, rect->y,
+                         rect->width, rect->height);
+
+      if (!data->region_shape)
+        {
+          gdk_draw_drawable (data->shape, data->shape_gc,
+                             data->predict_shape_under, 0, 0,
+                             rect->x, rect->y, rect->width, rect->height);
+          gromit_grid_dirty (data, rect, FALSE);
+        }
+    }
+
+  /* the region commit always sets the real shape again */
+  data->shape_stale = TRUE;
+  data->modified = 1;
+
+  gromit_area_draw (data, rect);
+  data->predicted = FALSE;
+}
+
+
+/* makes sure the save pixmaps hold width x height */
+void
+gromit_predict_reserve (GromitData *data, gint width, gint height)
+{
+  gint size = GROMIT_PREDICT_MAX_DISTANCE + data->maxwidth + 4;
+  gint w = 0, h = 0;
+
+  if (data->predict_under)
+    gdk_drawable_get_size (data->predict_under, &w, &h);
+
+  if (width > w || height > h)
+    {
+      w = MAX (MAX (w, width), size);
+      h = MAX (MAX (h, height), size);
+
+      if (data->predict_under)
+        g_object_unref (data->predict_under);
+      if (data->predict_shape_under)
+        g_object_unref (data->predict_shape_under);
+
+      data->predict_under = gdk_pixmap_new (data->pixmap, w, h, -1);
+      data->predict_shape_under = NULL;
+    }
+
+  if (!data->region_shape && !data->predict_shape_under)
+    data->predict_shape_under = gdk_pixmap_new (data->shape, w, h, 1);
+}
+
+
+void
+gromit_predict_draw (GromitData *data, gint x1, gint y1, gint x2, gint y2)
+{
+  GromitPaintContext *context = data->cur_context;
+  GdkRectangle        screen = { 0, 0, data->width, data->height };
+  GdkRectangle       *rect = &data->predict_rect;
+  gint                margin = data->maxwidth / 2 + 1;
+
+  rect->x = MIN (x1, x2) - margin;
+  rect->y = MIN (y1, y2) - margin;
+  rect->width = ABS (x1 - x2) + 2 * margin;
+  rect->height = ABS (y1 - y2) + 2 * margin;
+  if (!gdk_rectangle_intersect (rect, &screen, rect))
+    return;
+
+  if (!data->raster)
+    {
+      gromit_predict_reserve (data, rect->width, rect->height);
+      gdk_draw_drawable (data->predict_under,
+                         data->area->style->fg_gc[GTK_WIDGET_STATE (data->area)],
+                         data->pixmap, rect->x, rect->y, 0, 0,
+                         rect->width, rect->height);
+
+      if (!data->region_shape)
+        {
+          gdk_draw_drawable (data->predict_shape_under, data->shape_gc,
+                             data->shape, rect->x, rect->y, 0, 0,
+                             rect->width, rect->height);
+        }
+    }
+
+  gdk_draw_line (data->pixmap,
+                 gromit_paint_context_gc (data, context, FALSE, data->maxwidth),
+                 x1, y1, x2, y2);
+
+  if (data->region_shape)
+    {
+      Display       *dpy = GDK_DISPLAY_XDISPLAY (data->display);
+      GdkRegion     *tail = gdk_region_new ();
+      XserverRegion  shape;
+
+      gromit_region_flush (data);
+      gromit_line_spans (x1, y1, x2, y2, data->maxwidth,
+                         gromit_region_span, tail);
+      shape = gromit_region_to_xfixes (dpy, tail);
+      XFixesUnionRegion (dpy, shape, shape, data->shape_region);
+      XFixesSetWindowShapeRegion (dpy, GDK_WINDOW_XID (data->win->window),
+                                  ShapeBounding,
+                                  -data->win_rect.x, -data->win_rect.y,
+                                  shape);
+      XFixesDestroyRegion (dpy, shape);
+      gdk_region_destroy (tail);
+    }
+  else
+    {
+      gdk_draw_line (data->shape,
+                     gromit_paint_context_gc (data, context, TRUE,
+                                              data->maxwidth),
+                     x1, y1, x2, y2);
+      gromit_grid_dirty (data, rect, FALSE);
+      data->shape_stale = TRUE;
+      data->modified = 1;
+    }
+
+  gromit_area_draw (data, rect);
+  data->predicted = TRUE;
+}
+
+
+/* feed a real sample, then extrapolate from it */
+void
+gromit_predict (GromitData *data, guint32 time, gdouble x, gdouble y)
+{
+  gdouble dt = (gint32) (time - data->predict_time);
+  gdouble dx, dy, distance;
+
+  if (data->predict_time && dt > 0 && dt < 100)
+    {
+      /* a little smoothing against jittery samples */
+      data->velocity_x = (data->velocity_x + (x - data->predict_x) / dt) / 2;
+      data->velocity_y = (data->velocity_y + (y - data->predict_y) / dt) / 2;
+    }
+  else if (dt != 0)
+    {
+      data->velocity_x = 0;
+      data->velocity_y = 0;
+    }
+
+  data->predict_x = x;
+  data->predict_y = y;
+  data->predict_time = time;
+
+  /* a frozen window has no shape to get ahead of */
+  if (!data->predict || !data->pixmap || data->frozen ||
+      data->cur_context->type != GROMIT_PEN)
+    return;
+
+  dx = data->velocity_x * data->predict;
+  dy = data->velocity_y * data->predict;
+  distance = sqrt (dx * dx + dy * dy);
+
+  if (distance < 1)
+    return;
+
+  if (distance > GROMIT_PREDICT_MAX_DISTANCE)
+    {
+      dx *= GROMIT_PREDICT_MAX_DISTANCE / distance;
+      dy *= GROMIT_PREDICT_MAX_DISTANCE / distance;
+    }
+
+  gromit_predict_draw (data, x, y, x + dx, y + dy);
+}
+
+
+/*
+ * Several devices may draw at the same time. Each of them has its own
+ * stroke state, the event handlers swap it in before they start. The
+ * strokes coming in from a publisher get a record of their own, keyed
+ * by the stream.
+ */
+
+void
+gromit_pointer_save (GromitData *data, GromitPointer *pointer)
+{
+  pointer->device = data->device;
+  pointer->state = data->state;
+  pointer->cur_context = data->cur_context;
+  pointer->lastx = data->lastx;
+  pointer->lasty = data->lasty;
+  pointer->motion_time = data->motion_time;
+  pointer->coordlist = data->coordlist;
+  pointer->maxwidth = data->maxwidth;
+  pointer->cur_stroke = data->cur_stroke;
+  pointer->predict_x = data->predict_x;
+  pointer->predict_y = data->predict_y;
+  pointer->predict_time = data->predict_time;
+  pointer->velocity_x = data->velocity_x;
+  pointer->velocity_y = data->velocity_y;
+  pointer->highlight_region = data->highlight_region;
+  pointer->preview = data->preview;
+  pointer->previewing = data->previewing;
+  pointer->anchor_x = data->anchor_x;
+  pointer->anchor_y = data->anchor_y;
+  pointer->fix_x = data->fix_x;
+  pointer->fix_y = data->fix_y;
+}
+
+
+void
+gromit_pointer_load (GromitData *data, GromitPointer *pointer)
+{
+  data->device = pointer->device;
+  data->state = pointer->state;
+  data->cur_context = pointer->cur_context;
+  data->lastx = pointer->lastx;
+  data->lasty = pointer->lasty;
+  data->motion_time = pointer->motion_time;
+  data->coordlist = pointer->coordlist;
+  data->maxwidth = pointer->maxwidth;
+  data->cur_stroke = pointer->cur_stroke;
+  data->predict_x = pointer->predict_x;
+  data->predict_y = pointer->predict_y;
+  data->predict_time = pointer->predict_time;
+  data->velocity_x = pointer->velocity_x;
+  data->velocity_y = pointer->velocity_y;
+  data->highlight_region = pointer->highlight_region;
+  data->preview = pointer->preview;
+  data->previewing = pointer->previewing;
+  data->anchor_x = pointer->anchor_x;
+  data->anchor_y = pointer->anchor_y;
+  data->fix_x = pointer->fix_x;
+  data->fix_y = pointer->fix_y;
+}
+
+
+void
+gromit_pointer_switch (GromitData *data, gpointer key)
+{
+  GromitPointer *pointer;
+
+  if (data->pointer && g_hash_table_lookup (data->pointers, key) ==
+                       data->pointer)
+    return;
+
+  /* the predicted tail belongs to the previous device */
+  gromit_predict_clear (data);
+
+  if (data->pointer)
+    gromit_pointer_save (data, data->pointer);
+
+  pointer = g_hash_table_lookup (data->pointers, key);
+  if (!pointer)
+    {
+      pointer = g_new0 (GromitPointer, 1);
+      pointer->cur_context = data->default_pen;
+      g_hash_table_insert (data->pointers, key, pointer);
+    }
+
+  gromit_pointer_load (data, pointer);
+  data->pointer = pointer;
+}
+
+
+/*
+ * Strange left-corner line bugfix: some devices report a coordinate of
+ * 0 now and then, that one gets the last good one of the same device.
+ * Only for the input events, strokes that get redrawn or mirrored are
+ * fine already.
+ */
+void
+gromit_pointer_fix (GromitData *data, gdouble *x, gdouble *y)
+{
+  if ((gint) *x) data->fix_x = *x; else *x = data->fix_x;
+  if ((gint) *y) data->fix_y = *y; else *y = data->fix_y;
+}
+
+
+/* the strokes of the current page are gone */
+void
+gromit_pointer_drop_stroke (gpointer key, gpointer value, gpointer user_data)
+{
+  GromitPointer *pointer = value;
+
+  if (pointer == ((GromitData *) user_data)->pointer)
+    return;
+
+  pointer->cur_stroke = NULL;
+  if (pointer->highlight_region)
+    gdk_region_destroy (pointer->highlight_region);
+  pointer->highlight_region = NULL;
+}
+
+
+void
+gromit_pointers_drop_strokes (GromitData *data)
+{
+  g_hash_table_foreach (data->pointers, gromit_pointer_drop_stroke, data);
+  data->cur_stroke = NULL;
+  gromit_highlight_reset (data);
+}
+
+
+void
+gromit_pointer_cancel (gpointer key, gpointer value, gpointer user_data)
+{
+  GromitPointer *pointer = value;
+
+  if (pointer == ((GromitData *) user_data)->pointer || !pointer->previewing)
+    return;
+
+  gtk_widget_hide (pointer->preview);
+  pointer->previewing = FALSE;
+}
+
+
+/* takes the rubber bands of all devices off the screen */
+void
+gromit_pointers_cancel (GromitData *data)
+{
+  g_hash_table_foreach (data->pointers, gromit_pointer_cancel, data);
+  gromit_shape_cancel (data);
+}
+
+
+gboolean
+gromit_idle_release (gpointer user_data)
+{
+  GromitData *data = (GromitData *) user_data;
+
+  if (data->hidden)
+    {
+      gromit_release_pages (data);
+      if (debug)
+        g_printerr ("Released the buffers of all pages\n");
+    }
+
+  data->idle_release_id = 0;
+  return FALSE;
+}
+
+
+/* opens the session file for the current screen, or takes fd if it
+ * is not -1
+ */
+GromitSession *
+gromit_session_setup (GromitData *data, const gchar *filename, gint fd)
+{
+  GdkVisual *visual = gdk_screen_get_system_visual (data->screen);
+  guint32    format[4];
+
+  format[0] = visual->depth;
+  format[1] = visual->red_mask;
+  format[2] = visual->green_mask;
+  format[3] = visual->blue_mask;
+
+  if (fd >= 0)
+    return gromit_session_open_fd (fd, filename, data->width, data->height,
+                                   format, data->n_pages);
+
+  return gromit_session_open (filename, data->width, data->height,
+                              format, data->n_pages);
+}
+
+
+/* the current page has something to show once it is realized */
+gboolean
+gromit_page_restorable (GromitData *data)
+{
+  return data->strokes ||
+         (data->session &&
+          gromit_session_stored (data->session, data->cur_page));
+}
+
+
+void
+gromit_hide_window (GromitData *data)
+{
+  if (!data->hidden)
+    {
+      gromit_unfreeze (data);
+
+      if (data->hard_grab)
+        data->hidden = 2;
+      else
+        data->hidden = 1;
+      gromit_release_grab (data);
+      gtk_widget_hide (data->win);
+
+      if (data->idle_release && !data->idle_release_id)
+        data->idle_release_id = g_timeout_add_seconds (data->idle_release,
+                                                       gromit_idle_release,
+                                                       data);
+    }
+}
+
+
+void
+gromit_show_window (GromitData *data)
+{
+  gint oldstatus = data->hidden;
+
+  if (data->idle_release_id)
+    {
+      g_source_remove (data->idle_release_id);
+      data->idle_release_id = 0;
+    }
+
+  if (data->hidden)
+    {
+      if (gromit_page_restorable (data) && !data->pixmap)
+        gromit_page_realize (data);
+      gtk_widget_show (data->win);
+      data->hidden = 0;
+      if (oldstatus == 2)
+        gromit_acquire_grab (data);
+    }
+  gdk_window_raise (data->win->window);
+}
+
+
+void
+gromit_toggle_visibility (GromitData *data)
+{
+  if (data->hidden)
+    gromit_show_window (data);
+  else
+    gromit_hide_window (data);
+}
+
+
+/*
+ * While it is not grabbing the pointer, the window only covers the
+ * painted part of the screen with a margin around it, so that the
+ * window manager, drag and drop and the X server have less to deal
+ * with. The window grows as soon as something gets painted outside of
+ * it, by some slack more than needed. Shrinking waits for the grab to
+ * end or the page to change and only happens when it frees more than
+ * half of the window. Without any paint the window is down to a single
+ * (unshaped away) pixel.
+ */
+
+void gromit_apply_shape (GromitData *data);
+
+void
+gromit_window_place (GromitData *data, const GdkRectangle *rect)
+{
+  if (rect->x == data->win_rect.x && rect->y == data->win_rect.y &&
+      rect->width == data->win_rect.width &&
+      rect->height == data->win_rect.height)
+    return;
+
+  data->win_rect = *rect;
+
+  gtk_drawing_area_size (GTK_DRAWING_AREA (data->area),
+                         rect->width, rect->height);
+  gtk_widget_set_usize (GTK_WIDGET (data->win), rect->width, rect->height);
+  gtk_window_resize (GTK_WINDOW (data->win), rect->width, rect->height);
+  gtk_window_move (GTK_WINDOW (data->win), rect->x, rect->y);
+
+  /* the shape offset is relative to the new position already, so
+   * don't wait for GTK to get around to the resize */
+  gdk_window_move_resize (data->win->window,
+                          rect->x, rect->y, rect->width, rect->height);
+  gdk_window_resize (data->area->window, rect->width, rect->height);
+
+  /* freezing has taken the shape away for the snapshot */
+  if (!data->freeze_id)
+    gromit_apply_shape (data);
+  gromit_area_invalidate (data, NULL);
+
+  if (debug)
+    g_printerr ("Window at %dx%d+%d+%d\n",
+                rect->width, rect->height, rect->x, rect->y);
+}
+
+
+void
+gromit_window_fit (GromitData *data, gboolean shrink)
+{
+  GdkRectangle screen = { 0, 0, data->width, data->height };
+  GdkRectangle want;
+
+  if (data->hard_grab || data->frozen || data->freeze_id)
+    {
+      gromit_window_place (data, &screen);
+      return;
+    }
+
+  if (data->painted_box.width <= 0 || data->painted_box.height <= 0)
+    {
+      GdkRectangle nothing = { 0, 0, 1, 1 };
+
+      if (shrink)
+        gromit_window_place (data, &nothing);
+      return;
+    }
+
+  want.x = data->painted_box.x - GROMIT_WINDOW_MARGIN;
+  want.y = data->painted_box.y - GROMIT_WINDOW_MARGIN;
+  want.width = data->painted_box.width + 2 * GROMIT_WINDOW_MARGIN;
+  want.height = data->painted_box.height + 2 * GROMIT_WINDOW_MARGIN;
+  if (!gdk_rectangle_intersect (&want, &screen, &want))
+    return;
+
+  if (want.x >= data->win_rect.x && want.y >= data->win_rect.y &&
+      want.x + want.width <= data->win_rect.x + data->win_rect.width &&
+      want.y + want.height <= data->win_rect.y + data->win_rect.height)
+    {
+      if (!shrink ||
+          2 * want.width * want.height >
+          data->win_rect.width * data->win_rect.height)
+        return;
+    }
+  else if (!shrink)
+    {
+      want.x -= GROMIT_WINDOW_SLACK;
+      want.y -= GROMIT_WINDOW_SLACK;
+      want.width += 2 * GROMIT_WINDOW_SLACK;
+      want.height += 2 * GROMIT_WINDOW_SLACK;
+      gdk_rectangle_intersect (&want, &screen, &want);
+
+      /* the single pixel of an empty window holds nothing to keep */
+      if (data->win_rect.width > 1 || data->win_rect.height > 1)
+        gromit_rect_union (&want, &data->win_rect);
+    }
+
+  gromit_window_place (data, &want);
+}
+
+
+/* something got painted into rect */
+void
+gromit_painted_add (GromitData *data, GdkRectangle *rect)
+{
+  gromit_rect_union (&data->painted_box, rect);
+  gromit_window_fit (data, FALSE);
+}
+
+
+/* what the strokes cover, a label counts as covering the whole screen */
+void
+gromit_strokes_bounds (GromitData *data, GList *strokes, GdkRectangle *box)
+{
+  GList *ptr;
+
+  box->x = box->y = box->width = box->height = 0;
+
+  for (ptr = strokes; ptr; ptr = ptr->next)
+    {
+      GromitStroke *stroke = (GromitStroke *) ptr->data;
+      GdkRectangle  rect;
+
+      if (((GromitPaintContext *) stroke->context)->type == GROMIT_ERASER)
+        continue;
+
+      if (stroke->text)
+        {
+          box->x = box->y = 0;
+          box->width = data->width;
+          box->height = data->height;
+          return;
+        }
+
+      if (stroke->x1 > stroke->x2)
+        continue;
+
+      rect.x = stroke->x1;
+      rect.y = stroke->y1;
+      rect.width = stroke->x2 - stroke->x1 + 1;
+      rect.height = stroke->y2 - stroke->y1 + 1;
+      gromit_rect_union (box, &rect);
+    }
+}
+
+
+/*
+ * Recomputes painted_box from the current page. The shape knows best
+ * what is left after erasing, a page that is still being redrawn has
+ * only got its strokes.
+ */
+
+void
+gromit_painted_bounds (GromitData *data)
+{
+  GdkRectangle *box = &data->painted_box;
+
+  if (!data->pixmap || data->redraw)
+    gromit_strokes_bounds (data, data->strokes, box);
+  else if (data->region_shape)
+    {
+      gromit_region_flush (data);
+      gdk_region_get_clipbox (data->shape_grid ? data->grid_region
+                                               : data->painted_region, box);
+    }
+  else if (data->raster)
+    {
+      gromit_worker_finish (data);
+      gromit_raster_bounds (data->raster, box);
+    }
+  else
+    gromit_strokes_bounds (data, data->strokes, box);
+}
+
+
+void
+gromit_release_grab (GromitData *data)
+{
+  gromit_text_end (data);
+  gromit_pointers_cancel (data);
+
+  if (data->hard_grab)
+    {
+      data->hard_grab = 0;
+      gdk_display_pointer_ungrab (data->display, GDK_CURRENT_TIME);
+      /* inherit cursor from root window */
+      gdk_window_set_cursor (data->win->window, NULL);
+
+      gromit_painted_bounds (data);
+      gromit_window_fit (data, TRUE);
+    }
+
+  if (!data->painted)
+    gromit_hide_window (data);
+}
+
+
+void
+gromit_acquire_grab (GromitData *data)
+{
+  GdkGrabStatus result;
+
+  gromit_show_window (data);
+  if (!data->hard_grab)
+    {
+      GdkRectangle screen = { 0, 0, data->width, data->height };
+
+      /* painting may go anywhere */
+      gromit_window_place (data, &screen);
+
+      result = gdk_pointer_grab (data->area->window, FALSE,
+                                 GROMIT_MOUSE_EVENTS, 0,
+                                 NULL /* data->paint_cursor */,
+                                 GDK_CURRENT_TIME);
+
+      switch (result)
+      {
+        case GDK_GRAB_SUCCESS:
+           data->hard_grab = 1;
+           break;
+        case GDK_GRAB_ALREADY_GRABBED:
+           g_printerr ("Grabbing Pointer failed: %s\n", "AlreadyGrabbed");
+           break;
+        case GDK_GRAB_INVALID_TIME:
+           g_printerr ("Grabbing Pointer failed: %s\n", "GrabInvalidTime");
+           break;
+        case GDK_GRAB_NOT_VIEWABLE:
+           g_printerr ("Grabbing Pointer failed: %s\n", "GrabNotViewable");
+           break;
+        case GDK_GRAB_FROZEN:
+           g_printerr ("Grabbing Pointer failed: %s\n", "GrabFrozen");
+           break;
+        default:
+           g_printerr ("Grabbing Pointer failed: %s\n", "Unknown error");
+      }
+
+      if (data->cur_context->type == GROMIT_ERASER)
+         gdk_window_set_cursor (data->win->window, data->erase_cursor);
+      else
+         gdk_window_set_cursor (data->win->window, data->paint_cursor);
+    }
+}
+
+
+/*
+ * Adaptive quality: the time an XSync takes after a shape commit tells
+ * how busy the X server is. While it is slow, each quality level halves
+ * the rate of shape commits and doubles the distance below which motion
+ * points get dropped and (with --shape-grid) the size of new blocks.
+ */
+
+void
+gromit_quality_sample (GromitData *data)
+{
+  gint64 start = g_get_monotonic_time ();
+
+  if (!data->adaptive ||
+      start - data->latency_time < GROMIT_LATENCY_INTERVAL * 1000)
+    return;
+
+  XSync (GDK_DISPLAY_XDISPLAY (data->display), False);
+  data->latency_time = g_get_monotonic_time ();
+  data->latency = 0.75 * data->latency +
+                  0.25 * (data->latency_time - start) / 1000.0;
+
+  if (start - data->quality_time < GROMIT_QUALITY_HOLD * 1000)
+    return;
+
+  if (data->latency > GROMIT_LATENCY_HIGH &&
+      data->quality < GROMIT_QUALITY_MAX)
+    data->quality++;
+  else if (data->latency < GROMIT_LATENCY_LOW && data->quality > 0)
+    data->quality--;
+  else
+    return;
+
+  data->quality_time = start;
+
+  if (debug)
+    g_printerr ("X server round trip %.1f ms, quality level %u\n",
+                data->latency, data->quality);
+}
+
+
+/* puts what has been painted into the window shape */
+void
+gromit_commit_shape (GromitData *data)
+{
+  if (data->region_shape)
+    gromit_region_commit (data);
+  else if (!data->raster || gromit_raster_commit_shape (data) ||
+           data->shape_stale)
+    gtk_widget_shape_combine_mask (data->win, gromit_shape_mask (data, FALSE),
+                                   -data->win_rect.x, -data->win_rect.y);
+  data->shape_stale = FALSE;
+  data->shape_erased.width = data->shape_erased.height = 0;
+  data->modified = 0;
+  data->delayed = 0;
+
+  gromit_persist_flush (data);
+  gromit_quality_sample (data);
+}
+
+
+static gboolean
+gromit_shape_timeout (gpointer user_data)
+{
+  GromitData *data = (GromitData *) user_data;
+
+  data->shape_id = 0;
+
+  /* the page may have been cleared or released in the meantime */
+  if (data->pixmap && !data->frozen)
+    gromit_commit_shape (data);
+  return FALSE;
+}
+
+
+/*
+ * Has the shape committed soon. reshape () only runs while grabbing, this
+ * also works when the drawing changes without the user painting.
+ */
+void
+gromit_shape_later (GromitData *data)
+{
+  data->modified = 1;
+  if (!data->shape_id)
+    data->shape_id = g_timeout_add (GROMIT_FREEZE_DELAY,
+                                    gromit_shape_timeout, data);
+}
+
+
+gint
+reshape (gpointer user_data)
+{
+  GromitData *data = (GromitData *) user_data;
+
+  if (data->quality && ++data->reshape_ticks % (1 << data->quality))
+    return 1;
+
+  /* a frozen window is not shaped, it gets the shape when it thaws */
+  if (data->modified && !data->frozen)
+    {
+      if (gtk_events_pending () && data->delayed < 5)
+        {
+          data->delayed++ ;
+        }
+      else
+        gromit_commit_shape (data);
+    }
+  return 1;
+}
+
+
+void
+gromit_toggle_grab (GromitData *data)
+{
+  if (data->hard_grab) {
+    gtk_timeout_remove (data->timeout_id);
+    gromit_release_grab (data);
+  } else {
+    data->timeout_id = gtk_timeout_add (20, reshape, data);
+    gromit_acquire_grab (data);
+  }
+}
+
+
+void gromit_page_release (GromitData *data);
+void gromit_redraw_cancel (GromitData *data);
+
+/* a cleared page has nothing worth keeping the buffers for */
+void
+gromit_clear_screen (GromitData *data)
+{
+  gromit_text_end (data);
+  gromit_redraw_cancel (data);
+  gromit_stroke_list_free (data->strokes);
+  data->strokes = NULL;
+  gromit_pointers_drop_strokes (data);
+
+  if (data->publisher)
+    {
+      gromit_stream_clear (data->publisher);
+      data->published_stroke = NULL;
+    }
+
+  gromit_page_release (data);
+  if (data->session)
+    gromit_session_forget (data->session, data->cur_page);
+  gromit_apply_shape (data);
+  data->painted_box.width = 0;
+  data->painted_box.height = 0;
+
+  if (!data->hard_grab && !data->frozen)
+    gromit_hide_window (data);
+  data->painted = 0;
+}
+
+
+/*
+ * Freezing: the window covers the screen with a still image of it and
+ * the drawing on top, so that nothing below has to redraw while the
+ * window shape changes. The shape gets applied again on thawing.
+ */
+
+gboolean
+gromit_freeze_capture (gpointer user_data)
+{
+  GromitData *data = (GromitData *) user_data;
+
+  data->freeze_id = 0;
+
+  data->backdrop = gdk_pixmap_new (data->root, data->width, data->height, -1);
+  gdk_draw_drawable (data->backdrop, data->backdrop_gc, data->root,
+                     0, 0, 0, 0, data->width, data->height);
+  data->frozen_gc = gdk_gc_new (data->area->window);
+  data->frozen = TRUE;
+
+  gdk_window_set_back_pixmap (data->area->window, data->backdrop, FALSE);
+  gromit_apply_shape (data);
+  gtk_widget_queue_draw (data->area);
+
+  return FALSE;
+}
+
+
+void
+gromit_freeze (GromitData *data)
+{
+  if (data->frozen || data->freeze_id)
+    return;
+
+  if (data->hidden)
+    gromit_show_window (data);
+
+  data->freeze_id = g_timeout_add (GROMIT_FREEZE_DELAY,
+                                   gromit_freeze_capture, data);
+  gromit_window_fit (data, FALSE);
+
+  /* take the drawing off the screen for the snapshot */
+  gtk_widget_shape_combine_mask (data->win, data->empty_shape, 0, 0);
+  gdk_display_sync (data->display);
+}
+
+
+void
+gromit_unfreeze (GromitData *data)
+{
+  if (data->freeze_id)
+    {
+      g_source_remove (data->freeze_id);
+      data->freeze_id = 0;
+      gromit_window_fit (data, TRUE);
+      gromit_apply_shape (data);
+      return;
+    }
+
+  if (!data->frozen)
+    return;
+
+  data->frozen = FALSE;
+
+  if (data->pixmap)
+    {
+      gromit_worker_finish (data);
+      if (data->region_shape)
+        gromit_region_flush (data);
+      else if (data->raster)
+        gromit_raster_commit_shape (data);
+      else
+        gromit_grid_update (data);
+    }
+  gromit_persist_flush (data);
+  gromit_window_fit (data, TRUE);
+  gromit_apply_shape (data);
+  data->modified = 0;
+  data->delayed = 0;
+
+  gdk_window_set_background (data->area->window,
+                             data->cur_context->fg_color);
+  g_object_unref (data->frozen_gc);
+  data->frozen_gc = NULL;
+  g_object_unref (data->backdrop);
+  data->backdrop = NULL;
+}
+
+
+void
+gromit_toggle_freeze (GromitData *data)
+{
+  if (data->frozen || data->freeze_id)
+    gromit_unfreeze (data);
+  else
+    gromit_freeze (data);
+}
+
+
+/*
+ * Annotation pages
+ */
+
+void
+gromit_page_save (GromitData *data, GromitPage *page)
+{
+  page->pixmap = data->pixmap;
+  page->shape = data->shape;
+  page->raster = data->raster;
+  page->shm_image = data->shm_image;
+  page->shm_info = data->shm_info;
+  page->shape_image = data->shape_image;
+  page->painted_region = data->painted_region;
+  page->grid_region = data->grid_region;
+  page->grid_pending = data->grid_pending;
+  page->shape_region = data->shape_region;
+  page->picture = data->picture;
+  page->strokes = data->strokes;
+  page->painted = data->painted;
+}
+
+
+void
+gromit_page_load (GromitData *data, GromitPage *page)
+{
+  data->pixmap = page->pixmap;
+  data->shape = page->shape;
+  data->raster = page->raster;
+  data->shm_image = page->shm_image;
+  data->shm_info = page->shm_info;
+  data->shape_image = page->shape_image;
+  data->painted_region = page->painted_region;
+  data->grid_region = page->grid_region;
+  data->grid_pending = page->grid_pending;
+  data->shape_region = page->shape_region;
+  data->picture = page->picture;
+  data->strokes = page->strokes;
+  data->painted = page->painted;
+}
+
+
+void gromit_draw_line (GromitData *data, gint x1, gint y1,
+                       gint x2, gint y2);
+void gromit_draw_arrow (GromitData *data, gint x1, gint y1,
+                        gint width, gfloat direction);
+void gromit_draw_text (GromitData *data, GromitStroke *stroke, gboolean draw,
+                       gint *pen_x, gint *pen_y);
+GromitFont *gromit_text_font (GromitPaintContext *context);
+
+
+/* the tiles a stroke touches, labels count as touching all of them */
+void
+gromit_redraw_tiles (GromitRedraw *redraw, GromitStroke *stroke,
+                     gint *tx1, gint *ty1, gint *tx2, gint *ty2)
+{
+  if (stroke->text || stroke->x1 > stroke->x2)
+    {
+      *tx1 = 0;
+      *ty1 = 0;
+      *tx2 = redraw->cols - 1;
+      *ty2 = redraw->rows - 1;
+      return;
+    }
+
+  *tx1 = CLAMP (stroke->x1 / GROMIT_REDRAW_TILE, 0, redraw->cols - 1);
+  *ty1 = CLAMP (stroke->y1 / GROMIT_REDRAW_TILE, 0, redraw->rows - 1);
+  *tx2 = CLAMP (stroke->x2 / GROMIT_REDRAW_TILE, 0, redraw->cols - 1);
+  *ty2 = CLAMP (stroke->y2 / GROMIT_REDRAW_TILE, 0, redraw->rows - 1);
+}
+
+
+gint
+gromit_redraw_head (GromitRedraw *redraw, gint tx, gint ty)
+{
+  GQueue *queue = &redraw->tiles[ty * redraw->cols + tx];
+
+  return queue->head ? GPOINTER_TO_INT (queue->head->data) : -1;
+}
+
+
+/*
+ * Picks the next stroke to draw: the oldest one of the non-empty tile
+ * nearest to (x, y) that touches area (or anywhere for NULL), or an
+ * older stroke it has to wait for. Returns -1 if there is none.
+ */
+
+gint
+gromit_redraw_pick (GromitRedraw *redraw, GdkRectangle *area, gint x, gint y)
+{
+  gint tx1 = 0, ty1 = 0;
+  gint tx2 = redraw->cols - 1, ty2 = redraw->rows - 1;
+  gint tx, ty, cx, cy, dist, best_dist = G_MAXINT;
+  gint stroke = -1, blocker, head;
+
+  if (redraw->current >= 0)
+    return redraw->current;
+
+  if (area)
+    {
+      if (area->x + area->width <= 0 || area->y + area->height <= 0)
+        return -1;
+
+      tx1 = MAX (area->x / GROMIT_REDRAW_TILE, 0);
+      ty1 = MAX (area->y / GROMIT_REDRAW_TILE, 0);
+      tx2 = MIN ((area->x + area->width - 1) / GROMIT_REDRAW_TILE, tx2);
+      ty2 = MIN ((area->y + area->height - 1) / GROMIT_REDRAW_TILE, ty2);
+    }
+
+  for (ty = ty1; ty <= ty2; ty++)
+    for (tx = tx1; tx <= tx2; tx++)
+      {
+        head = gromit_redraw_head (redraw, tx, ty);
+        if (head < 0)
+          continue;
+
+        cx = tx * GROMIT_REDRAW_TILE + GROMIT_REDRAW_TILE / 2 - x;
+        cy = ty * GROMIT_REDRAW_TILE + GROMIT_REDRAW_TILE / 2 - y;
+        dist = cx * cx + cy * cy;
+        if (dist < best_dist)
+          {
+            best_dist = dist;
+            stroke = head;
+          }
+      }
+
+  /* follow the older strokes sharing a tile until one is free to go */
+  while (stroke >= 0)
+    {
+      blocker = stroke;
+      gromit_redraw_tiles (redraw, g_ptr_array_index (redraw->strokes, stroke),
+                           &tx1, &ty1, &tx2, &ty2);
+
+      for (ty = ty1; ty <= ty2; ty++)
+        for (tx = tx1; tx <= tx2; tx++)
+          {
+            head = gromit_redraw_head (redraw, tx, ty);
+            if (head >= 0 && head < blocker)
+              blocker = head;
+          }
+
+      if (blocker == stroke)
+        break;
+      stroke = blocker;
+    }
+
+  return stroke;
+}
+
+
+void
+gromit_redraw_dirty (GromitData *data, gint x, gint y, gint width, gint height)
+{
+  GdkRectangle rect = { x, y, width, height };
+
+  gromit_rect_union (&data->redraw->dirty, &rect);
+}
+
+
+/*
+ * Draws the next segment of the current stroke, or its label and
+ * arrow at the end. Returns FALSE once the stroke is done.
+ */
+
+gboolean
+gromit_redraw_step (GromitData *data)
+{
+  GromitRedraw *redraw = data->redraw;
+  GromitStroke *stroke = g_ptr_array_index (redraw->strokes, redraw->current);
+  gint          x1, y1, x2, y2, width, tx1, ty1, tx2, ty2, tx, ty;
+
+  if (!stroke->text &&
+      gromit_stroke_iter_next (&redraw->iter, &x1, &y1, &x2, &y2, &width))
+    {
+      data->maxwidth = width;
+      gromit_draw_line (data, x1, y1, x2, y2);
+      gromit_redraw_dirty (data, MIN (x1, x2) - width / 2 - 1,
+                           MIN (y1, y2) - width / 2 - 1,
+                           ABS (x1 - x2) + width + 2,
+                           ABS (y1 - y2) + width + 2);
+      return TRUE;
+    }
+
+  if (stroke->text)
+    {
+      gromit_draw_text (data, stroke, TRUE, NULL, NULL);
+      gromit_redraw_dirty (data, 0, 0, data->width, data->height);
+    }
+
+  if (stroke->has_arrow)
+    {
+      gromit_draw_arrow (data, stroke->arrow_x, stroke->arrow_y,
+                         stroke->arrow_width, stroke->arrow_direction);
+      gromit_redraw_dirty (data, stroke->x1, stroke->y1,
+                           stroke->x2 - stroke->x1 + 1,
+                           stroke->y2 - stroke->y1 + 1);
+    }
+
+  gromit_redraw_tiles (redraw, stroke, &tx1, &ty1, &tx2, &ty2);
+  for (ty = ty1; ty <= ty2; ty++)
+    for (tx = tx1; tx <= tx2; tx++)
+      g_queue_pop_head (&redraw->tiles[ty * redraw->cols + tx]);
+
+  redraw->current = -1;
+  redraw->left--;
+  return FALSE;
+}
+
+
+void
+gromit_redraw_begin_stroke (GromitData *data, gint index)
+{
+  GromitRedraw *redraw = data->redraw;
+  GromitStroke *stroke = g_ptr_array_index (redraw->strokes, index);
+
+  redraw->current = index;
+  data->cur_context = stroke->context;
+  gromit_highlight_reset (data);
+  gromit_stroke_iter_init (stroke, &redraw->iter);
+}
+
+
+/*
+ * The redraw has a stroke state of its own, so that a device drawing
+ * at the same time keeps its tool and highlight.
+ */
+
+void
+gromit_redraw_enter (GromitData *data)
+{
+  GromitRedraw *redraw = data->redraw;
+
+  redraw->previous = data->pointer;
+  if (!data->pointer)
+    gromit_pointer_save (data, &redraw->outside);
+
+  gromit_worker_finish (data);
+  gromit_pointer_switch (data, &data->redraw);
+  data->replaying = TRUE;
+}
+
+
+void
+gromit_redraw_leave (GromitData *data)
+{
+  GromitRedraw *redraw = data->redraw;
+  GdkRectangle  all = { 0, 0, data->width, data->height };
+  GdkRectangle  dirty;
+
+  data->replaying = FALSE;
+
+  if (gdk_rectangle_intersect (&redraw->dirty, &all, &dirty))
+    {
+      if (data->raster)
+        gromit_raster_upload (data, &dirty);
+      gromit_area_invalidate (data, &dirty);
+      /* committing takes a server round trip, not one per slice */
+      gromit_shape_later (data);
+    }
+  redraw->dirty.width = 0;
+  redraw->dirty.height = 0;
+
+  gromit_pointer_save (data, data->pointer);
+  gromit_pointer_load (data, redraw->previous ? redraw->previous
+                                              : &redraw->outside);
+  data->pointer = redraw->previous;
+}
+
+
+/* stops the redraw of the current page, whatever is left is lost */
+void
+gromit_redraw_cancel (GromitData *data)
+{
+  GromitRedraw  *redraw = data->redraw;
+  GromitPointer *pointer;
+  gint           i;
+
+  if (!redraw)
+    return;
+
+  /* a page is only good for the session once all of it is there */
+  if (redraw->left == 0)
+    gromit_persist_done (data);
+
+  if (redraw->parallel)
+    gromit_tile_pool_cancel (data->tile_pool);
+  if (redraw->idle_id)
+    g_source_remove (redraw->idle_id);
+
+  for (i = 0; i < redraw->cols * redraw->rows; i++)
+    g_queue_clear (&redraw->tiles[i]);
+  g_free (redraw->tiles);
+  g_ptr_array_free (redraw->strokes, TRUE);
+  g_timer_destroy (redraw->timer);
+  g_free (redraw);
+  data->redraw = NULL;
+
+  pointer = g_hash_table_lookup (data->pointers, &data->redraw);
+  if (pointer && pointer->highlight_region)
+    {
+      gdk_region_destroy (pointer->highlight_region);
+      pointer->highlight_region = NULL;
+    }
+}
+
+
+/*
+ * What gromit_draw_line () and friends do to the raster, for a whole
+ * stroke. This runs on the threads of the tile pool, so it must only
+ * read the stroke, its tool and glyphs that are in the cache already.
+ */
+
+void
+gromit_render_stroke (GromitRaster *raster, GromitStroke *stroke,
+                      guint32 outline)
+{
+  GromitPaintContext *context = stroke->context;
+  GromitRasterOp      op = gromit_raster_op (context);
+  guint32             pixel = context->fg_color->pixel;
+  GromitStrokeIter    iter;
+  gint                x1, y1, x2, y2, width, i;
+
+  if (stroke->text)
+    {
+      GromitFont  *font = gromit_text_font (context);
+      GromitGlyph *glyph;
+      const gchar *p;
+      gint         x = stroke->text_x;
+      gint         y = stroke->text_y;
+
+      for (p = stroke->text->str; *p; p = g_utf8_next_char (p))
+        {
+          if (*p == '\n')
+            {
+              x = stroke->text_x;
+              y += font->height;
+              continue;
+            }
+
+          glyph = gromit_font_glyph (font, g_utf8_get_char (p));
+          if (glyph->width > 0 && glyph->height > 0)
+            gromit_raster_bitmap (raster, x + glyph->x_offset,
+                                  y + glyph->y_offset,
+                                  glyph->width, glyph->height,
+                                  glyph->bits, glyph->bytes_per_line,
+                                  pixel, GROMIT_RASTER_PAINT, NULL);
+          x += glyph->advance;
+        }
+    }
+  else
+    {
+      gromit_stroke_iter_init (stroke, &iter);
+      while (gromit_stroke_iter_next (&iter, &x1, &y1, &x2, &y2, &width))
+        gromit_raster_line (raster, x1, y1, x2, y2, width, pixel, op, NULL);
+    }
+
+  if (stroke->has_arrow)
+    {
+      GdkPoint arrowhead [4];
+
+      gromit_arrowhead (stroke->arrow_x, stroke->arrow_y,
+                        stroke->arrow_width, stroke->arrow_direction,
+                        arrowhead);
+      gromit_raster_polygon (raster, arrowhead, 4, pixel, op, NULL);
+      for (i = 0; i < 4; i++)
+        gromit_raster_line (raster,
+                            arrowhead[i].x, arrowhead[i].y,
+                            arrowhead[(i+1) % 4].x, arrowhead[(i+1) % 4].y,
+                            0, outline, op, NULL);
+    }
+}
+
+
+void
+gromit_redraw_tile_rect (GromitRedraw *redraw, guint tile, GdkRectangle *rect)
+{
+  rect->x = (tile % redraw->cols) * GROMIT_REDRAW_TILE;
+  rect->y = (tile / redraw->cols) * GROMIT_REDRAW_TILE;
+  rect->width = GROMIT_REDRAW_TILE;
+  rect->height = GROMIT_REDRAW_TILE;
+}
+
+
+/* a GromitTileFunc, draws the strokes of a tile clipped to it */
+void
+gromit_redraw_render_tile (guint tile, gpointer user_data)
+{
+  GromitRedraw *redraw = user_data;
+  GromitRaster  view;
+  GdkRectangle  rect;
+  GList        *ptr;
+
+  gromit_redraw_tile_rect (redraw, tile, &rect);
+  gromit_raster_view (&view, redraw->raster, &rect);
+
+  for (ptr = redraw->tiles[tile].head; ptr; ptr = ptr->next)
+    gromit_render_stroke (&view,
+                          g_ptr_array_index (redraw->strokes,
+                                             GPOINTER_TO_INT (ptr->data)),
+                          redraw->outline);
+}
+
+
+/*
+ * A GromitTileFunc as well, shows a tile that is done. Its shape and
+ * session copy are taken right away: shape_dirty and session_dirty are
+ * boxes, which could span tiles the pool is still drawing.
+ */
+void
+gromit_redraw_tile_done (guint tile, gpointer user_data)
+{
+  GromitData   *data = (GromitData *) user_data;
+  GromitRedraw *redraw = data->redraw;
+  GdkRectangle  all = { 0, 0, data->width, data->height };
+  GdkRectangle  rect;
+
+  gromit_redraw_tile_rect (redraw, tile, &rect);
+  if (gdk_rectangle_intersect (&rect, &all, &rect))
+    {
+      gromit_raster_put (data, &rect);
+      gromit_area_invalidate (data, &rect);
+      if (gromit_raster_commit_rect (data, &rect))
+        data->shape_stale = TRUE;
+      if (data->session)
+        gromit_session_store (data->session, data->cur_page, data->raster,
+                              &rect);
+      data->modified = 1;
+    }
+
+  redraw->left--;
+}
+
+
+gboolean
+gromit_redraw_notify (gpointer user_data)
+{
+  GromitData   *data = (GromitData *) user_data;
+  GromitRedraw *redraw = data->redraw;
+
+  /* left over from a cancelled redraw */
+  if (!redraw || !redraw->parallel)
+    {
+      gromit_tile_pool_drain (data->tile_pool, NULL, NULL);
+      return FALSE;
+    }
+
+  gromit_tile_pool_drain (data->tile_pool, gromit_redraw_tile_done, data);
+  if (data->modified)
+    gromit_shape_later (data);
+
+  if (redraw->left == 0)
+    gromit_redraw_cancel (data);
+
+  return FALSE;
+}
+
+
+/* the tiles of area (all for NULL) have to be done before drawing there */
+void
+gromit_redraw_claim (GromitData *data, GdkRectangle *area)
+{
+  GromitRedraw *redraw = data->redraw;
+  gint          tx1 = 0, ty1 = 0;
+  gint          tx2 = redraw->cols - 1, ty2 = redraw->rows - 1;
+  gint          tx, ty;
+
+  if (area)
+    {
+      /* thin lines can reach a pixel past their rectangle */
+      tx1 = MAX ((area->x - 1) / GROMIT_REDRAW_TILE, 0);
+      ty1 = MAX ((area->y - 1) / GROMIT_REDRAW_TILE, 0);
+      tx2 = MIN ((area->x + area->width) / GROMIT_REDRAW_TILE, tx2);
+      ty2 = MIN ((area->y + area->height) / GROMIT_REDRAW_TILE, ty2);
+    }
+
+  for (ty = ty1; ty <= ty2; ty++)
+    for (tx = tx1; tx <= tx2; tx++)
+      gromit_tile_pool_claim (data->tile_pool, ty * redraw->cols + tx);
+}
+
+
+gint
+gromit_redraw_compare_tiles (gconstpointer a, gconstpointer b,
+                             gpointer user_data)
+{
+  const gint *dist = user_data;
+  gint        da = dist[*(const guint *) a];
+  gint        db = dist[*(const guint *) b];
+
+  return (da > db) - (da < db);
+}
+
+
+/* hands the tiles to the tile pool, the ones near the pointer first */
+void
+gromit_redraw_run_tiles (GromitData *data)
+{
+  GromitRedraw *redraw = data->redraw;
+  guint         n_tiles = redraw->cols * redraw->rows;
+  guint        *tiles = g_new (guint, n_tiles);
+  gint         *dist = g_new (gint, n_tiles);
+  gint          x = data->lastx, y = data->lasty, dx, dy;
+  guint         i, n = 0;
+
+  /* the threads must not add to the glyph cache */
+  for (i = 0; i < redraw->strokes->len; i++)
+    if (((GromitStroke *) g_ptr_array_index (redraw->strokes, i))->text)
+      gromit_draw_text (data, g_ptr_array_index (redraw->strokes, i), FALSE,
+                        NULL, NULL);
+
+  for (i = 0; i < n_tiles; i++)
+    {
+      if (!redraw->tiles[i].head)
+        continue;
+
+      dx = (i % redraw->cols) * GROMIT_REDRAW_TILE + GROMIT_REDRAW_TILE / 2 - x;
+      dy = (i / redraw->cols) * GROMIT_REDRAW_TILE + GROMIT_REDRAW_TILE / 2 - y;
+      dist[i] = dx * dx + dy * dy;
+      tiles[n++] = i;
+    }
+
+  g_qsort_with_data (tiles, n, sizeof (guint),
+                     gromit_redraw_compare_tiles, dist);
+
+  redraw->parallel = TRUE;
+  redraw->raster = data->raster;
+  redraw->outline = data->black->pixel;
+  redraw->left = n;
+
+  if (debug)
+    g_printerr ("Redrawing %u tiles on %u threads\n", n,
+                gromit_tile_pool_threads (data->tile_pool));
+
+  gromit_tile_pool_run (data->tile_pool, tiles, n, n_tiles,
+                        gromit_redraw_render_tile, redraw);
+
+  g_free (dist);
+  g_free (tiles);
+}
+
+
+/*
+ * Draws the strokes touching area (all of them for NULL) right away,
+ * before something new gets painted on top of them.
+ */
+
+void
+gromit_redraw_area (GromitData *data, GdkRectangle *area)
+{
+  GromitRedraw *redraw = data->redraw;
+  gint          stroke, x = 0, y = 0;
+
+  if (!redraw)
+    return;
+
+  if (redraw->parallel)
+    {
+      gromit_redraw_claim (data, area);
+      return;
+    }
+
+  if (area)
+    {
+      x = area->x + area->width / 2;
+      y = area->y + area->height / 2;
+    }
+
+  gromit_redraw_enter (data);
+
+  while ((stroke = gromit_redraw_pick (redraw, area, x, y)) >= 0)
+    {
+      if (stroke != redraw->current)
+        gromit_redraw_begin_stroke (data, stroke);
+      while (gromit_redraw_step (data))
+        ;
+    }
+
+  gromit_redraw_leave (data);
+
+  if (redraw->left == 0)
+    gromit_redraw_cancel (data);
+}
+
+
+/*
+ * One slice of the redraw. It draws from the tiles near the pointer
+ * and yields as soon as input is pending or the time is up.
+ */
+
+gboolean
+gromit_redraw_slice (gpointer user_data)
+{
+  GromitData   *data = (GromitData *) user_data;
+  GromitRedraw *redraw = data->redraw;
+  gint          x = data->lastx, y = data->lasty;
+  guint         steps = 0;
+
+  gromit_redraw_enter (data);
+  g_timer_start (redraw->timer);
+
+  while (redraw->left > 0)
+    {
+      if (redraw->current < 0)
+        gromit_redraw_begin_stroke (data,
+                                    gromit_redraw_pick (redraw, NULL, x, y));
+      gromit_redraw_step (data);
+
+      if (++steps % 16 == 0 &&
+          (gtk_events_pending () ||
+           g_timer_elapsed (redraw->timer, NULL) * 1000 >=
+           GROMIT_REDRAW_SLICE))
+        break;
+    }
+
+  gromit_redraw_leave (data);
+
+  if (debug)
+    g_printerr ("Redraw slice: %u steps, %u strokes left\n",
+                steps, redraw->left);
+
+  if (redraw->left > 0)
+    return TRUE;
+
+  redraw->idle_id = 0;
+  gromit_redraw_cancel (data);
+  return FALSE;
+}
+
+
+/* the windows below had their time to repaint, the redraw can go on */
+gboolean
+gromit_redraw_wait (gpointer user_data)
+{
+  GromitData *data = (GromitData *) user_data;
+
+  data->redraw->idle_id = g_idle_add (gromit_redraw_slice, data);
+  return FALSE;
+}
+
+
+/*
+ * Schedules the redraw of the strokes of the current page. With wait it
+ * starts after GROMIT_FREEZE_DELAY, for highlighters that take their
+ * backdrop from the screen.
+ */
+void
+gromit_redraw_start (GromitData *data, gboolean wait)
+{
+  GromitRedraw *redraw = g_new0 (GromitRedraw, 1);
+  GList        *ptr;
+  gint          tx1, ty1, tx2, ty2, tx, ty;
+  guint         i;
+
+  /* the strokes being redrawn must not grow any more */
+  gromit_pointers_drop_strokes (data);
+
+  redraw->cols = (data->width + GROMIT_REDRAW_TILE - 1) / GROMIT_REDRAW_TILE;
+  redraw->rows = (data->height + GROMIT_REDRAW_TILE - 1) / GROMIT_REDRAW_TILE;
+  redraw->tiles = g_new0 (GQueue, redraw->cols * redraw->rows);
+  redraw->strokes = g_ptr_array_new ();
+  for (ptr = g_list_last (data->strokes); ptr; ptr = ptr->prev)
+    g_ptr_array_add (redraw->strokes, ptr->data);
+
+  for (i = 0; i < redraw->strokes->len; i++)
+    {
+      gromit_redraw_tiles (redraw, g_ptr_array_index (redraw->strokes, i),
+                           &tx1, &ty1, &tx2, &ty2);
+      for (ty = ty1; ty <= ty2; ty++)
+        for (tx = tx1; tx <= tx2; tx++)
+          g_queue_push_tail (&redraw->tiles[ty * redraw->cols + tx],
+                             GINT_TO_POINTER (i));
+    }
+
+  redraw->left = redraw->strokes->len;
+  redraw->current = -1;
+  redraw->timer = g_timer_new ();
+  data->redraw = redraw;
+
+  /* the shape regions are not collected by the tile pool */
+  if (data->tile_pool && data->raster && !data->region_shape)
+    gromit_redraw_run_tiles (data);
+  else if (wait)
+    redraw->idle_id = g_timeout_add (GROMIT_FREEZE_DELAY,
+                                     gromit_redraw_wait, data);
+  else
+    redraw->idle_id = g_idle_add (gromit_redraw_slice, data);
+
+  if (redraw->left == 0)
+    gromit_redraw_cancel (data);
+}
+
+
+/* the XRender picture of the pixmap for the highlighters */
+Picture
+gromit_page_picture (GromitData *data)
+{
+  Display           *dpy = GDK_DISPLAY_XDISPLAY (data->display);
+  GdkVisual         *visual = gdk_screen_get_system_visual (data->screen);
+  XRenderPictFormat *format;
+
+  if (!data->xrender)
+    return None;
+
+  format = XRenderFindVisualFormat (dpy, GDK_VISUAL_XVISUAL (visual));
+  if (!format)
+    return None;
+
+  return XRenderCreatePicture (dpy, GDK_PIXMAP_XID (data->pixmap),
+                               format, 0, NULL);
+}
+
+
+/*
+ * The raster of the current page came from the session file: only the
+ * pixmap and the shape have to catch up, nothing gets redrawn.
+ */
+
+void
+gromit_page_restore (GromitData *data)
+{
+  if (debug)
+    g_printerr ("Restored page %d from the session\n", data->cur_page + 1);
+
+  gromit_raster_bounds (data->raster, &data->painted_box);
+  gromit_raster_put (data, &data->painted_box);
+
+  if (data->region_shape)
+    {
+      gromit_raster_coverage_spans (data->raster, gromit_region_span,
+                                    data->shape_add);
+      gromit_region_flush (data);
+    }
+  else
+    {
+      data->shape_dirty = data->painted_box;
+      gromit_raster_commit_shape (data);
+    }
+
+  /* all of it is in the file already */
+  data->session_dirty.width = data->session_dirty.height = 0;
+
+  gromit_window_fit (data, TRUE);
+  if (!data->frozen)
+    gromit_apply_shape (data);
+  gromit_area_invalidate (data, NULL);
+  data->painted = 1;
+}
+
+
+/*
+ * Allocate the buffers of the current page and schedule the redraw of
+ * its strokes. This happens on the first stroke of a page and when a
+ * page whose buffers have been released gets shown again. A page kept
+ * in the session file is taken from there instead.
+ */
+
+void
+gromit_page_realize (GromitData *data)
+{
+  gboolean restored = FALSE;
+  gboolean wait = FALSE;
+
+  data->pixmap = gdk_pixmap_new (data->area->window, data->width,
+                                 data->height, -1);
+  gdk_draw_rectangle (data->pixmap, data->area->style->black_gc,
+                      1, 0, 0, data->width, data->height);
+
+  data->shape = gdk_pixmap_new (NULL, data->width, data->height, 1);
+  gdk_gc_set_foreground (data->shape_gc, data->transparent);
+  gdk_draw_rectangle (data->shape, data->shape_gc,
+                      1, 0, 0, data->width, data->height);
+
+  if (debug)
+    g_printerr ("Realizing page %d\n", data->cur_page + 1);
+
+  data->raster = NULL;
+  data->shm_image = NULL;
+  data->shape_image = NULL;
+  if (data->client_render && !gromit_raster_alloc (data))
+    g_printerr ("Using server side rendering for this page\n");
+
+  data->session_dirty.width = data->session_dirty.height = 0;
+  if (data->session && data->raster &&
+      gromit_session_restore (data->session, data->cur_page, data->raster))
+    restored = TRUE;
+  else if (data->session && data->raster)
+    gromit_session_begin (data->session, data->cur_page);
+  else if (data->session)
+    gromit_session_forget (data->session, data->cur_page);
+
+  data->picture = gromit_page_picture (data);
+
+  if (data->shape_grid)
+    {
+      data->grid_region = gdk_region_new ();
+      data->grid_pending = gdk_region_new ();
+    }
+
+  /* the grid mask still shows the page that was realized last */
+  if (data->grid_mask)
+    {
+      gdk_gc_set_foreground (data->shape_gc, data->transparent);
+      gdk_draw_rectangle (data->grid_mask, data->shape_gc, TRUE,
+                          0, 0, data->width, data->height);
+      data->grid_dirty.width = data->grid_dirty.height = 0;
+    }
+
+  if (data->region_shape)
+    {
+      data->painted_region = gdk_region_new ();
+      data->shape_region = XFixesCreateRegion (GDK_DISPLAY_XDISPLAY (data->display),
+                                               NULL, 0);
+    }
+
+  if (restored)
+    {
+      gromit_page_restore (data);
+      return;
+    }
+
+  gromit_strokes_bounds (data, data->strokes, &data->painted_box);
+  if (!data->strokes)
+    {
+      gromit_persist_done (data);
+      return;
+    }
+
+  /*
+   * Highlighter strokes take their backdrop from the screen, which has
+   * to show the windows below first: they get some time to repaint.
+   */
+  if (!data->hidden && !data->frozen)
+    {
+      GList *ptr;
+
+      for (ptr = data->strokes; ptr; ptr = ptr->next)
+        if (((GromitPaintContext *)
+             ((GromitStroke *) ptr->data)->context)->type == GROMIT_HIGHLIGHTER)
+          {
+            gtk_widget_shape_combine_mask (data->win, data->empty_shape, 0,0);
+            wait = TRUE;
+            break;
+          }
+    }
+
+  gromit_redraw_start (data, wait);
+  gromit_area_invalidate (data, NULL);
+}
+
+
+/* free the buffers of the current page, the strokes are kept */
+void
+gromit_page_release (GromitData *data)
+{
+  Display *dpy = GDK_DISPLAY_XDISPLAY (data->display);
+
+  if (!data->pixmap)
+    return;
+
+  gromit_redraw_cancel (data);
+  gromit_predict_clear (data);
+  gromit_worker_finish (data);
+  gromit_persist_dirty (data, &data->shape_dirty);
+  gromit_persist_flush (data);
+
+  if (data->picture != None)
+    XRenderFreePicture (dpy, data->picture);
+  data->picture = None;
+
+  g_object_unref (data->pixmap);
+  g_object_unref (data->shape);
+  data->pixmap = NULL;
+  data->shape = NULL;
+
+  if (data->raster)
+    gromit_raster_destroy (data);
+
+  if (data->region_shape)
+    {
+      gromit_region_clear (data);
+      gdk_region_destroy (data->painted_region);
+      XFixesDestroyRegion (dpy, data->shape_region);
+      data->painted_region = NULL;
+      data->shape_region = None;
+    }
+
+  if (data->grid_region)
+    {
+      gdk_region_destroy (data->grid_region);
+      gdk_region_destroy (data->grid_pending);
+      data->grid_region = NULL;
+      data->grid_pending = NULL;
+    }
+
+  data->modified = 0;
+  data->delayed = 0;
+}
+
+
+void
+gromit_release_pages (GromitData *data)
+{
+  guint i;
+
+  gromit_page_save (data, &data->pages[data->cur_page]);
+
+  for (i = 0; i < data->n_pages; i++)
+    {
+      gromit_page_load (data, &data->pages[i]);
+      gromit_page_release (data);
+      gromit_page_save (data, &data->pages[i]);
+    }
+
+  gromit_page_load (data, &data->pages[data->cur_page]);
+  gromit_apply_shape (data);
+}
+
+
+void
+gromit_apply_shape (GromitData *data)
+{
+  if (data->frozen)
+    gtk_widget_shape_combine_mask (data->win, NULL, 0, 0);
+  else if (!data->pixmap)
+    gtk_widget_shape_combine_mask (data->win, data->empty_shape, 0,0);
+  else if (data->region_shape)
+    XFixesSetWindowShapeRegion (GDK_DISPLAY_XDISPLAY (data->display),
+                                GDK_WINDOW_XID (data->win->window),
+                                ShapeBounding,
+                                -data->win_rect.x, -data->win_rect.y,
+                                data->shape_region);
+  else
+    gtk_widget_shape_combine_mask (data->win, gromit_shape_mask (data, TRUE),
+                                   -data->win_rect.x, -data->win_rect.y);
+}
+
+
+/*
+ * Screen size changes (RandR): the buffers of the realized pages are
+ * adapted rather than thrown away. Pixmaps only get replaced when the
+ * screen grows, keeping what is beyond the edge of a smaller screen for
+ * when it grows again, only the newly exposed parts get cleared. The
+ * client side raster shrinks in place, growing it needs a new shared
+ * memory segment. The drawing beyond its edge is dropped then.
+ */
+
+GdkPixmap *
+gromit_pixmap_grow (GromitData *data, GdkPixmap *pixmap, gint depth,
+                    GdkGC *gc)
+{
+  GdkPixmap *grown;
+  gint       width, height, new_width, new_height;
+
+  gdk_drawable_get_size (pixmap, &width, &height);
+  if (width >= data->width && height >= data->height)
+    return pixmap;
+
+  new_width = MAX (width, data->width);
+  new_height = MAX (height, data->height);
+  grown = gdk_pixmap_new (depth == 1 ? NULL : data->area->window,
+                          new_width, new_height, depth);
+
+  gdk_draw_drawable (grown, gc, pixmap, 0, 0, 0, 0, width, height);
+  if (new_width > width)
+    gdk_draw_rectangle (grown, gc, TRUE,
+                        width, 0, new_width - width, new_height);
+  if (new_height > height)
+    gdk_draw_rectangle (grown, gc, TRUE,
+                        0, height, width, new_height - height);
+
+  g_object_unref (pixmap);
+  return grown;
+}
+
+
+void
+gromit_page_resize_raster (GromitData *data)
+{
+  GromitRaster    *raster = data->raster;
+  XImage          *shm_image = data->shm_image;
+  XImage          *shape_image = data->shape_image;
+  XShmSegmentInfo  shm_info = data->shm_info;
+  GdkRectangle     all = { 0, 0, data->width, data->height };
+
+  if (data->width <= raster->width && data->height <= raster->height)
+    {
+      gromit_raster_shrink (raster, data->width, data->height);
+
+      /* the shape must not show what the raster does not have */
+      if (data->region_shape)
+        {
+          GdkRectangle  huge = { 0, 0, G_MAXSHORT, G_MAXSHORT };
+          GdkRegion    *beyond = gdk_region_rectangle (&huge);
+          GdkRegion    *screen = gdk_region_rectangle (&all);
+
+          gdk_region_subtract (beyond, screen);
+          gromit_region_add (data, beyond, TRUE);
+          gromit_region_flush (data);
+          gdk_region_destroy (beyond);
+          gdk_region_destroy (screen);
+        }
+      return;
+    }
+
+  if (!gromit_raster_alloc (data))
+    {
+      g_printerr ("Using server side rendering for page %d\n",
+                  data->cur_page + 1);
+      data->raster = raster;
+      data->shm_image = shm_image;
+      data->shape_image = shape_image;
+      data->shm_info = shm_info;
+      gromit_raster_destroy (data);
+      return;
+    }
+
+  gromit_raster_copy (data->raster, raster);
+
+  /* swap the old buffers back in for freeing them */
+  {
+    GromitRaster    *grown = data->raster;
+    XImage          *grown_image = data->shm_image;
+    XImage          *grown_shape = data->shape_image;
+    XShmSegmentInfo  grown_info = data->shm_info;
+
+    data->raster = raster;
+    data->shm_image = shm_image;
+    data->shape_image = shape_image;
+    data->shm_info = shm_info;
+    gromit_raster_destroy (data);
+
+    data->raster = grown;
+    data->shm_image = grown_image;
+    data->shape_image = grown_shape;
+    data->shm_info = grown_info;
+  }
+
+  /* the pixmap and the shape follow the raster, the new shape image
+   * starts out empty */
+  gromit_raster_put (data, &all);
+  if (!data->region_shape)
+    {
+      gdk_gc_set_foreground (data->shape_gc, data->transparent);
+      gdk_draw_rectangle (data->shape, data->shape_gc, TRUE,
+                          0, 0, data->width, data->height);
+      data->shape_dirty = all;
+      gromit_raster_commit_shape (data);
+    }
+}
+
+
+void
+gromit_page_resize (GromitData *data)
+{
+  GdkPixmap *pixmap = data->pixmap;
+
+  data->pixmap = gromit_pixmap_grow (data, data->pixmap, -1,
+                                     data->area->style->black_gc);
+  gdk_gc_set_foreground (data->shape_gc, data->transparent);
+  data->shape = gromit_pixmap_grow (data, data->shape, 1, data->shape_gc);
+
+  if (data->pixmap != pixmap && data->picture != None)
+    {
+      XRenderFreePicture (GDK_DISPLAY_XDISPLAY (data->display),
+                          data->picture);
+      data->picture = gromit_page_picture (data);
+    }
+
+  if (data->raster)
+    gromit_page_resize_raster (data);
+}
+
+
+void
+gromit_screen_changed (GdkScreen *screen, gpointer user_data)
+{
+  GromitData   *data = (GromitData *) user_data;
+  gint          width = gdk_screen_get_width (screen);
+  gint          height = gdk_screen_get_height (screen);
+  GdkRectangle  all = { 0, 0, width, height };
+  guint         i;
+
+  if (width == data->width && height == data->height)
+    return;
+
+  if (debug)
+    g_printerr ("Screen resized from %dx%d to %dx%d\n",
+                data->width, data->height, width, height);
+
+  /* the backdrop has the old size, a redraw starts over */
+  gromit_unfreeze (data);
+  gromit_text_end (data);
+  if (data->redraw)
+    gromit_page_release (data);
+
+  if (data->pixmap)
+    {
+      gromit_predict_clear (data);
+      gromit_worker_finish (data);
+      if (data->region_shape)
+        gromit_region_flush (data);
+      else if (data->raster)
+        gromit_raster_commit_shape (data);
+      else
+        gromit_grid_update (data);
+    }
+  gromit_persist_flush (data);
+
+  data->width = width;
+  data->height = height;
+  data->xinerama = gdk_screen_get_n_monitors (screen) > 1;
+
+  if (data->grid_mask)
+    {
+      g_object_unref (data->grid_mask);
+      data->grid_mask = gdk_pixmap_new (NULL, width, height, 1);
+    }
+
+  /*
+   * A session file only fits one size. The stored pages, including those
+   * that are not realized, move over to a new file which then replaces
+   * the old one.
+   */
+  if (data->session)
+    {
+      GromitSession *old = data->session;
+      gchar         *path = g_strconcat (data->session_path, ".XXXXXX", NULL);
+      gint           fd;
+
+      /* a new file of our own, nothing that happens to be there */
+      fd = g_mkstemp (path);
+      if (fd < 0)
+        {
+          g_printerr ("Unable to create %s: %s\n", path, g_strerror (errno));
+          data->session = NULL;
+        }
+      else
+        {
+          data->session = gromit_session_setup (data, path, fd);
+          if (!data->session)
+            unlink (path);
+        }
+
+      if (data->session)
+        {
+          for (i = 0; i < data->n_pages; i++)
+            gromit_session_migrate (old, data->session, i);
+          gromit_session_set_cur_page (data->session, data->cur_page);
+          if (rename (path, data->session_path) < 0)
+            g_printerr ("Unable to replace %s: %s\n", data->session_path,
+                        g_strerror (errno));
+        }
+      gromit_session_free (old);
+      g_free (path);
+    }
+
+  gromit_page_save (data, &data->pages[data->cur_page]);
+  for (i = 0; i < data->n_pages; i++)
+    {
+      gromit_page_load (data, &data->pages[i]);
+      if (data->pixmap)
+        {
+          gromit_page_resize (data);
+          if (data->session && data->raster)
+            {
+              gromit_session_begin (data->session, i);
+              gromit_session_store (data->session, i, data->raster, &all);
+              gromit_session_done (data->session, i);
+            }
+        }
+      gromit_page_save (data, &data->pages[i]);
+    }
+  gromit_page_load (data, &data->pages[data->cur_page]);
+  data->session_dirty.width = data->session_dirty.height = 0;
+
+  if (gromit_page_restorable (data) && !data->pixmap && !data->hidden)
+    gromit_page_realize (data);
+
+  gromit_painted_bounds (data);
+  if (data->hard_grab)
+    gromit_window_place (data, &all);
+  else
+    gromit_window_fit (data, TRUE);
+  gromit_apply_shape (data);
+  gromit_area_invalidate (data, NULL);
+}
+
+
+/*
+ * Switching pages only swaps the backing store: the new shape gets
+ * applied and the window is refreshed from the page's pixmap. A page
+ * without buffers gets realized from its strokes.
+ */
+
+void
+gromit_select_page (GromitData *data, guint page)
+{
+  if (page >= data->n_pages || page == data->cur_page)
+    return;
+
+  gromit_text_end (data);
+
+  /* rather than finishing it, a page still being redrawn starts over
+   * when it comes back */
+  if (data->redraw)
+    gromit_page_release (data);
+
+  /* bring the shape of the old page up to date */
+  if (data->pixmap)
+    {
+      gromit_predict_clear (data);
+      gromit_worker_finish (data);
+      if (data->region_shape)
+        gromit_region_flush (data);
+      else if (data->raster)
+        gromit_raster_commit_shape (data);
+      else
+        gromit_grid_update (data);
+    }
+  data->modified = 0;
+  data->delayed = 0;
+  gromit_persist_flush (data);
+  gromit_pointers_drop_strokes (data);
+
+  gromit_page_save (data, &data->pages[data->cur_page]);
+  data->cur_page = page;
+  gromit_page_load (data, &data->pages[page]);
+  if (data->session)
+    gromit_session_set_cur_page (data->session, page);
+
+  /* the mirrors may not have seen this page yet */
+  if (data->publisher)
+    gromit_publish_page (data);
+
+  if (gromit_page_restorable (data) && !data->pixmap)
+    gromit_page_realize (data);
+  else
+    gromit_painted_bounds (data);
+
+  gromit_window_fit (data, TRUE);
+  gromit_apply_shape (data);
+  if (data->pixmap)
+    gromit_area_invalidate (data, NULL);
+  if (data->grid_pending && !gdk_region_empty (data->grid_pending))
+    gromit_shape_later (data);
+
+  if (debug)
+    g_printerr ("Page %d\n", data->cur_page + 1);
+
+  if (data->painted)
+    gromit_show_window (data);
+  else if (!data->hard_grab)
+    gromit_hide_window (data);
+}
+
+
+void
+gromit_next_page (GromitData *data)
+{
+  gromit_select_page (data, data->cur_page + 1);
+}
+
+
+void
+gromit_prev_page (GromitData *data)
+{
+  if (data->cur_page > 0)
+    gromit_select_page (data, data->cur_page - 1);
+}
+
+
+void
+gromit_select_tool (GromitData *data, GdkDevice *device, guint state)
+{
+  guint buttons = 0, modifier = 0, len = 0;
+  guint req_buttons = 0, req_modifier = 0;
+  guint i, j, success = 0;
+  GromitPaintContext *context = NULL;
+  guchar *name;
+
+  if (device)
+    {
+      len = strlen (device->name);
+      name = g_strndup (device->name, len + 3);
+
+      /* Extract Button/Modifiers from state (see GdkModifierType) */
+      req_buttons = (state >> 8) & 31;
+
+      req_modifier = (state >> 1) & 7;
+      if (state & GDK_SHIFT_MASK) req_modifier |= 1;
+
+      name [len] = 124;
+      name [len+3] = 0;
+
+      /*  0, 1, 3, 7, 15, 31 */
+      context = NULL;
+      i=-1;
+      do
+        {
+          i++;
+          buttons = req_buttons & ((1 << i)-1);
+          j=-1;
+          do
+            {
+              j++;
+              modifier = req_modifier & ((1 << j)-1);
+              name [len+1] = buttons + 64;
+              name [len+2] = modifier + 48;
+              context = g_hash_table_lookup (data->tool_config, name);
+              if (context)
+                {
+                  data->cur_context = context;
+                  success = 1;
+                }
+            }
+          while (j<=3 && req_modifier >= (1 << j));
+        }
+      while (i<=5 && req_buttons >= (1 << i));
+
+      g_free (name);
+
+      if (!success)
+        {
+          if (device->source == GDK_SOURCE_ERASER)
+            data->cur_context = data->default_eraser;
+          else
+            data->cur_context = data->default_pen;
+        }
+    }
+  else
+    {
+      g_printerr ("ERROR: Attempt to select nonexistent device!\n");
+      data->cur_context = data->default_pen;
+    }
+
+  if (data->cur_context->type == GROMIT_ERASER)
+    gdk_window_set_cursor (data->win->window, data->erase_cursor);
+  else
+    gdk_window_set_cursor (data->win->window, data->paint_cursor);
+
+  data->state = state;
+  data->device = device;
+}
+
+
+/* tells the mirrors which stroke the following packets belong to */
+void
+gromit_publish_stroke (GromitData *data, GromitStroke *stroke)
+{
+  GromitPaintContext *context = stroke->context;
+  GromitStreamTool    tool;
+
+  if (stroke == data->published_stroke)
+    return;
+
+  tool.type = context->type;
+  tool.red = context->fg_color->red;
+  tool.green = context->fg_color->green;
+  tool.blue = context->fg_color->blue;
+  tool.width = context->width;
+  tool.arrowsize = context->arrowsize;
+  tool.opacity = context->opacity;
+  tool.font = context->font;
+
+  gromit_stream_stroke (data->publisher, &tool);
+  data->published_stroke = stroke;
+}
+
+
+/* the stroke the segments currently drawn belong to */
+GromitStroke *
+gromit_current_stroke (GromitData *data)
+{
+  if (!data->cur_stroke || data->cur_stroke->context != data->cur_context)
+    {
+      data->cur_stroke = gromit_stroke_new (data->cur_context);
+      data->strokes = g_list_prepend (data->strokes, data->cur_stroke);
+      gromit_highlight_reset (data);
+    }
+
+  return data->cur_stroke;
+}
+
+
+void
+gromit_draw_line (GromitData *data, gint x1, gint y1,
+                  gint x2, gint y2)
+{
+  GdkRectangle rect;
+  GdkRegion *spans = NULL;
+  gboolean threaded, highlight;
+
+  if (debug) fprintf(stderr, "line (%d,%d) (%d,%d)\n", x1, y1, x2, y2);
+
+  if (!data->pixmap)
+    gromit_page_realize (data);
+
+  rect.x = MIN (x1,x2) - data->maxwidth / 2;
+  rect.y = MIN (y1,y2) - data->maxwidth / 2;
+  rect.width = ABS (x1-x2) + data->maxwidth;
+  rect.height = ABS (y1-y2) + data->maxwidth;
+
+  /* what is below has to be there first */
+  if (data->redraw && !data->replaying)
+    gromit_redraw_area (data, &rect);
+
+  if (!data->replaying)
+    gromit_stroke_add_segment (gromit_current_stroke (data),
+                               x1, y1, x2, y2, data->maxwidth);
+
+  if (data->publisher && !data->replaying)
+    {
+      gromit_publish_stroke (data, data->cur_stroke);
+      gromit_stream_segment (data->publisher, x1, y1, x2, y2,
+                             data->maxwidth);
+    }
+
+  threaded = data->worker && data->raster && !data->replaying;
+  highlight = gromit_highlighting (data);
+
+  /* before the shape changes, the backdrop depends on it */
+  if (highlight)
+    gromit_highlight_line (data, x1, y1, x2, y2);
+
+  /* the shape and the color painted by the server get the same pixels */
+  if (data->region_shape && !threaded)
+    {
+      spans = gdk_region_new ();
+      gromit_line_spans (x1, y1, x2, y2, data->maxwidth,
+                         gromit_region_span, spans);
+      if (data->cur_context->shape_gc)
+        gromit_region_add (data, spans,
+                           data->cur_context->type == GROMIT_ERASER);
+    }
+
+  if (threaded)
+    {
+      gromit_worker_line (data->worker, data->raster,
+                          x1, y1, x2, y2, data->maxwidth,
+                          data->cur_context->fg_color->pixel,
+                          gromit_raster_op (data->cur_context),
+                          gromit_work_flags (data));
+    }
+  else if (data->raster)
+    {
+      GromitRasterOp op = gromit_raster_op (data->cur_context);
+      GdkRectangle   dirty = { 0, 0, 0, 0 };
+
+      gromit_raster_line (data->raster, x1, y1, x2, y2, data->maxwidth,
+                          data->cur_context->fg_color->pixel, op, &dirty);
+
+      if (data->cur_context->paint_gc && !data->replaying)
+        gromit_raster_upload (data, &dirty);
+
+      if (data->cur_context->shape_gc && !data->region_shape)
+        {
+          gromit_rect_union (&data->shape_dirty, &dirty);
+          data->modified = 1;
+        }
+    }
+  else
+    {
+      if (data->cur_context->paint_gc && !highlight && spans)
+        {
+          GdkGC        *gc = data->cur_context->paint_gc;
+          GdkRectangle  box;
+
+          gdk_region_get_clipbox (spans, &box);
+          gdk_gc_set_clip_region (gc, spans);
+          gdk_draw_rectangle (data->pixmap, gc, TRUE,
+                              box.x, box.y, box.width, box.height);
+          gdk_gc_set_clip_region (gc, NULL);
+        }
+      else if (data->cur_context->paint_gc && !highlight)
+        gdk_draw_line (data->pixmap,
+                       gromit_paint_context_gc (data, data->cur_context,
+                                                FALSE, data->maxwidth),
+                       x1, y1, x2, y2);
+
+      if (data->cur_context->shape_gc && !data->region_shape)
+        {
+          gdk_draw_line (data->shape,
+                         gromit_paint_context_gc (data, data->cur_context,
+                                                  TRUE, data->maxwidth),
+                         x1, y1, x2, y2);
+          gromit_grid_dirty (data, &rect,
+                             data->cur_context->type == GROMIT_ERASER);
+          data->modified = 1;
+        }
+    }
+
+  if (data->cur_context->paint_gc && !data->replaying && !threaded)
+     gromit_area_draw (data, &rect);
+  if (data->cur_context->type != GROMIT_ERASER)
+    gromit_painted_add (data, &rect);
+
+  if (spans)
+    gdk_region_destroy (spans);
+
+  data->painted = 1;
+}
+
+
+void
+gromit_draw_arrow (GromitData *data, gint x1, gint y1,
+                   gint width, gfloat direction)
+{
+  GdkRectangle rect;
+  GdkPoint arrowhead [4];
+  gboolean threaded, highlight;
+
+  if (!data->pixmap)
+    gromit_page_realize (data);
+
+  if (!data->replaying)
+    gromit_stroke_set_arrow (gromit_current_stroke (data),
+                             x1, y1, width, direction);
+
+  if (data->publisher && !data->replaying)
+    {
+      gromit_publish_stroke (data, data->cur_stroke);
+      gromit_stream_arrow (data->publisher, x1, y1, width, direction);
+    }
+
+  gromit_arrowhead (x1, y1, width, direction, arrowhead);
+
+  width = width / 2;
+
+  /* I doubt that calculating the boundary box more exact is very useful */
+  rect.x = x1 - 4 * width - 1;
+  rect.y = y1 - 4 * width - 1;
+  rect.width = 8 * width + 2;
+  rect.height = 8 * width + 2;
+
+  if (data->redraw && !data->replaying)
+    gromit_redraw_area (data, &rect);
+
+  threaded = data->worker && data->raster && !data->replaying;
+  highlight = gromit_highlighting (data);
+
+  if (highlight)
+    gromit_highlight (data, gdk_region_polygon (arrowhead, 4,
+                                                GDK_WINDING_RULE));
+
+  if (data->region_shape && data->cur_context->shape_gc && !threaded)
+    {
+      GdkRegion *delta = gdk_region_polygon (arrowhead, 4, GDK_WINDING_RULE);
+
+      gromit_region_add (data, delta,
+                         data->cur_context->type == GROMIT_ERASER);
+      gdk_region_destroy (delta);
+    }
+
+  if (threaded)
+    {
+      gromit_worker_polygon (data->worker, data->raster, arrowhead, 4,
+                             data->cur_context->fg_color->pixel,
+                             data->black->pixel,
+                             gromit_raster_op (data->cur_context),
+                             gromit_work_flags (data) | GROMIT_WORK_OUTLINE);
+    }
+  else if (data->raster)
+    {
+      GromitRasterOp op = gromit_raster_op (data->cur_context);
+      GdkRectangle   dirty = { 0, 0, 0, 0 };
+      gint           i;
+
+      gromit_raster_polygon (data->raster, arrowhead, 4,
+                             data->cur_context->fg_color->pixel, op, &dirty);
+      for (i = 0; i < 4; i++)
+        gromit_raster_line (data->raster,
+                            arrowhead[i].x, arrowhead[i].y,
+                            arrowhead[(i+1) % 4].x, arrowhead[(i+1) % 4].y,
+                            0, data->black->pixel, op, &dirty);
+
+      if (data->cur_context->paint_gc && !data->replaying)
+        gromit_raster_upload (data, &dirty);
+
+      if (data->cur_context->shape_gc && !data->region_shape)
+        {
+          gromit_rect_union (&data->shape_dirty, &dirty);
+          data->modified = 1;
+        }
+    }
+  else
+    {
+      if (data->cur_context->paint_gc && !highlight)
+        {
+          GdkGC *gc = gromit_paint_context_gc (data, data->cur_context,
+                                               FALSE, 0);
+
+          gdk_draw_polygon (data->pixmap, gc, TRUE, arrowhead, 4);
+          gdk_gc_set_foreground (gc, data->black);
+          gdk_draw_polygon (data->pixmap, gc, FALSE, arrowhead, 4);
+          gdk_gc_set_foreground (gc, data->cur_context->fg_color);
+        }
+
+      if (data->cur_context->shape_gc && !data->region_shape)
+        {
+          GdkGC *gc = gromit_paint_context_gc (data, data->cur_context,
+                                               TRUE, 0);
+
+          gdk_draw_polygon (data->shape, gc, TRUE, arrowhead, 4);
+          gdk_draw_polygon (data->shape, gc, FALSE, arrowhead, 4);
+          gromit_grid_dirty (data, &rect,
+                             data->cur_context->type == GROMIT_ERASER);
+          data->modified = 1;
+        }
+    }
+
+  if (data->cur_context->paint_gc && !data->replaying && !threaded)
+    gromit_area_draw (data, &rect);
+  if (data->cur_context->type != GROMIT_ERASER)
+    gromit_painted_add (data, &rect);
+
+  data->painted = 1;
+}
+
+
+/*
+ * The TEXT tool: a click places the caret, then every typed character
+ * gets drawn as one glyph from the glyph cache (see glyph.c). The label
+ * is kept as the text of a stroke.
+ */
+
+GromitFont *
+gromit_text_font (GromitPaintContext *context)
+{
+  return gromit_font_get (context->font ? context->font : GROMIT_DEFAULT_FONT,
+                          context->width);
+}
+
+
+void
+gromit_draw_glyph (GromitData *data, GromitPaintContext *context,
+                   GromitFont *font, GromitGlyph *glyph,
+                   gint x, gint y, gboolean erase)
+{
+  GdkRectangle rect;
+
+  rect.x = x + glyph->x_offset;
+  rect.y = y + glyph->y_offset;
+  rect.width = glyph->width;
+  rect.height = glyph->height;
+
+  if (rect.width <= 0 || rect.height <= 0)
+    return;
+
+  if (data->region_shape)
+    {
+      GdkRegion *delta = gdk_region_copy (glyph->region);
+
+      gdk_region_offset (delta, rect.x, rect.y);
+      gromit_region_add (data, delta, erase);
+      gdk_region_destroy (delta);
+    }
+
+  if (data->raster)
+    {
+      GdkRectangle dirty = { 0, 0, 0, 0 };
+
+      gromit_worker_finish (data);
+      gromit_raster_bitmap (data->raster, rect.x, rect.y,
+                            rect.width, rect.height,
+                            glyph->bits, glyph->bytes_per_line,
+                            context->fg_color->pixel,
+                            erase ? GROMIT_RASTER_ERASE : GROMIT_RASTER_PAINT,
+                            &dirty);
+
+      if (!erase && !data->replaying)
+        gromit_raster_upload (data, &dirty);
+
+      if (!data->region_shape)
+        {
+          gromit_rect_union (&data->shape_dirty, &dirty);
+          data->modified = 1;
+        }
+    }
+  else
+    {
+      /* fill the glyph's box through the atlas */
+      if (!erase)
+        {
+          gdk_gc_set_clip_mask (context->paint_gc, font->atlas);
+          gdk_gc_set_clip_origin (context->paint_gc,
+                                  rect.x - glyph->atlas_x,
+                                  rect.y - glyph->atlas_y);
+          gdk_draw_rectangle (data->pixmap, context->paint_gc, TRUE,
+                              rect.x, rect.y, rect.width, rect.height);
+          gdk_gc_set_clip_mask (context->paint_gc, NULL);
+        }
+
+      if (!data->region_shape)
+        {
+          gdk_gc_set_foreground (data->shape_gc,
+                                 erase ? data->transparent : data->opaque);
+          gdk_gc_set_clip_mask (data->shape_gc, font->atlas);
+          gdk_gc_set_clip_origin (data->shape_gc,
+                                  rect.x - glyph->atlas_x,
+                                  rect.y - glyph->atlas_y);
+          gdk_draw_rectangle (data->shape, data->shape_gc, TRUE,
+                              rect.x, rect.y, rect.width, rect.height);
+          gdk_gc_set_clip_mask (data->shape_gc, NULL);
+          gromit_grid_dirty (data, &rect, erase);
+          data->modified = 1;
+        }
+    }
+
+  if (!data->replaying)
+    gromit_area_draw (data, &rect);
+  if (!erase)
+    gromit_painted_add (data, &rect);
+
+  data->painted = 1;
+}
+
+
+/* lays out (and draws) the label of stroke, no kerning or shaping */
+void
+gromit_draw_text (GromitData *data, GromitStroke *stroke, gboolean draw,
+                  gint *pen_x, gint *pen_y)
+{
+  GromitPaintContext *context = stroke->context;
+  GromitFont         *font = gromit_text_font (context);
+  GromitGlyph        *glyph;
+  const gchar        *p;
+  gunichar            c;
+  gint                x = stroke->text_x;
+  gint                y = stroke->text_y;
+
+  for (p = stroke->text->str; *p; p = g_utf8_next_char (p))
+    {
+      c = g_utf8_get_char (p);
+      if (c == '\n')
+        {
+          x = stroke->text_x;
+          y += font->height;
+          continue;
+        }
+
+      glyph = gromit_font_glyph (font, c);
+      if (draw)
+        gromit_draw_glyph (data, context, font, glyph, x, y, FALSE);
+      x += glyph->advance;
+    }
+
+  if (pen_x)
+    *pen_x = x;
+  if (pen_y)
+    *pen_y = y;
+}
+
+
+void
+gromit_text_move_caret (GromitData *data)
+{
+  gtk_window_move (GTK_WINDOW (data->caret),
+                   data->text_pen_x, data->text_pen_y);
+}
+
+
+void
+gromit_text_begin (GromitData *data, gint x, gint y)
+{
+  GromitPaintContext *context = data->cur_context;
+  GromitFont         *font = gromit_text_font (context);
+  GromitStroke       *stroke;
+
+  gromit_text_end (data);
+
+  if (!data->pixmap)
+    gromit_page_realize (data);
+
+  /* there is no telling where the label is going to end */
+  gromit_redraw_area (data, NULL);
+
+  /* the click marks the middle of the first line */
+  stroke = gromit_stroke_new (context);
+  stroke->text = g_string_new ("");
+  stroke->text_x = x;
+  stroke->text_y = y - font->height / 2;
+  data->strokes = g_list_prepend (data->strokes, stroke);
+
+  data->text_stroke = stroke;
+  data->text_pen_x = stroke->text_x;
+  data->text_pen_y = stroke->text_y;
+
+  gdk_keyboard_grab (data->area->window, FALSE, GDK_CURRENT_TIME);
+
+  gtk_widget_modify_bg (data->caret, GTK_STATE_NORMAL, context->fg_color);
+  gtk_window_resize (GTK_WINDOW (data->caret), 2, font->height);
+  gromit_text_move_caret (data);
+  gtk_widget_show (data->caret);
+  gdk_window_raise (data->caret->window);
+}
+
+
+void
+gromit_text_end (GromitData *data)
+{
+  GromitStroke *stroke = data->text_stroke;
+
+  if (!stroke)
+    return;
+
+  if (stroke->text->len == 0)
+    {
+      data->strokes = g_list_remove (data->strokes, stroke);
+      gromit_stroke_free (stroke);
+    }
+  else if (data->publisher)
+    {
+      /* labels get sent once they are finished */
+      gromit_publish_stroke (data, stroke);
+      gromit_stream_text (data->publisher, stroke->text_x, stroke->text_y,
+                          stroke->text->str);
+    }
+
+  data->text_stroke = NULL;
+  gdk_display_keyboard_ungrab (data->display, GDK_CURRENT_TIME);
+  gtk_widget_hide (data->caret);
+}
+
+
+void
+gromit_text_insert (GromitData *data, gunichar c)
+{
+  GromitStroke *stroke = data->text_stroke;
+  GromitFont   *font = gromit_text_font (stroke->context);
+  GromitGlyph  *glyph;
+
+  if (!data->pixmap)
+    gromit_page_realize (data);
+  gromit_redraw_area (data, NULL);
+
+  if (c == '\n')
+    {
+      data->text_pen_x = stroke->text_x;
+      data->text_pen_y += font->height;
+    }
+  else
+    {
+      glyph = gromit_font_glyph (font, c);
+      gromit_draw_glyph (data, stroke->context, font, glyph,
+                         data->text_pen_x, data->text_pen_y, FALSE);
+      data->text_pen_x += glyph->advance;
+    }
+
+  g_string_append_unichar (stroke->text, c);
+  gromit_text_move_caret (data);
+}
+
+
+/* erases the last glyph; where it covered older drawing that is lost */
+void
+gromit_text_delete (GromitData *data)
+{
+  GromitStroke *stroke = data->text_stroke;
+  GromitFont   *font = gromit_text_font (stroke->context);
+  gchar        *last;
+  gunichar      c;
+
+  if (stroke->text->len == 0)
+    return;
+
+  last = g_utf8_find_prev_char (stroke->text->str,
+                                stroke->text->str + stroke->text->len);
+  c = g_utf8_get_char (last);
+  g_string_truncate (stroke->text, last - stroke->text->str);
+
+  gromit_draw_text (data, stroke, FALSE,
+                    &data->text_pen_x, &data->text_pen_y);
+
+  if (c != '\n' && data->pixmap)
+    gromit_draw_glyph (data, stroke->context, font,
+                       gromit_font_glyph (font, c),
+                       data->text_pen_x, data->text_pen_y, TRUE);
+
+  gromit_text_move_caret (data);
+}
+
+
+gboolean
+gromit_text_key (GromitData *data, GdkEventKey *event)
+{
+  gunichar c;
 
-  if (data->cur_context->shape_gc)
+  switch (event->keyval)
     {
-      gdk_draw_line (data->shape, data->cur_context->shape_gc,
-                     x1, y1, x2, y2);
-      data->modified = 1;
+      case GDK_Escape:
+        gromit_text_end (data);
+        break;
+      case GDK_Return:
+      case GDK_KP_Enter:
+        gromit_text_insert (data, '\n');
+        break;
+      case GDK_BackSpace:
+        gromit_text_delete (data);
+        break;
+      default:
+        c = gdk_keyval_to_unicode (event->keyval);
+        if (c && g_unichar_isprint (c))
+          gromit_text_insert (data, c);
+        break;
     }
 
-  if (data->cur_context->paint_gc)
-     gtk_widget_draw (data->area, &rect);
+  return TRUE;
+}
+
 
-  data->painted = 1;
+/*
+ * The shape tools. While the button is down the shape is only shown
+ * in a small shaped popup window; the pixmap, the shape and the stroke
+ * list see it once, when the button gets released.
+ */
+
+gboolean
+gromit_shape_tool (GromitPaintContext *context)
+{
+  return (context->type == GROMIT_LINE ||
+          context->type == GROMIT_RECT ||
+          context->type == GROMIT_ELLIPSE);
 }
 
 
 void
-gromit_draw_arrow (GromitData *data, gint x1, gint y1,
-                   gint width, gfloat direction)
+gromit_shape_preview (GromitData *data, gint x, gint y)
 {
+  GdkPoint    *points;
+  GdkBitmap   *mask;
   GdkRectangle rect;
-  GdkPoint arrowhead [4];
+  gint         i, n;
 
-  width = width / 2;
+  points = gromit_shape_points (data->cur_context->type,
+                                data->anchor_x, data->anchor_y, x, y, &n);
+
+  rect.x = MIN (data->anchor_x, x) - data->maxwidth / 2 - 1;
+  rect.y = MIN (data->anchor_y, y) - data->maxwidth / 2 - 1;
+  rect.width = ABS (x - data->anchor_x) + data->maxwidth + 2;
+  rect.height = ABS (y - data->anchor_y) + data->maxwidth + 2;
+
+  for (i = 0; i < n; i++)
+    {
+      points[i].x -= rect.x;
+      points[i].y -= rect.y;
+    }
+
+  if (!data->preview)
+    {
+      data->preview = gtk_window_new (GTK_WINDOW_POPUP);
+      gtk_widget_set_size_request (data->preview, 1, 1);
+      gtk_widget_realize (data->preview);
+    }
+
+  mask = gdk_pixmap_new (data->root, rect.width, rect.height, 1);
+  if (!data->preview_gc)
+    data->preview_gc = gdk_gc_new (mask);
+
+  gdk_gc_set_foreground (data->preview_gc, data->transparent);
+  gdk_draw_rectangle (mask, data->preview_gc, TRUE,
+                      0, 0, rect.width, rect.height);
+  gdk_gc_set_foreground (data->preview_gc, data->opaque);
+  gdk_gc_set_line_attributes (data->preview_gc, data->maxwidth,
+                              GDK_LINE_SOLID, GDK_CAP_ROUND, GDK_JOIN_ROUND);
+  gdk_draw_lines (mask, data->preview_gc, points, n);
+
+  gtk_window_move (GTK_WINDOW (data->preview), rect.x, rect.y);
+  gtk_window_resize (GTK_WINDOW (data->preview), rect.width, rect.height);
+  gtk_widget_shape_combine_mask (data->preview, mask, 0, 0);
+
+  if (!data->previewing)
+    {
+      gtk_widget_modify_bg (data->preview, GTK_STATE_NORMAL,
+                            data->cur_context->fg_color);
+      gtk_widget_show (data->preview);
+      gdk_window_raise (data->preview->window);
+      data->previewing = TRUE;
+    }
+
+  g_object_unref (mask);
+  g_free (points);
+}
 
-  /* I doubt that calculating the boundary box more exact is very useful */
-  rect.x = x1 - 4 * width - 1;
-  rect.y = y1 - 4 * width - 1;
-  rect.width = 8 * width + 2;
-  rect.height = 8 * width + 2;
 
-  arrowhead [0].x = x1 + 4 * width * cos (direction);
-  arrowhead [0].y = y1 + 4 * width * sin (direction);
+void
+gromit_shape_cancel (GromitData *data)
+{
+  if (!data->previewing)
+    return;
+
+  gtk_widget_hide (data->preview);
+  data->previewing = FALSE;
+}
 
-  arrowhead [1].x = x1 - 3 * width * cos (direction)
-                       + 3 * width * sin (direction);
-  arrowhead [1].y = y1 - 3 * width * cos (direction)
-                       - 3 * width * sin (direction);
 
-  arrowhead [2].x = x1 - 2 * width * cos (direction);
-  arrowhead [2].y = y1 - 2 * width * sin (direction);
+void
+gromit_shape_commit (GromitData *data, gint x, gint y)
+{
+  GdkPoint *points;
+  gint      i, n;
+  gint      width;
 
-  arrowhead [3].x = x1 - 3 * width * cos (direction)
-                       - 3 * width * sin (direction);
-  arrowhead [3].y = y1 + 3 * width * cos (direction)
-                       - 3 * width * sin (direction);
+  gromit_shape_cancel (data);
 
-  if (data->cur_context->paint_gc)
-    gdk_gc_set_line_attributes (data->cur_context->paint_gc,
-                                0, GDK_LINE_SOLID,
-                                GDK_CAP_ROUND, GDK_JOIN_ROUND);
+  points = gromit_shape_points (data->cur_context->type,
+                                data->anchor_x, data->anchor_y, x, y, &n);
 
-  if (data->cur_context->shape_gc)
-    gdk_gc_set_line_attributes (data->cur_context->shape_gc,
-                                0, GDK_LINE_SOLID,
-                                GDK_CAP_ROUND, GDK_JOIN_ROUND);
+  for (i = 1; i < n; i++)
+    gromit_draw_line (data, points[i-1].x, points[i-1].y,
+                      points[i].x, points[i].y);
 
-  if (data->cur_context->paint_gc)
+  if (data->cur_context->type == GROMIT_LINE &&
+      data->cur_context->arrowsize != 0 &&
+      (x != data->anchor_x || y != data->anchor_y))
     {
-      gdk_draw_polygon (data->pixmap, data->cur_context->paint_gc,
-                        TRUE, arrowhead, 4);
-      gdk_gc_set_foreground (data->cur_context->paint_gc, data->black);
-      gdk_draw_polygon (data->pixmap, data->cur_context->paint_gc,
-                        FALSE, arrowhead, 4);
-      gdk_gc_set_foreground (data->cur_context->paint_gc,
-                             data->cur_context->fg_color);
+      width = data->cur_context->arrowsize * data->cur_context->width / 2;
+      gromit_draw_arrow (data, x, y, width,
+                         atan2 (y - data->anchor_y, x - data->anchor_x));
+    }
+
+  g_free (points);
+}
+
+
+/*
+ * Streaming. A publisher sends what gets drawn to the mirrors as it
+ * happens, a mirror draws it through the usual functions.
+ */
+
+void
+gromit_publish_segment (gint x1, gint y1, gint x2, gint y2, gint width,
+                        gpointer user_data)
+{
+  GromitData *data = (GromitData *) user_data;
+
+  gromit_stream_segment (data->publisher, x1, y1, x2, y2, width);
+}
+
+
+/* sends the whole current page */
+void
+gromit_publish_page (GromitData *data)
+{
+  GromitStroke *stroke;
+  GList        *ptr;
+
+  gromit_stream_page (data->publisher, data->cur_page);
+  gromit_stream_clear (data->publisher);
+  data->published_stroke = NULL;
+
+  for (ptr = g_list_last (data->strokes); ptr; ptr = ptr->prev)
+    {
+      stroke = ptr->data;
+
+      if (stroke == data->text_stroke)
+        continue;
+
+      gromit_publish_stroke (data, stroke);
+      if (stroke->text)
+        gromit_stream_text (data->publisher, stroke->text_x,
+                            stroke->text_y, stroke->text->str);
+      else
+        gromit_stroke_foreach_segment (stroke, gromit_publish_segment, data);
+
+      if (stroke->has_arrow)
+        gromit_stream_arrow (data->publisher,
+                             stroke->arrow_x, stroke->arrow_y,
+                             stroke->arrow_width, stroke->arrow_direction);
+    }
+
+  /* the live packets go to all mirrors again */
+  data->published_stroke = NULL;
+}
+
+
+void
+gromit_publish_subscribe (GromitStream *stream, gpointer user_data)
+{
+  gromit_publish_page ((GromitData *) user_data);
+}
+
+
+void
+gromit_mirror_clear (gpointer user_data)
+{
+  GromitData *data = (GromitData *) user_data;
+  guint       hidden = data->hidden;
+
+  /* keep the mirror visible for what comes next */
+  gromit_clear_screen (data);
+  if (!hidden)
+    gromit_show_window (data);
+}
+
+
+/* a mirror shows up with the first thing drawn, like a local paint */
+void
+gromit_mirror_show (GromitData *data)
+{
+  if (data->hidden)
+    gromit_show_window (data);
+}
+
+
+void
+gromit_mirror_page (guint page, gpointer user_data)
+{
+  gromit_select_page ((GromitData *) user_data, page);
+}
+
+
+/* the publisher's tools, created as they show up */
+GromitPaintContext *
+gromit_mirror_tool (GromitData *data, const GromitStreamTool *tool)
+{
+  GromitPaintContext *context;
+  GdkColor           *color;
+  gchar              *key;
+
+  key = g_strdup_printf ("%d %04x%04x%04x %d %.3f %.3f %s",
+                         tool->type, tool->red, tool->green, tool->blue,
+                         tool->width, tool->arrowsize, tool->opacity,
+                         tool->font ? tool->font : "");
+
+  context = g_hash_table_lookup (data->mirror_tools, key);
+  if (context)
+    {
+      g_free (key);
+      return context;
     }
 
-  if (data->cur_context->shape_gc)
+  /* every tool costs a GC and a color, a publisher must not run us out */
+  if (g_hash_table_size (data->mirror_tools) >= GROMIT_MIRROR_MAX_TOOLS)
     {
-      gdk_draw_polygon (data->shape, data->cur_context->shape_gc,
-                        TRUE, arrowhead, 4);
-      gdk_draw_polygon (data->shape, data->cur_context->shape_gc,
-                        FALSE, arrowhead, 4);
-      data->modified = 1;
+      g_free (key);
+      return data->default_pen;
     }
 
-  if (data->cur_context->paint_gc)
-    gtk_widget_draw (data->area, &rect);
+  color = g_malloc (sizeof (GdkColor));
+  color->red = tool->red;
+  color->green = tool->green;
+  color->blue = tool->blue;
+  gdk_colormap_alloc_color (data->cm, color, FALSE, TRUE);
+
+  context = gromit_paint_context_new (data,
+                                      tool->type >= 0 &&
+                                      tool->type <= GROMIT_ELLIPSE ?
+                                      tool->type : GROMIT_PEN,
+                                      color, tool->width,
+                                      tool->arrowsize, tool->opacity);
+  context->font = g_strdup (tool->font);
+
+  g_hash_table_insert (data->mirror_tools, key, context);
+  if (g_hash_table_size (data->mirror_tools) == GROMIT_MIRROR_MAX_TOOLS)
+    g_printerr ("Too many tools from %s, new ones use the default pen\n",
+                data->mirror_path);
 
-  data->painted = 1;
+  return context;
+}
+
+
+void
+gromit_mirror_stroke (const GromitStreamTool *tool, gpointer user_data)
+{
+  GromitData *data = (GromitData *) user_data;
+
+  gromit_mirror_show (data);
+  gromit_pointer_switch (data, data->mirror);
+  data->cur_context = gromit_mirror_tool (data, tool);
+  data->cur_stroke = NULL;
+}
+
+
+void
+gromit_mirror_segment (gint x1, gint y1, gint x2, gint y2, gint width,
+                       gpointer user_data)
+{
+  GromitData *data = (GromitData *) user_data;
+
+  gromit_mirror_show (data);
+  gromit_pointer_switch (data, data->mirror);
+  data->maxwidth = width;
+  gromit_draw_line (data, x1, y1, x2, y2);
+}
+
+
+void
+gromit_mirror_arrow (gint x, gint y, gint width, gfloat direction,
+                     gpointer user_data)
+{
+  GromitData *data = (GromitData *) user_data;
+
+  gromit_mirror_show (data);
+  gromit_pointer_switch (data, data->mirror);
+  gromit_draw_arrow (data, x, y, width, direction);
+}
+
+
+void
+gromit_mirror_text (gint x, gint y, const gchar *text, gpointer user_data)
+{
+  GromitData   *data = (GromitData *) user_data;
+  GromitStroke *stroke;
+
+  gromit_mirror_show (data);
+  gromit_pointer_switch (data, data->mirror);
+
+  if (!data->pixmap)
+    gromit_page_realize (data);
+
+  stroke = gromit_current_stroke (data);
+  stroke->text = g_string_new (text);
+  stroke->text_x = x;
+  stroke->text_y = y;
+  gromit_draw_text (data, stroke, TRUE, NULL, NULL);
+
+  if (data->publisher)
+    {
+      gromit_publish_stroke (data, stroke);
+      gromit_stream_text (data->publisher, x, y, text);
+    }
+
+  data->cur_stroke = NULL;
 }
 
 
+static const GromitStreamHandler gromit_mirror_handler =
+{
+  gromit_mirror_clear,
+  gromit_mirror_page,
+  gromit_mirror_stroke,
+  gromit_mirror_segment,
+  gromit_mirror_arrow,
+  gromit_mirror_text
+};
+
+
 /*
  * Event-Handlers to perform the drawing
  */
 
+/* real input has to wait while a trace gets replayed */
+gboolean
+gromit_replay_ignore (GromitData *data, GdkEvent *ev)
+{
+  return data->replay && ev != data->replay_event;
+}
+
+
 gboolean
 proximity_in (GtkWidget *win, GdkEventProximity *ev, gpointer user_data)
 {
@@ -654,7 +4819,16 @@ proximity_in (GtkWidget *win, GdkEventProximity *ev, gpointer user_data)
   gint x, y;
   GdkModifierType state;
 
-  gdk_window_get_pointer (data->win->window, &x, &y, &state);
+  if (gromit_replay_ignore (data, (GdkEvent *) ev))
+    return TRUE;
+
+  gromit_pointer_switch (data, ev->device);
+  if (data->replay)
+    state = gromit_trace_state (data->replay);
+  else
+    gdk_window_get_pointer (data->win->window, &x, &y, &state);
+  if (data->trace)
+    gromit_trace_write_event (data->trace, (GdkEvent *) ev, state);
   gromit_select_tool (data, ev->device, state);
 
   return TRUE;
@@ -666,6 +4840,12 @@ proximity_out (GtkWidget *win, GdkEventProximity *ev, gpointer user_data)
 {
   GromitData *data = (GromitData *) user_data;
 
+  if (gromit_replay_ignore (data, (GdkEvent *) ev))
+    return TRUE;
+  if (data->trace)
+    gromit_trace_write_event (data->trace, (GdkEvent *) ev, 0);
+
+  gromit_pointer_switch (data, ev->device);
   data->cur_context = data->default_pen;
 
   if (data->cur_context->type == GROMIT_ERASER)
@@ -686,20 +4866,39 @@ paint (GtkWidget *win, GdkEventButton *ev, gpointer user_data)
   GromitData *data = (GromitData *) user_data;
   gdouble pressure = 0.5;
 
+  if (gromit_replay_ignore (data, (GdkEvent *) ev))
+    return TRUE;
+  if (data->trace)
+    gromit_trace_write_event (data->trace, (GdkEvent *) ev, ev->state);
+
   if (!data->hard_grab)
     return FALSE;
 
+  gromit_pointer_switch (data, ev->device);
+  gromit_pointer_fix (data, &ev->x, &ev->y);
+
   /* See GdkModifierType. Am I fixing a Gtk misbehaviour???  */
   ev->state |= 1 << (ev->button + 7);
   if (ev->state != data->state || ev->device != data->device)
     gromit_select_tool (data, ev->device, ev->state);
 
-  gdk_window_set_background (data->area->window,
-                             data->cur_context->fg_color);
+  if (data->cur_context->type == GROMIT_TEXT)
+    {
+      gromit_text_begin (data, ev->x, ev->y);
+      return TRUE;
+    }
+  gromit_text_end (data);
+
+  if (!data->frozen)
+    gdk_window_set_background (data->area->window,
+                               data->cur_context->fg_color);
 
   data->lastx = ev->x;
   data->lasty = ev->y;
+  data->anchor_x = ev->x;
+  data->anchor_y = ev->y;
   data->motion_time = ev->time;
+  data->predict_time = 0;
 
   if (ev->device->source == GDK_SOURCE_MOUSE)
     {
@@ -711,7 +4910,7 @@ paint (GtkWidget *win, GdkEventButton *ev, gpointer user_data)
       data->maxwidth = (CLAMP (pressure * pressure,0,1) *
                         (double) data->cur_context->width);
     }
-  if (ev->button <= 5)
+  if (ev->button <= 5 && !gromit_shape_tool (data->cur_context))
      gromit_draw_line (data, ev->x, ev->y, ev->x, ev->y);
 
   gromit_coord_list_prepend (data, ev->x, ev->y, data->maxwidth);
@@ -730,20 +4929,51 @@ paintto (GtkWidget *win,
 {
   GromitData *data = (GromitData *) user_data;
   GdkTimeCoord **coords = NULL;
-  int nevents;
+  int nevents = 0;
   int i;
-  gboolean ret;
   gdouble pressure = 0.5;
 
+  if (gromit_replay_ignore (data, (GdkEvent *) ev))
+    return TRUE;
+
+  /* paintend () hands its release event in, that one is recorded there */
+  if (data->trace && ev->type == GDK_MOTION_NOTIFY)
+    gromit_trace_write_event (data->trace, (GdkEvent *) ev, ev->state);
+
   if (!data->hard_grab)
     return FALSE;
 
+  gromit_pointer_switch (data, ev->device);
+  gromit_pointer_fix (data, &ev->x, &ev->y);
+  gromit_predict_clear (data);
+
   if (ev->state != data->state || ev->device != data->device)
      gromit_select_tool (data, ev->device, ev->state);
 
-  ret = gdk_device_get_history (ev->device, ev->window,
-                                data->motion_time, ev->time,
-                                &coords, &nevents);
+  if (data->cur_context->type == GROMIT_TEXT)
+    return TRUE;
+
+  if (gromit_shape_tool (data->cur_context))
+    {
+      gromit_shape_preview (data, ev->x, ev->y);
+      data->lastx = ev->x;
+      data->lasty = ev->y;
+      return TRUE;
+    }
+
+  if (data->replay)
+    {
+      gromit_trace_read_history (data->replay, &coords, &nevents);
+    }
+  else
+    {
+      gdk_device_get_history (ev->device, ev->window,
+                              data->motion_time, ev->time,
+                              &coords, &nevents);
+      if (data->trace)
+        gromit_trace_write_history (data->trace, ev->device,
+                                    coords, nevents);
+    }
 
   /* g_printerr ("Got %d coords\n", nevents); */
   if (!data->xinerama && nevents > 0)
@@ -766,6 +4996,12 @@ paintto (GtkWidget *win,
                                   GDK_AXIS_X, &x);
               gdk_device_get_axis(ev->device, coords[i]->axes,
                                   GDK_AXIS_Y, &y);
+              gromit_pointer_fix (data, &x, &y);
+
+              /* under load, see gromit_quality_sample () */
+              if (ABS (x - data->lastx) + ABS (y - data->lasty) <
+                  (1 << data->quality) - 1)
+                continue;
 
               gromit_draw_line (data, data->lastx, data->lasty, x, y);
 
@@ -776,9 +5012,11 @@ paintto (GtkWidget *win,
         }
 
       data->motion_time = coords[nevents-1]->time;
-      g_free (coords);
     }
 
+  if (coords)
+    gdk_device_free_history (coords, nevents);
+
   /* always paint to the current event coordinate. */
   gdk_event_get_axis ((GdkEvent *) ev, GDK_AXIS_PRESSURE, &pressure);
 
@@ -792,6 +5030,7 @@ paintto (GtkWidget *win,
       gromit_draw_line (data, data->lastx, data->lasty, ev->x, ev->y);
 
       gromit_coord_list_prepend (data, ev->x, ev->y, data->maxwidth);
+      gromit_predict (data, ev->time, ev->x, ev->y);
     }
 
   data->lastx = ev->x;
@@ -805,9 +5044,18 @@ gboolean
 paintend (GtkWidget *win, GdkEventButton *ev, gpointer user_data)
 {
   GromitData *data = (GromitData *) user_data;
-  gint width = data->cur_context->arrowsize * data->cur_context->width / 2;
+  gint width;
   gfloat direction = 0;
 
+  if (gromit_replay_ignore (data, (GdkEvent *) ev))
+    return TRUE;
+  if (data->trace)
+    gromit_trace_write_event (data->trace, (GdkEvent *) ev, ev->state);
+
+  gromit_pointer_switch (data, ev->device);
+  gromit_pointer_fix (data, &ev->x, &ev->y);
+  width = data->cur_context->arrowsize * data->cur_context->width / 2;
+
   if ((ev->x != data->lastx) ||
       (ev->y != data->lasty))
      paintto (win, (GdkEventMotion *) ev, user_data);
@@ -815,17 +5063,131 @@ paintend (GtkWidget *win, GdkEventButton *ev, gpointer user_data)
   if (!data->hard_grab)
     return FALSE;
 
-  if (data->cur_context->arrowsize != 0 &&
-      gromit_coord_list_get_arrow_param (data, width * 3,
-                                         &width, &direction))
+  gromit_predict_clear (data);
+
+  if (gromit_shape_tool (data->cur_context))
+    gromit_shape_commit (data, ev->x, ev->y);
+  else if (data->cur_context->arrowsize != 0 &&
+           data->cur_context->type != GROMIT_TEXT &&
+           gromit_coord_list_get_arrow_param (data, width * 3,
+                                              &width, &direction))
     gromit_draw_arrow (data, ev->x, ev->y, width, direction);
 
   gromit_coord_list_free (data);
+  data->cur_stroke = NULL;
+  gromit_highlight_reset (data);
 
   return TRUE;
 }
 
 
+/*
+ * Replaying an input trace: the recorded events go through the handlers
+ * above one per main loop iteration, either at the recorded pace or as
+ * fast as possible. Real input is ignored meanwhile.
+ */
+
+gboolean gromit_replay_next (gpointer user_data);
+
+void
+gromit_replay_schedule (GromitData *data, guint32 last_time)
+{
+  gint32 delay;
+
+  if (data->replay_fast)
+    {
+      g_idle_add (gromit_replay_next, data);
+      return;
+    }
+
+  delay = gdk_event_get_time (data->replay_next) - last_time;
+  g_timeout_add (MAX (delay, 0), gromit_replay_next, data);
+}
+
+
+void
+gromit_replay_done (GromitData *data)
+{
+  gdk_display_sync (data->display);
+  g_printerr ("Replayed %d events in %.3f s\n", data->replay_count,
+              g_timer_elapsed (data->replay_timer, NULL));
+
+  g_timer_destroy (data->replay_timer);
+  gromit_trace_free (data->replay);
+  data->replay = NULL;
+  data->replay_timer = NULL;
+
+  if (data->replay_fast)
+    gtk_main_quit ();
+}
+
+
+gboolean
+gromit_replay_next (gpointer user_data)
+{
+  GromitData *data = (GromitData *) user_data;
+  GdkEvent   *event = data->replay_next;
+
+  event->any.window = g_object_ref (data->area->window);
+  data->replay_event = event;
+
+  switch (event->type)
+    {
+      case GDK_BUTTON_PRESS:
+      case GDK_2BUTTON_PRESS:
+      case GDK_3BUTTON_PRESS:
+        paint (data->win, &event->button, data);
+        break;
+      case GDK_BUTTON_RELEASE:
+        paintend (data->win, &event->button, data);
+        break;
+      case GDK_MOTION_NOTIFY:
+        paintto (data->win, &event->motion, data);
+        break;
+      case GDK_PROXIMITY_IN:
+        proximity_in (data->win, &event->proximity, data);
+        break;
+      case GDK_PROXIMITY_OUT:
+        proximity_out (data->win, &event->proximity, data);
+        break;
+      default:
+        break;
+    }
+
+  data->replay_event = NULL;
+  data->replay_count++;
+
+  data->replay_next = gromit_trace_read_event (data->replay);
+  if (data->replay_next)
+    gromit_replay_schedule (data, gdk_event_get_time (event));
+  else
+    gromit_replay_done (data);
+
+  gdk_event_free (event);
+
+  return FALSE;
+}
+
+
+void
+gromit_replay_start (GromitData *data)
+{
+  data->replay_next = gromit_trace_read_event (data->replay);
+  if (!data->replay_next)
+    {
+      g_printerr ("%s holds no events\n", data->replay_path);
+      gromit_trace_free (data->replay);
+      data->replay = NULL;
+      return;
+    }
+
+  gromit_acquire_grab (data);
+  data->replay_count = 0;
+  data->replay_timer = g_timer_new ();
+  gromit_replay_schedule (data, gdk_event_get_time (data->replay_next));
+}
+
+
 /*
  * Functions for handling various (GTK+)-Events
  */
@@ -844,13 +5206,59 @@ event_configure (GtkWidget *widget,
 {
   GromitData *data = (GromitData *) user_data;
 
-  data->pixmap = gdk_pixmap_new (data->area->window, data->width,
-                                 data->height, -1);
-  gdk_draw_rectangle (data->pixmap, data->area->style->black_gc,
-                      1, 0, 0, data->width, data->height);
-  gdk_window_set_transient_for (data->area->window, data->win->window);
+  /* the buffers get allocated on the first stroke */
+  gdk_window_set_transient_for (data->area->window, data->win->window);
+
+  return TRUE;
+}
+
+
+/*
+ * The frozen image with the painted part of the pixmap on top. A frozen
+ * window always covers the whole screen.
+ */
+void
+gromit_frozen_expose (GromitData *data, GdkRectangle *area)
+{
+  GdkRegion *clip;
+
+  gdk_draw_drawable (data->area->window,
+                     data->area->style->fg_gc[GTK_WIDGET_STATE (data->area)],
+                     data->backdrop,
+                     area->x, area->y, area->x, area->y,
+                     area->width, area->height);
+
+  if (!data->pixmap)
+    return;
+
+  if (data->region_shape)
+    {
+      GdkRegion *added = gdk_region_rectangle (area);
+
+      clip = gdk_region_rectangle (area);
+      gdk_region_intersect (clip, data->painted_region);
+      gdk_region_intersect (added, data->shape_add);
+      gdk_region_union (clip, added);
+      gdk_region_subtract (clip, data->shape_sub);
+      gdk_gc_set_clip_region (data->frozen_gc, clip);
+
+      gdk_region_destroy (added);
+      gdk_region_destroy (clip);
+    }
+  else
+    {
+      /* the shape bitmap lags behind the raster */
+      if (data->raster)
+        gromit_raster_commit_shape (data);
+      gdk_gc_set_clip_mask (data->frozen_gc, data->shape);
+      gdk_gc_set_clip_origin (data->frozen_gc, 0, 0);
+    }
 
-  return TRUE;
+  gdk_draw_drawable (data->area->window, data->frozen_gc, data->pixmap,
+                     area->x, area->y, area->x, area->y,
+                     area->width, area->height);
+
+  gdk_gc_set_clip_mask (data->frozen_gc, NULL);
 }
 
 
@@ -861,10 +5269,20 @@ event_expose (GtkWidget *widget,
 {
   GromitData *data = (GromitData *) user_data;
 
+  if (data->frozen)
+    {
+      gromit_frozen_expose (data, &event->area);
+      return TRUE;
+    }
+
+  if (!data->pixmap)
+    return TRUE;
+
   gdk_draw_drawable (data->area->window,
                      data->area->style->fg_gc[GTK_WIDGET_STATE (data->area)],
                      data->pixmap,
-                     event->area.x, event->area.y,
+                     event->area.x + data->win_rect.x,
+                     event->area.y + data->win_rect.y,
                      event->area.x, event->area.y,
                      event->area.width, event->area.height);
   return TRUE;
@@ -883,7 +5301,16 @@ key_press_event (GtkWidget   *grab_widget,
   if (event->type == GDK_KEY_PRESS &&
       event->hardware_keycode == data->hot_keycode)
     {
-      if (event->state & GDK_SHIFT_MASK)
+      if ((event->state & GDK_SHIFT_MASK) &&
+          (event->state & GDK_CONTROL_MASK))
+        gromit_next_page (data);
+      else if ((event->state & GDK_SHIFT_MASK) &&
+               (event->state & GDK_MOD1_MASK))
+        gromit_prev_page (data);
+      else if ((event->state & GDK_CONTROL_MASK) &&
+               (event->state & GDK_MOD1_MASK))
+        gromit_toggle_freeze (data);
+      else if (event->state & GDK_SHIFT_MASK)
         gromit_clear_screen (data);
       else if (event->state & GDK_CONTROL_MASK)
         gromit_toggle_visibility (data);
@@ -894,6 +5321,10 @@ key_press_event (GtkWidget   *grab_widget,
 
       return TRUE;
     }
+
+  if (event->type == GDK_KEY_PRESS && data->text_stroke)
+    return gromit_text_key (data, event);
+
   return FALSE;
 }
 
@@ -936,8 +5367,25 @@ event_selection_get (GtkWidget          *widget,
     gromit_clear_screen (data);
   else if (selection_data->target == GA_QUIT)
     gtk_main_quit ();
+  else if (selection_data->target == GA_NEXTPAGE)
+    gromit_next_page (data);
+  else if (selection_data->target == GA_PREVPAGE)
+    gromit_prev_page (data);
+  else if (selection_data->target == GA_FREEZE)
+    gromit_toggle_freeze (data);
   else
-    uri = "NOK";
+    {
+      gchar *name = gdk_atom_name (selection_data->target);
+      gint   page;
+
+      if (name && g_str_has_prefix (name, GA_PAGE_PREFIX) &&
+          (page = atoi (name + strlen (GA_PAGE_PREFIX))) > 0)
+        gromit_select_page (data, page - 1);
+      else
+        uri = "NOK";
+
+      g_free (name);
+    }
 
   gtk_selection_data_set (selection_data,
                           selection_data->target,
@@ -1036,14 +5484,14 @@ parse_name (GScanner *scanner)
   return name;
 }
 
-void
-parse_config (GromitData *data)
+/* adds the tools defined in filename, FALSE if it can't be opened */
+gboolean
+parse_config_file (GromitData *data, gchar *filename)
 {
   GromitPaintContext *context=NULL;
   GromitPaintContext *context_template=NULL;
   GScanner *scanner;
   GTokenType token;
-  gchar *filename;
   int file;
 
   gchar *name, *copy;
@@ -1051,25 +5499,12 @@ parse_config (GromitData *data)
   GromitPaintType type;
   GdkColor *fg_color=NULL;
   guint width, arrowsize;
+  gfloat opacity;
+  gchar *font;
 
-  filename = g_strjoin (G_DIR_SEPARATOR_S,
-                        g_get_home_dir(), ".gromitrc", NULL);
   file = open (filename, O_RDONLY);
-
   if (file < 0)
-    {
-      /* try global config file */
-      g_free (filename);
-      filename = g_strdup ("/etc/gromit/gromitrc");
-      file = open (filename, O_RDONLY);
-
-      if (file < 0)
-        {
-          g_printerr ("Could not open %s: %s\n", filename, g_strerror (errno));
-          g_free (filename);
-          return;
-        }
-    }
+    return FALSE;
 
   scanner = g_scanner_new (NULL);
   scanner->input_name = filename;
@@ -1083,6 +5518,12 @@ parse_config (GromitData *data)
   g_scanner_scope_add_symbol (scanner, 0, "PEN",    (gpointer) GROMIT_PEN);
   g_scanner_scope_add_symbol (scanner, 0, "ERASER", (gpointer) GROMIT_ERASER);
   g_scanner_scope_add_symbol (scanner, 0, "RECOLOR",(gpointer) GROMIT_RECOLOR);
+  g_scanner_scope_add_symbol (scanner, 0, "HIGHLIGHTER",
+                              (gpointer) GROMIT_HIGHLIGHTER);
+  g_scanner_scope_add_symbol (scanner, 0, "TEXT",   (gpointer) GROMIT_TEXT);
+  g_scanner_scope_add_symbol (scanner, 0, "LINE",   (gpointer) GROMIT_LINE);
+  g_scanner_scope_add_symbol (scanner, 0, "RECT",   (gpointer) GROMIT_RECT);
+  g_scanner_scope_add_symbol (scanner, 0, "ELLIPSE",(gpointer) GROMIT_ELLIPSE);
 
   g_scanner_scope_add_symbol (scanner, 1, "BUTTON1", (gpointer) 1);
   g_scanner_scope_add_symbol (scanner, 1, "BUTTON2", (gpointer) 2);
@@ -1097,6 +5538,8 @@ parse_config (GromitData *data)
   g_scanner_scope_add_symbol (scanner, 2, "size",      (gpointer) 1);
   g_scanner_scope_add_symbol (scanner, 2, "color",     (gpointer) 2);
   g_scanner_scope_add_symbol (scanner, 2, "arrowsize", (gpointer) 3);
+  g_scanner_scope_add_symbol (scanner, 2, "opacity",   (gpointer) 4);
+  g_scanner_scope_add_symbol (scanner, 2, "font",      (gpointer) 5);
 
   g_scanner_set_scope (scanner, 0);
   scanner->config->scope_0_fallback = 0;
@@ -1130,12 +5573,18 @@ parse_config (GromitData *data)
           type = GROMIT_PEN;
           width = 7;
           arrowsize = 0;
+          opacity = 1.0;
+          font = NULL;
           fg_color = data->red;
 
           if (token == G_TOKEN_SYMBOL)
             {
               type = (GromitPaintType) scanner->value.v_symbol;
               token = g_scanner_get_next_token (scanner);
+              if (type == GROMIT_HIGHLIGHTER)
+                opacity = 0.4;
+              else if (type == GROMIT_TEXT)
+                width = 24;
             }
           else if (token == G_TOKEN_STRING)
             {
@@ -1147,6 +5596,8 @@ parse_config (GromitData *data)
                   type = context_template->type;
                   width = context_template->width;
                   arrowsize = context_template->arrowsize;
+                  opacity = context_template->opacity;
+                  font = context_template->font;
                   fg_color = context_template->fg_color;
                 }
               else
@@ -1247,6 +5698,40 @@ parse_config (GromitData *data)
                             }
                           arrowsize = scanner->value.v_float;
                         }
+                      else if ((gulong) scanner->value.v_symbol == 4)
+                        {
+                          token = g_scanner_get_next_token (scanner);
+                          if (token != G_TOKEN_EQUAL_SIGN)
+                            {
+                              g_printerr ("Missing \"=\"... aborting\n");
+                              exit (1);
+                            }
+                          token = g_scanner_get_next_token (scanner);
+                          if (token != G_TOKEN_FLOAT)
+                            {
+                              g_printerr ("Missing Opacity (float)... "
+                                          "aborting\n");
+                              exit (1);
+                            }
+                          opacity = CLAMP (scanner->value.v_float, 0, 1);
+                        }
+                      else if ((gulong) scanner->value.v_symbol == 5)
+                        {
+                          token = g_scanner_get_next_token (scanner);
+                          if (token != G_TOKEN_EQUAL_SIGN)
+                            {
+                              g_printerr ("Missing \"=\"... aborting\n");
+                              exit (1);
+                            }
+                          token = g_scanner_get_next_token (scanner);
+                          if (token != G_TOKEN_STRING)
+                            {
+                              g_printerr ("Missing Font (string)... "
+                                          "aborting\n");
+                              exit (1);
+                            }
+                          font = g_strdup (scanner->value.v_string);
+                        }
                       else
                         {
                           g_printerr ("Unknown tool type?????\n");
@@ -1272,7 +5757,9 @@ parse_config (GromitData *data)
               exit (1);
             }
 
-          context = gromit_paint_context_new (data, type, fg_color, width, arrowsize);
+          context = gromit_paint_context_new (data, type, fg_color, width,
+                                              arrowsize, opacity);
+          context->font = font;
           g_hash_table_insert (data->tool_config, name, context);
         }
       else
@@ -1285,6 +5772,29 @@ parse_config (GromitData *data)
     }
   g_scanner_destroy (scanner);
   close (file);
+
+  return TRUE;
+}
+
+
+void
+parse_config (GromitData *data)
+{
+  gchar *filename;
+
+  filename = g_strjoin (G_DIR_SEPARATOR_S,
+                        g_get_home_dir(), ".gromitrc", NULL);
+
+  if (!parse_config_file (data, filename))
+    {
+      /* try global config file */
+      g_free (filename);
+      filename = g_strdup ("/etc/gromit/gromitrc");
+
+      if (!parse_config_file (data, filename))
+        g_printerr ("Could not open %s: %s\n", filename, g_strerror (errno));
+    }
+
   g_free (filename);
 }
 
@@ -1334,6 +5844,14 @@ setup_client_app (GromitData *data)
   data->width = gdk_screen_get_width (data->screen);
   data->height = gdk_screen_get_height (data->screen);
   data->hard_grab = 0;
+  data->win_rect.x = 0;
+  data->win_rect.y = 0;
+  data->win_rect.width = data->width;
+  data->win_rect.height = data->height;
+  data->painted_box.x = 0;
+  data->painted_box.y = 0;
+  data->painted_box.width = 0;
+  data->painted_box.height = 0;
 
   data->win = gtk_window_new (GTK_WINDOW_POPUP);
   gtk_widget_set_usize (GTK_WIDGET (data->win), data->width, data->height);
@@ -1358,6 +5876,50 @@ setup_main_app (GromitData *data, gboolean activate)
 {
   GdkPixmap *cursor_src, *cursor_mask;
   gboolean   have_key = FALSE;
+  guint      i;
+  gint       event_base, error_base;
+
+  data->pixmap = NULL;
+  data->shape = NULL;
+  data->raster = NULL;
+  data->painted_region = NULL;
+  data->grid_region = NULL;
+  data->grid_pending = NULL;
+  data->grid_mask = NULL;
+  data->grid_dirty.width = data->grid_dirty.height = 0;
+  data->grid_erased = NULL;
+  data->shape_erased.width = data->shape_erased.height = 0;
+  data->strokes = NULL;
+  data->cur_stroke = NULL;
+  data->replaying = FALSE;
+  data->redraw = NULL;
+  data->idle_release_id = 0;
+  data->worker = NULL;
+  data->predicted = FALSE;
+  data->predict_time = 0;
+  data->velocity_x = 0;
+  data->velocity_y = 0;
+  data->predict_under = NULL;
+  data->predict_shape_under = NULL;
+  data->shape_stale = FALSE;
+  data->picture = None;
+  data->highlight_region = NULL;
+  data->text_stroke = NULL;
+  data->preview = NULL;
+  data->preview_gc = NULL;
+  data->previewing = FALSE;
+  data->fix_x = data->fix_y = 0;
+  data->pointers = g_hash_table_new (NULL, NULL);
+  data->pointer = NULL;
+  data->publisher = NULL;
+  data->mirror = NULL;
+  data->published_stroke = NULL;
+  data->mirror_tools = g_hash_table_new (g_str_hash, g_str_equal);
+  data->frozen = FALSE;
+  data->freeze_id = 0;
+  data->shape_id = 0;
+  data->backdrop = NULL;
+  data->frozen_gc = NULL;
 
   /* COLORMAP */
   data->cm = gdk_screen_get_default_colormap (data->screen);
@@ -1400,16 +5962,15 @@ setup_main_app (GromitData *data, gboolean activate)
 
   gdk_window_set_cursor (data->win->window, data->paint_cursor);
 
-  /* SHAPE PIXMAP */
-  data->shape = gdk_pixmap_new (NULL, data->width, data->height, 1);
-  data->shape_gc = gdk_gc_new (data->shape);
+  /* SHAPE PIXMAP, the real one gets allocated with the page buffers */
+  data->empty_shape = gdk_pixmap_new (NULL, 1, 1, 1);
+  data->shape_gc = gdk_gc_new (data->empty_shape);
   data->shape_gcv = g_malloc (sizeof (GdkGCValues));
   gdk_gc_get_values (data->shape_gc, data->shape_gcv);
   data->transparent = gdk_color_copy (&(data->shape_gcv->foreground));
   data->opaque = gdk_color_copy (&(data->shape_gcv->background));
   gdk_gc_set_foreground (data->shape_gc, data->transparent);
-  gdk_draw_rectangle (data->shape, data->shape_gc,
-                      1, 0, 0, data->width, data->height);
+  gdk_draw_point (data->empty_shape, data->shape_gc, 0, 0);
 
   /* DRAWING AREA */
   data->area = gtk_drawing_area_new ();
@@ -1435,23 +5996,133 @@ setup_main_app (GromitData *data, gboolean activate)
 
   gtk_container_add (GTK_CONTAINER (data->win), data->area);
 
-  gtk_widget_shape_combine_mask (data->win, data->shape, 0,0);
+  gtk_widget_shape_combine_mask (data->win, data->empty_shape, 0,0);
 
   gtk_widget_show_all (data->area);
 
   gtk_widget_realize (data->win);
 
+  /* the text cursor, a thin window of the text color */
+  data->caret = gtk_window_new (GTK_WINDOW_POPUP);
+  gtk_widget_set_size_request (data->caret, 2, 2);
+  gtk_widget_realize (data->caret);
+
   data->painted = 0;
   gromit_hide_window (data);
 
+  data->pages = g_new0 (GromitPage, data->n_pages);
+  data->cur_page = 0;
+
+  if (data->region_shape && !gromit_region_shape_setup (data))
+    {
+      g_printerr ("Falling back to bitmap based shaping\n");
+      data->region_shape = FALSE;
+    }
+
+  if (data->client_render && !gromit_client_render_setup (data))
+    {
+      g_printerr ("Falling back to server side rendering\n");
+      data->client_render = FALSE;
+    }
+
+  /* the raster uploads would overwrite the screen copied into the blocks */
+  if (data->shape_grid && data->client_render)
+    {
+      g_printerr ("The shape grid needs server side rendering, using the "
+                  "exact shape\n");
+      data->shape_grid = 0;
+    }
+
+  if (data->shape_grid && !data->region_shape)
+    {
+      data->grid_mask = gdk_pixmap_new (NULL, data->width, data->height, 1);
+      data->grid_erased = gdk_region_new ();
+    }
+
+  data->xrender = XRenderQueryExtension (GDK_DISPLAY_XDISPLAY (data->display),
+                                         &event_base, &error_base);
+  if (!data->xrender)
+    g_printerr ("No XRender, highlighters will be opaque\n");
+
+  /* copies the screen including the windows on it */
+  data->backdrop_gc = gdk_gc_new (data->root);
+  gdk_gc_set_subwindow (data->backdrop_gc, GDK_INCLUDE_INFERIORS);
+
+  if (data->geometry_thread)
+    {
+      if (!data->client_render)
+        g_printerr ("The geometry thread needs client side rendering\n");
+      else
+        data->worker = gromit_worker_new (gromit_worker_notify, data);
+    }
+
+  /* RandR changes of the screen size */
+  g_signal_connect (data->screen, "size-changed",
+                    G_CALLBACK (gromit_screen_changed), data);
+
+  data->tile_pool = NULL;
+  if (data->client_render)
+    {
+      guint threads = data->render_threads ? data->render_threads
+                                           : g_get_num_processors ();
+
+      if (threads > 1)
+        data->tile_pool = gromit_tile_pool_new (threads,
+                                                gromit_redraw_notify, data);
+    }
+  else if (data->render_threads > 1)
+    g_printerr ("The render threads need client side rendering\n");
+
+  data->session = NULL;
+  data->session_dirty.width = data->session_dirty.height = 0;
+  if (data->session_path && !data->client_render)
+    g_printerr ("The session file needs client side rendering\n");
+  else if (data->session_path)
+    data->session = gromit_session_setup (data, data->session_path, -1);
+
+  /* pick up where the last Gromit on this session left off */
+  if (data->session)
+    {
+      for (i = 0; i < data->n_pages; i++)
+        data->pages[i].painted = gromit_session_stored (data->session, i);
+      data->cur_page = gromit_session_cur_page (data->session);
+      gromit_page_load (data, &data->pages[data->cur_page]);
+    }
+
+  if (data->publish_path)
+    data->publisher = gromit_stream_publish (data->publish_path,
+                                             gromit_publish_subscribe, data);
+  if (data->mirror_path)
+    data->mirror = gromit_stream_mirror (data->mirror_path,
+                                         &gromit_mirror_handler, data);
+
+  data->trace = NULL;
+  data->replay = NULL;
+  data->replay_event = NULL;
+  data->replay_next = NULL;
+  data->replay_timer = NULL;
+  if (data->trace_path)
+    data->trace = gromit_trace_record (data->trace_path);
+  if (data->replay_path)
+    data->replay = gromit_trace_replay (data->replay_path, data->display);
+
+  /* replays should draw the same thing every time */
+  if (data->replay_path)
+    data->adaptive = FALSE;
+  data->quality = 0;
+  data->latency = 0;
+  data->latency_time = 0;
+  data->quality_time = 0;
+  data->reshape_ticks = 0;
+
   /* data->timeout_id = gtk_timeout_add (20, reshape, data); */
   data->coordlist = NULL;
   data->modified = 0;
 
   data->default_pen = gromit_paint_context_new (data, GROMIT_PEN,
-                                                data->red, 7, 0);
+                                                data->red, 7, 0, 1.0);
   data->default_eraser = gromit_paint_context_new (data, GROMIT_ERASER,
-                                                   data->red, 75, 0);
+                                                   data->red, 75, 0, 1.0);
 
   data->cur_context = data->default_pen;
 
@@ -1472,6 +6143,18 @@ setup_main_app (GromitData *data, gboolean activate)
   gtk_selection_add_target (data->win, GA_CONTROL, GA_TOGGLE, 4);
   gtk_selection_add_target (data->win, GA_CONTROL, GA_VISIBILITY, 5);
   gtk_selection_add_target (data->win, GA_CONTROL, GA_CLEAR, 6);
+  gtk_selection_add_target (data->win, GA_CONTROL, GA_NEXTPAGE, 7);
+  gtk_selection_add_target (data->win, GA_CONTROL, GA_PREVPAGE, 8);
+  gtk_selection_add_target (data->win, GA_CONTROL, GA_FREEZE, 9);
+
+  for (i = 1; i <= data->n_pages; i++)
+    {
+      gchar *name = g_strdup_printf ("%s%d", GA_PAGE_PREFIX, i);
+
+      gtk_selection_add_target (data->win, GA_CONTROL,
+                                gdk_atom_intern (name, FALSE), 9 + i);
+      g_free (name);
+    }
 
   setup_input_devices (data);
 
@@ -1535,8 +6218,14 @@ setup_main_app (GromitData *data, gboolean activate)
   gdk_event_handler_set ((GdkEventFunc) gromit_main_do_event, data, NULL);
   gtk_key_snooper_install (key_press_event, data);
 
+  if (data->painted)
+    gromit_show_window (data);
+
   if (activate)
     gromit_acquire_grab (data);
+
+  if (data->replay)
+    gromit_replay_start (data);
 }
 
 
@@ -1556,6 +6245,21 @@ app_parse_args (int argc, char **argv, GromitData *data)
 
    data->hot_keyval = "Pause";
    data->hot_keycode = 0;
+   data->client_render = FALSE;
+   data->region_shape = FALSE;
+   data->shape_grid = 0;
+   data->n_pages = GROMIT_DEFAULT_PAGES;
+   data->idle_release = GROMIT_DEFAULT_IDLE_RELEASE;
+   data->geometry_thread = FALSE;
+   data->render_threads = 0;
+   data->adaptive = TRUE;
+   data->predict = 0;
+   data->publish_path = NULL;
+   data->mirror_path = NULL;
+   data->trace_path = NULL;
+   data->replay_path = NULL;
+   data->replay_fast = FALSE;
+   data->session_path = NULL;
 
    for (i=1; i < argc ; i++)
      {
@@ -1585,6 +6289,157 @@ app_parse_args (int argc, char **argv, GromitData *data)
                wrong_arg = TRUE;
              }
          }
+       else if (strcmp (arg, "--client-render") == 0)
+         {
+           data->client_render = TRUE;
+         }
+       else if (strcmp (arg, "--region-shape") == 0)
+         {
+           data->region_shape = TRUE;
+         }
+       else if (strcmp (arg, "--shape-grid") == 0)
+         {
+           if (i+1 < argc && atoi (argv[i+1]) > 0)
+             {
+               /* a grid of 1 is the exact shape */
+               data->shape_grid = atoi (argv[i+1]) > 1 ? atoi (argv[i+1]) : 0;
+               i++;
+             }
+           else
+             {
+               g_printerr ("--shape-grid requires a number > 0 as argument\n");
+               wrong_arg = TRUE;
+             }
+         }
+       else if (strcmp (arg, "--geometry-thread") == 0)
+         {
+           data->geometry_thread = TRUE;
+         }
+       else if (strcmp (arg, "--render-threads") == 0)
+         {
+           if (i+1 < argc && atoi (argv[i+1]) > 0)
+             {
+               data->render_threads = atoi (argv[i+1]);
+               i++;
+             }
+           else
+             {
+               g_printerr ("--render-threads requires a number > 0 as argument\n");
+               wrong_arg = TRUE;
+             }
+         }
+       else if (strcmp (arg, "--fixed-quality") == 0)
+         {
+           data->adaptive = FALSE;
+         }
+       else if (strcmp (arg, "--pages") == 0)
+         {
+           if (i+1 < argc && atoi (argv[i+1]) > 0)
+             {
+               data->n_pages = atoi (argv[i+1]);
+               i++;
+             }
+           else
+             {
+               g_printerr ("--pages requires a number > 0 as argument\n");
+               wrong_arg = TRUE;
+             }
+         }
+       else if (strcmp (arg, "--predict") == 0)
+         {
+           if (i+1 < argc && atoi (argv[i+1]) >= 0)
+             {
+               data->predict = atoi (argv[i+1]);
+               i++;
+             }
+           else
+             {
+               g_printerr ("--predict requires a number of milliseconds as argument\n");
+               wrong_arg = TRUE;
+             }
+         }
+       else if (strcmp (arg, "--idle-release") == 0)
+         {
+           if (i+1 < argc && atoi (argv[i+1]) >= 0)
+             {
+               data->idle_release = atoi (argv[i+1]);
+               i++;
+             }
+           else
+             {
+               g_printerr ("--idle-release requires a number of seconds as argument\n");
+               wrong_arg = TRUE;
+             }
+         }
+       else if (strcmp (arg, "--publish") == 0)
+         {
+           if (i+1 < argc)
+             {
+               data->publish_path = argv[i+1];
+               i++;
+             }
+           else
+             {
+               g_printerr ("--publish requires a socket path as argument\n");
+               wrong_arg = TRUE;
+             }
+         }
+       else if (strcmp (arg, "--mirror") == 0)
+         {
+           if (i+1 < argc)
+             {
+               data->mirror_path = argv[i+1];
+               i++;
+             }
+           else
+             {
+               g_printerr ("--mirror requires a socket path as argument\n");
+               wrong_arg = TRUE;
+             }
+         }
+       else if (strcmp (arg, "--record-trace") == 0)
+         {
+           if (i+1 < argc)
+             {
+               data->trace_path = argv[i+1];
+               i++;
+             }
+           else
+             {
+               g_printerr ("--record-trace requires a file name as argument\n");
+               wrong_arg = TRUE;
+             }
+         }
+       else if (strcmp (arg, "--replay-trace") == 0)
+         {
+           if (i+1 < argc)
+             {
+               data->replay_path = argv[i+1];
+               i++;
+             }
+           else
+             {
+               g_printerr ("--replay-trace requires a file name as argument\n");
+               wrong_arg = TRUE;
+             }
+         }
+       else if (strcmp (arg, "--replay-fast") == 0)
+         {
+           data->replay_fast = TRUE;
+         }
+       else if (strcmp (arg, "--session") == 0)
+         {
+           if (i+1 < argc)
+             {
+               data->session_path = argv[i+1];
+               i++;
+             }
+           else
+             {
+               g_printerr ("--session requires a file name as argument\n");
+               wrong_arg = TRUE;
+             }
+         }
        else if (strcmp (arg, "-K") == 0 ||
                 strcmp (arg, "--keycode") == 0)
          {
@@ -1662,6 +6517,38 @@ main_client (int argc, char **argv, GromitData *data)
          {
            action = GA_CLEAR;
          }
+       else if (strcmp (arg, "-n") == 0 ||
+                strcmp (arg, "--next-page") == 0)
+         {
+           action = GA_NEXTPAGE;
+         }
+       else if (strcmp (arg, "-p") == 0 ||
+                strcmp (arg, "--prev-page") == 0)
+         {
+           action = GA_PREVPAGE;
+         }
+       else if (strcmp (arg, "-f") == 0 ||
+                strcmp (arg, "--freeze") == 0)
+         {
+           action = GA_FREEZE;
+         }
+       else if (strcmp (arg, "-P") == 0 ||
+                strcmp (arg, "--page") == 0)
+         {
+           if (i+1 < argc && atoi (argv[i+1]) > 0)
+             {
+               gchar *name = g_strdup_printf ("%s%d", GA_PAGE_PREFIX,
+                                              atoi (argv[i+1]));
+               action = gdk_atom_intern (name, FALSE);
+               g_free (name);
+               i++;
+             }
+           else
+             {
+               g_printerr ("--page requires a page number > 0 as argument\n");
+               wrong_arg = TRUE;
+             }
+         }
        else
          {
            g_printerr ("Unknown Option to control a running Gromit process: \"%s\"\n", arg);
@@ -1689,6 +6576,10 @@ main (int argc, char **argv)
 {
   GromitData *data;
 
+  /* works without a display, so it has to come before gtk_init () */
+  if (argc > 1 && strcmp (argv[1], "--render") == 0)
+    return gromit_render_main (argc - 2, argv + 2);
+
   gtk_init (&argc, &argv);
   data = g_malloc (sizeof (GromitData));
 
@@ -1710,6 +6601,19 @@ main (int argc, char **argv)
   /* Main application */
   setup_main_app (data, app_parse_args (argc, argv, data));
   gtk_main ();
+  if (data->tile_pool)
+    gromit_tile_pool_free (data->tile_pool);
+  if (data->publisher)
+    gromit_stream_free (data->publisher);
+  if (data->mirror)
+    gromit_stream_free (data->mirror);
+  if (data->trace)
+    gromit_trace_free (data->trace);
+  if (data->session)
+    {
+      gromit_persist_flush (data);
+      gromit_session_free (data->session);
+    }
   gdk_display_pointer_ungrab (data->display, GDK_CURRENT_TIME);
   gdk_cursor_unref (data->paint_cursor);
   gdk_cursor_unref (data->erase_cursor);
@@ -0,0 +1,235 @@
+/* Gromit -- a program for painting on the screen
+ * Copyright (C) 2000 Simon Budig <Simon.Budig@unix-ag.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+
+
+/*
+ * Checks the row kernels of gromit_raster_pack_mask () against each
+ * other: the SSE2 and AVX2 versions (where the CPU has them) must give
+ * the same bits and the same changed rectangle as the plain C one, and
+ * that one the same as packing pixel by pixel. The rectangles start at
+ * unaligned x and run into the right edge of rasters that are not a
+ * multiple of 8 wide. "make check" builds and runs it, no display
+ * needed.
+ */
+
+#include <stdlib.h>
+
+/* the kernels are static */
+#include "raster.c"
+
+#define CHECK_ROUNDS 20000
+#define CHECK_SEED   0x67726f6d
+
+typedef struct
+{
+  const gchar       *name;
+  GromitPackRowFunc  row;
+} CheckKernel;
+
+
+/* mostly runs of empty and full coverage, with a few odd values */
+static void
+check_fill (GromitRaster *raster)
+{
+  guchar value = 0;
+  gint   i;
+
+  for (i = 0; i < raster->width * raster->height; i++)
+    {
+      if (g_random_int_range (0, 16) == 0)
+        value = g_random_boolean () ? 0 : 255;
+      raster->coverage[i] = g_random_int_range (0, 32) ? value
+                                                       : g_random_int ();
+    }
+}
+
+
+/* what pack_mask must produce, one pixel at a time. The bits beyond
+ * the right edge in the last byte of a row count as not painted.
+ */
+static void
+check_expect (GromitRaster *raster, const GdkRectangle *rect,
+              const guchar *before, guchar *bits, gint bytes_per_line,
+              GdkRectangle *changed)
+{
+  gint x, y, x0, x1, byte;
+  gint xmin = G_MAXINT, xmax = -1, ymin = -1, ymax = -1;
+
+  memcpy (bits, before, bytes_per_line * raster->height);
+
+  x0 = MAX (rect->x, 0) & ~7;
+  x1 = MIN ((rect->x + rect->width + 7) & ~7, raster->width);
+
+  for (y = MAX (rect->y, 0);
+       y < MIN (rect->y + rect->height, raster->height); y++)
+    for (x = x0; x < ((x1 + 7) & ~7); x++)
+      {
+        byte = y * bytes_per_line + x / 8;
+        if (x < raster->width &&
+            raster->coverage[y * raster->width + x] >= 128)
+          bits[byte] |= 1 << (x % 8);
+        else
+          bits[byte] &= ~(1 << (x % 8));
+      }
+
+  for (y = 0; y < raster->height; y++)
+    for (x = 0; x < bytes_per_line; x++)
+      if (bits[y * bytes_per_line + x] != before[y * bytes_per_line + x])
+        {
+          xmin = MIN (xmin, x);
+          xmax = MAX (xmax, x);
+          if (ymin < 0)
+            ymin = y;
+          ymax = y;
+        }
+
+  if (xmax < 0)
+    {
+      changed->x = changed->y = changed->width = changed->height = 0;
+      return;
+    }
+
+  changed->x = 8 * xmin;
+  changed->y = ymin;
+  changed->width = MIN (8 * (xmax + 1), raster->width) - changed->x;
+  changed->height = ymax - ymin + 1;
+}
+
+
+static gboolean
+check_same (const gchar *name, gint round, const guchar *bits,
+            const GdkRectangle *changed, const guchar *want,
+            const GdkRectangle *want_changed, gint size)
+{
+  if (memcmp (bits, want, size) != 0)
+    {
+      g_printerr ("%s: round %d: the bits differ\n", name, round);
+      return FALSE;
+    }
+
+  if (changed->x != want_changed->x || changed->y != want_changed->y ||
+      changed->width != want_changed->width ||
+      changed->height != want_changed->height)
+    {
+      g_printerr ("%s: round %d: changed %dx%d+%d+%d instead of "
+                  "%dx%d+%d+%d\n", name, round,
+                  changed->width, changed->height, changed->x, changed->y,
+                  want_changed->width, want_changed->height,
+                  want_changed->x, want_changed->y);
+      return FALSE;
+    }
+
+  return TRUE;
+}
+
+
+int
+main (int argc, char **argv)
+{
+  CheckKernel   kernels[3];
+  GromitRaster *raster;
+  GdkRectangle  rect, changed, want_changed;
+  guchar       *before, *bits, *want;
+  gint          n_kernels = 0, width, height, bytes_per_line, size;
+  gint          round, i, k, failed = 0;
+
+  kernels[n_kernels].name = "C";
+  kernels[n_kernels++].row = gromit_pack_row_c;
+
+#if defined (__GNUC__) && (defined (__x86_64__) || defined (__i386__))
+  __builtin_cpu_init ();
+  if (__builtin_cpu_supports ("sse2"))
+    {
+      kernels[n_kernels].name = "SSE2";
+      kernels[n_kernels++].row = gromit_pack_row_sse2;
+    }
+  if (__builtin_cpu_supports ("avx2"))
+    {
+      kernels[n_kernels].name = "AVX2";
+      kernels[n_kernels++].row = gromit_pack_row_avx2;
+    }
+#endif
+
+  g_random_set_seed (CHECK_SEED);
+
+  for (round = 0; round < CHECK_ROUNDS && !failed; round++)
+    {
+      width = g_random_int_range (1, 200);
+      height = g_random_int_range (1, 8);
+      bytes_per_line = (width + 7) / 8 + g_random_int_range (0, 3);
+      size = bytes_per_line * height;
+
+      raster = gromit_raster_new (width, height, NULL, 0);
+      check_fill (raster);
+
+      /* from anywhere, up to beyond the edges */
+      rect.x = g_random_int_range (-8, width);
+      rect.y = g_random_int_range (-2, height);
+      rect.width = g_random_int_range (1, width + 16);
+      rect.height = g_random_int_range (1, height + 4);
+
+      /* what was packed before, with some of it out of date */
+      before = g_malloc (size);
+      for (i = 0; i < size; i++)
+        before[i] = g_random_int ();
+      bits = g_malloc (size);
+      if (g_random_boolean ())
+        {
+          GdkRectangle all = { 0, 0, width, height };
+
+          check_expect (raster, &all, before, bits, bytes_per_line,
+                        &changed);
+          memcpy (before, bits, size);
+          for (i = g_random_int_range (0, 3); i > 0; i--)
+            before[g_random_int_range (0, size)] ^=
+              1 << g_random_int_range (0, 8);
+        }
+
+      want = g_malloc (size);
+      check_expect (raster, &rect, before, want, bytes_per_line,
+                    &want_changed);
+      for (k = 0; k < n_kernels && !failed; k++)
+        {
+          memcpy (bits, before, size);
+          gromit_pack_row = kernels[k].row;
+          gromit_raster_pack_mask (raster, &rect, bits, bytes_per_line,
+                                   &changed);
+          if (!check_same (kernels[k].name, round, bits, &changed,
+                           want, &want_changed, size))
+            {
+              g_printerr ("  raster %dx%d, %d bytes per line, "
+                          "rect %dx%d+%d+%d\n", width, height,
+                          bytes_per_line, rect.width, rect.height,
+                          rect.x, rect.y);
+              failed = 1;
+            }
+        }
+
+      g_free (bits);
+      g_free (want);
+      g_free (before);
+      gromit_raster_free (raster);
+    }
+
+  if (!failed)
+    for (k = 0; k < n_kernels; k++)
+      g_print ("%-6s ok\n", kernels[k].name);
+
+  return failed;
+}
@@ -0,0 +1,98 @@
+/* Gromit -- a program for painting on the screen
+ * Copyright (C) 2000 Simon Budig <Simon.Budig@unix-ag.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include <string.h>
+
+#include "queue.h"
+
+
+/* n_items gets rounded up to a power of two */
+GromitQueue *
+gromit_queue_new (guint n_items, gsize item_size)
+{
+  GromitQueue *queue;
+  guint        size = 1;
+
+  while (size < n_items)
+    size <<= 1;
+
+  queue = g_malloc (sizeof (GromitQueue));
+
+  queue->items = g_malloc (size * item_size);
+  queue->item_size = item_size;
+  queue->mask = size - 1;
+  queue->head = 0;
+  queue->tail = 0;
+
+  return queue;
+}
+
+
+void
+gromit_queue_free (GromitQueue *queue)
+{
+  g_free (queue->items);
+  g_free (queue);
+}
+
+
+/*
+ * The counters run freely and wrap around, only their difference is
+ * meaningful. g_atomic_int_add() is a full barrier, so the item is
+ * completely written before the other side can see the new counter.
+ */
+
+gboolean
+gromit_queue_push (GromitQueue *queue, gconstpointer item)
+{
+  guint head = g_atomic_int_get (&queue->head);
+  guint tail = g_atomic_int_get (&queue->tail);
+
+  if (head - tail > queue->mask)
+    return FALSE;
+
+  memcpy (queue->items + (head & queue->mask) * queue->item_size,
+          item, queue->item_size);
+  g_atomic_int_add (&queue->head, 1);
+
+  return TRUE;
+}
+
+
+gboolean
+gromit_queue_pop (GromitQueue *queue, gpointer item)
+{
+  guint head = g_atomic_int_get (&queue->head);
+  guint tail = g_atomic_int_get (&queue->tail);
+
+  if (head == tail)
+    return FALSE;
+
+  memcpy (item, queue->items + (tail & queue->mask) * queue->item_size,
+          queue->item_size);
+  g_atomic_int_add (&queue->tail, 1);
+
+  return TRUE;
+}
+
+
+gboolean
+gromit_queue_empty (GromitQueue *queue)
+{
+  return g_atomic_int_get (&queue->head) == g_atomic_int_get (&queue->tail);
+}
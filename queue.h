@@ -0,0 +1,47 @@
+/* Gromit -- a program for painting on the screen
+ * Copyright (C) 2000 Simon Budig <Simon.Budig@unix-ag.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __GROMIT_QUEUE_H__
+#define __GROMIT_QUEUE_H__
+
+#include <glib.h>
+
+/*
+ * A bounded queue for exactly one producer and one consumer thread.
+ * It needs no locks: "head" is only written by the producer, "tail"
+ * only by the consumer.
+ */
+
+typedef struct
+{
+  guchar        *items;
+  gsize          item_size;
+  guint          mask;
+  volatile gint  head;
+  volatile gint  tail;
+} GromitQueue;
+
+
+GromitQueue *gromit_queue_new   (guint n_items, gsize item_size);
+void         gromit_queue_free  (GromitQueue *queue);
+
+gboolean     gromit_queue_push  (GromitQueue *queue, gconstpointer item);
+gboolean     gromit_queue_pop   (GromitQueue *queue, gpointer item);
+gboolean     gromit_queue_empty (GromitQueue *queue);
+
+#endif /* __GROMIT_QUEUE_H__ */
@@ -0,0 +1,861 @@
+/* Gromit -- a program for painting on the screen
+ * Copyright (C) 2000 Simon Budig <Simon.Budig@unix-ag.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include <string.h>
+#include <math.h>
+#include <stdlib.h>
+
+#include "raster.h"
+
+
+GromitRaster *
+gromit_raster_new (gint width, gint height, guint32 *pixels, gint stride)
+{
+  GromitRaster *raster;
+
+  raster = g_malloc (sizeof (GromitRaster));
+
+  raster->width = width;
+  raster->height = height;
+
+  if (pixels)
+    {
+      raster->pixels = pixels;
+      raster->stride = stride;
+      raster->own_pixels = FALSE;
+    }
+  else
+    {
+      raster->pixels = g_malloc (width * height * sizeof (guint32));
+      raster->stride = width;
+      raster->own_pixels = TRUE;
+    }
+
+  raster->coverage = g_malloc0 (width * height);
+
+  raster->clip.x = 0;
+  raster->clip.y = 0;
+  raster->clip.width = width;
+  raster->clip.height = height;
+
+  return raster;
+}
+
+
+void
+gromit_raster_free (GromitRaster *raster)
+{
+  if (raster->own_pixels)
+    g_free (raster->pixels);
+  g_free (raster->coverage);
+  g_free (raster);
+}
+
+
+/* view is only valid as long as raster, it must not be freed */
+void
+gromit_raster_view (GromitRaster *view, const GromitRaster *raster,
+                    const GdkRectangle *clip)
+{
+  *view = *raster;
+  view->own_pixels = FALSE;
+
+  if (!gdk_rectangle_intersect (clip, &raster->clip, &view->clip))
+    view->clip.width = view->clip.height = 0;
+}
+
+
+/*
+ * Makes the raster smaller without moving the pixels: they keep their
+ * stride, only the coverage gets packed to the new width.
+ */
+
+void
+gromit_raster_shrink (GromitRaster *raster, gint width, gint height)
+{
+  gint y;
+
+  g_return_if_fail (width <= raster->width && height <= raster->height);
+
+  if (width < raster->width)
+    for (y = 1; y < height; y++)
+      memmove (raster->coverage + y * width,
+               raster->coverage + y * raster->width, width);
+
+  raster->width = width;
+  raster->height = height;
+  raster->clip.x = 0;
+  raster->clip.y = 0;
+  raster->clip.width = width;
+  raster->clip.height = height;
+}
+
+
+/* copies what dest and src have in common, the rest of dest is left alone */
+void
+gromit_raster_copy (GromitRaster *dest, const GromitRaster *src)
+{
+  gint width = MIN (dest->width, src->width);
+  gint height = MIN (dest->height, src->height);
+  gint y;
+
+  for (y = 0; y < height; y++)
+    {
+      memcpy (dest->pixels + y * dest->stride,
+              src->pixels + y * src->stride, width * sizeof (guint32));
+      memcpy (dest->coverage + y * dest->width,
+              src->coverage + y * src->width, width);
+    }
+}
+
+
+void
+gromit_raster_clear (GromitRaster *raster, guint32 pixel)
+{
+  gint x, y;
+
+  for (y = 0; y < raster->height; y++)
+    {
+      guint32 *row = raster->pixels + y * raster->stride;
+
+      for (x = 0; x < raster->width; x++)
+        row[x] = pixel;
+    }
+
+  memset (raster->coverage, 0, raster->width * raster->height);
+}
+
+
+void
+gromit_rect_union (GdkRectangle *dest, const GdkRectangle *src)
+{
+  gint x2, y2;
+
+  if (src->width <= 0 || src->height <= 0)
+    return;
+
+  if (dest->width <= 0 || dest->height <= 0)
+    {
+      *dest = *src;
+      return;
+    }
+
+  x2 = MAX (dest->x + dest->width, src->x + src->width);
+  y2 = MAX (dest->y + dest->height, src->y + src->height);
+  dest->x = MIN (dest->x, src->x);
+  dest->y = MIN (dest->y, src->y);
+  dest->width = x2 - dest->x;
+  dest->height = y2 - dest->y;
+}
+
+
+/*
+ * The smallest rectangle holding every pixel that counts as painted for
+ * the shape (coverage >= 128), width 0 if there is none.
+ */
+
+void
+gromit_raster_bounds (GromitRaster *raster, GdkRectangle *bounds)
+{
+  gint y, x1 = raster->width, x2 = -1, y1 = -1, y2 = -1;
+
+  for (y = 0; y < raster->height; y++)
+    {
+      const guchar *row = raster->coverage + y * raster->width;
+      gint first = 0, last = raster->width - 1;
+
+      while (first <= last && row[first] < 128)
+        first++;
+      if (first > last)
+        continue;
+
+      /* only the part outside of what is known so far needs a look */
+      while (last > x2 && row[last] < 128)
+        last--;
+
+      x1 = MIN (x1, first);
+      x2 = MAX (x2, last);
+      if (y1 < 0)
+        y1 = y;
+      y2 = y;
+    }
+
+  if (y1 < 0)
+    {
+      bounds->x = bounds->y = bounds->width = bounds->height = 0;
+      return;
+    }
+
+  bounds->x = x1;
+  bounds->y = y1;
+  bounds->width = x2 - x1 + 1;
+  bounds->height = y2 - y1 + 1;
+}
+
+
+/* hands the painted spans (coverage >= 128) of the raster to func */
+void
+gromit_raster_coverage_spans (GromitRaster *raster, GromitSpanFunc func,
+                              gpointer user_data)
+{
+  gint x, x0, y;
+
+  for (y = 0; y < raster->height; y++)
+    {
+      const guchar *row = raster->coverage + y * raster->width;
+
+      for (x = 0; x < raster->width; x++)
+        {
+          if (row[x] < 128)
+            continue;
+
+          for (x0 = x; x + 1 < raster->width && row[x + 1] >= 128; x++)
+            ;
+          func (y, x0, x, user_data);
+        }
+    }
+}
+
+
+/* a GromitSpanFunc that collects the spans in a GdkRegion */
+void
+gromit_region_span (gint y, gint x0, gint x1, gpointer user_data)
+{
+  GdkRegion    *delta = user_data;
+  GdkRectangle  rect;
+
+  rect.x = x0;
+  rect.y = y;
+  rect.width = x1 - x0 + 1;
+  rect.height = 1;
+
+  gdk_region_union_with_rect (delta, &rect);
+}
+
+
+static inline void
+gromit_raster_span (GromitRaster *raster, gint y, gint x0, gint x1,
+                    guint32 pixel, GromitRasterOp op)
+{
+  guint32 *row;
+  gint x;
+
+  if (x0 < raster->clip.x)
+    x0 = raster->clip.x;
+  if (x1 >= raster->clip.x + raster->clip.width)
+    x1 = raster->clip.x + raster->clip.width - 1;
+  if (x0 > x1)
+    return;
+
+  if (op != GROMIT_RASTER_ERASE)
+    {
+      row = raster->pixels + y * raster->stride;
+      for (x = x0; x <= x1; x++)
+        row[x] = pixel;
+    }
+
+  if (op == GROMIT_RASTER_PAINT)
+    memset (raster->coverage + y * raster->width + x0, 255, x1 - x0 + 1);
+  else if (op == GROMIT_RASTER_ERASE)
+    memset (raster->coverage + y * raster->width + x0, 0, x1 - x0 + 1);
+}
+
+
+static void
+gromit_raster_add_dirty (GromitRaster *raster, gint x0, gint y0,
+                         gint x1, gint y1, GdkRectangle *dirty)
+{
+  GdkRectangle rect;
+
+  if (!dirty)
+    return;
+
+  x0 = MAX (x0, raster->clip.x);
+  y0 = MAX (y0, raster->clip.y);
+  x1 = MIN (x1, raster->clip.x + raster->clip.width - 1);
+  y1 = MIN (y1, raster->clip.y + raster->clip.height - 1);
+
+  if (x0 > x1 || y0 > y1)
+    return;
+
+  rect.x = x0;
+  rect.y = y0;
+  rect.width = x1 - x0 + 1;
+  rect.height = y1 - y0 + 1;
+  gromit_rect_union (dirty, &rect);
+}
+
+
+/*
+ * A line of width w with round caps is the set of all points with a
+ * distance of at most w/2 to the segment. That is a convex "capsule",
+ * so every row intersects it in a single span: the union of the spans
+ * of the two end discs and of the rectangle in between.
+ */
+
+void
+gromit_line_spans (gint x1, gint y1, gint x2, gint y2, gint width,
+                   GromitSpanFunc func, gpointer user_data)
+{
+  gdouble r, r2, nx = 0, ny = 0, len;
+  gdouble cx[4], cy[4];
+  gint ymin, ymax, py, i;
+
+  r = MAX (width, 1) / 2.0;
+  r2 = r * r;
+
+  len = sqrt ((gdouble) (x2 - x1) * (x2 - x1) + (gdouble) (y2 - y1) * (y2 - y1));
+  if (len > 0)
+    {
+      nx = - (y2 - y1) * r / len;
+      ny =   (x2 - x1) * r / len;
+    }
+
+  cx[0] = x1 + nx;  cy[0] = y1 + ny;
+  cx[1] = x2 + nx;  cy[1] = y2 + ny;
+  cx[2] = x2 - nx;  cy[2] = y2 - ny;
+  cx[3] = x1 - nx;  cy[3] = y1 - ny;
+
+  ymin = floor (MIN (y1, y2) - r);
+  ymax = ceil (MAX (y1, y2) + r);
+
+  for (py = ymin; py <= ymax; py++)
+    {
+      gdouble xl = G_MAXINT, xr = G_MININT;
+      gdouble dy, h;
+      gint left, right;
+
+      dy = py - y1;
+      if (dy * dy <= r2)
+        {
+          h = sqrt (r2 - dy * dy);
+          xl = MIN (xl, x1 - h);
+          xr = MAX (xr, x1 + h);
+        }
+
+      dy = py - y2;
+      if (dy * dy <= r2)
+        {
+          h = sqrt (r2 - dy * dy);
+          xl = MIN (xl, x2 - h);
+          xr = MAX (xr, x2 + h);
+        }
+
+      if (len > 0)
+        {
+          for (i = 0; i < 4; i++)
+            {
+              gdouble ax = cx[i], ay = cy[i];
+              gdouble bx = cx[(i+1) % 4], by = cy[(i+1) % 4];
+              gdouble x;
+
+              if ((py < ay && py < by) || (py > ay && py > by))
+                continue;
+
+              if (ay == by)
+                {
+                  xl = MIN (xl, MIN (ax, bx));
+                  xr = MAX (xr, MAX (ax, bx));
+                }
+              else
+                {
+                  x = ax + (py - ay) * (bx - ax) / (by - ay);
+                  xl = MIN (xl, x);
+                  xr = MAX (xr, x);
+                }
+            }
+        }
+
+      if (xl > xr)
+        continue;
+
+      left = ceil (xl);
+      right = floor (xr);
+      if (left <= right)
+        func (py, left, right, user_data);
+    }
+}
+
+
+typedef struct
+{
+  GromitRaster   *raster;
+  guint32         pixel;
+  GromitRasterOp  op;
+  gint            xmin, xmax, ymin, ymax;
+} GromitRasterSpanData;
+
+
+static void
+gromit_raster_line_span (gint y, gint x0, gint x1, gpointer user_data)
+{
+  GromitRasterSpanData *sd = user_data;
+
+  if (y < sd->raster->clip.y ||
+      y >= sd->raster->clip.y + sd->raster->clip.height)
+    return;
+
+  gromit_raster_span (sd->raster, y, x0, x1, sd->pixel, sd->op);
+
+  sd->xmin = MIN (sd->xmin, x0);
+  sd->xmax = MAX (sd->xmax, x1);
+  sd->ymin = MIN (sd->ymin, y);
+  sd->ymax = MAX (sd->ymax, y);
+}
+
+
+void
+gromit_raster_line (GromitRaster *raster,
+                    gint x1, gint y1, gint x2, gint y2,
+                    gint width, guint32 pixel, GromitRasterOp op,
+                    GdkRectangle *dirty)
+{
+  GromitRasterSpanData sd;
+
+  sd.raster = raster;
+  sd.pixel = pixel;
+  sd.op = op;
+  sd.xmin = sd.ymin = G_MAXINT;
+  sd.xmax = sd.ymax = G_MININT;
+
+  gromit_line_spans (x1, y1, x2, y2, width, gromit_raster_line_span, &sd);
+
+  if (sd.xmin <= sd.xmax)
+    gromit_raster_add_dirty (raster, sd.xmin, sd.ymin, sd.xmax, sd.ymax,
+                             dirty);
+}
+
+
+static int
+gromit_raster_compare_double (const void *a, const void *b)
+{
+  gdouble da = *(const gdouble *) a;
+  gdouble db = *(const gdouble *) b;
+
+  return (da > db) - (da < db);
+}
+
+
+/* the four corners of an arrowhead of the given width at x, y */
+void
+gromit_arrowhead (gint x, gint y, gint width, gfloat direction,
+                  GdkPoint *points)
+{
+  width = width / 2;
+
+  points [0].x = x + 4 * width * cos (direction);
+  points [0].y = y + 4 * width * sin (direction);
+
+  points [1].x = x - 3 * width * cos (direction)
+                   + 3 * width * sin (direction);
+  points [1].y = y - 3 * width * cos (direction)
+                   - 3 * width * sin (direction);
+
+  points [2].x = x - 2 * width * cos (direction);
+  points [2].y = y - 2 * width * sin (direction);
+
+  points [3].x = x - 3 * width * cos (direction)
+                   - 3 * width * sin (direction);
+  points [3].y = y + 3 * width * cos (direction)
+                   - 3 * width * sin (direction);
+}
+
+
+/* the outline of the shape as a polyline, free with g_free () */
+GdkPoint *
+gromit_shape_points (GromitPaintType type,
+                     gint x1, gint y1, gint x2, gint y2,
+                     gint *npoints)
+{
+  GdkPoint *points;
+  gdouble   cx, cy, rx, ry;
+  gint      i, n;
+
+  switch (type)
+    {
+      case GROMIT_RECT:
+        points = g_new (GdkPoint, 5);
+        points[0].x = x1; points[0].y = y1;
+        points[1].x = x2; points[1].y = y1;
+        points[2].x = x2; points[2].y = y2;
+        points[3].x = x1; points[3].y = y2;
+        points[4] = points[0];
+        *npoints = 5;
+        break;
+
+      case GROMIT_ELLIPSE:
+        cx = (x1 + x2) / 2.0;
+        cy = (y1 + y2) / 2.0;
+        rx = ABS (x2 - x1) / 2.0;
+        ry = ABS (y2 - y1) / 2.0;
+
+        /* segments of about 8 pixels */
+        n = CLAMP (G_PI * (rx + ry) / 8, 16, 256);
+        points = g_new (GdkPoint, n + 1);
+        for (i = 0; i < n; i++)
+          {
+            points[i].x = cx + rx * cos (2 * G_PI * i / n) + 0.5;
+            points[i].y = cy + ry * sin (2 * G_PI * i / n) + 0.5;
+          }
+        points[n] = points[0];
+        *npoints = n + 1;
+        break;
+
+      default:
+        /* GROMIT_LINE */
+        points = g_new (GdkPoint, 2);
+        points[0].x = x1; points[0].y = y1;
+        points[1].x = x2; points[1].y = y2;
+        *npoints = 2;
+        break;
+    }
+
+  return points;
+}
+
+
+/*
+ * Even-odd scanline fill, good enough for the small (and possibly
+ * concave) arrowheads.
+ */
+
+void
+gromit_raster_polygon (GromitRaster *raster,
+                       const GdkPoint *points, gint npoints,
+                       guint32 pixel, GromitRasterOp op,
+                       GdkRectangle *dirty)
+{
+  gdouble *xs;
+  gint ymin = G_MAXINT, ymax = G_MININT;
+  gint xmin = G_MAXINT, xmax = G_MININT;
+  gint py, i, n;
+
+  if (npoints < 3)
+    return;
+
+  for (i = 0; i < npoints; i++)
+    {
+      ymin = MIN (ymin, points[i].y);
+      ymax = MAX (ymax, points[i].y);
+      xmin = MIN (xmin, points[i].x);
+      xmax = MAX (xmax, points[i].x);
+    }
+
+  xs = g_new (gdouble, npoints);
+
+  for (py = MAX (ymin, raster->clip.y);
+       py <= MIN (ymax, raster->clip.y + raster->clip.height - 1); py++)
+    {
+      n = 0;
+      for (i = 0; i < npoints; i++)
+        {
+          const GdkPoint *a = &points[i];
+          const GdkPoint *b = &points[(i+1) % npoints];
+
+          if (a->y == b->y)
+            continue;
+
+          if (py >= MIN (a->y, b->y) && py < MAX (a->y, b->y))
+            xs[n++] = a->x + (gdouble) (py - a->y) * (b->x - a->x) / (b->y - a->y);
+        }
+
+      qsort (xs, n, sizeof (gdouble), gromit_raster_compare_double);
+
+      for (i = 0; i + 1 < n; i += 2)
+        gromit_raster_span (raster, py, ceil (xs[i]), floor (xs[i+1]),
+                            pixel, op);
+    }
+
+  g_free (xs);
+
+  gromit_raster_add_dirty (raster, xmin, ymin, xmax, ymax, dirty);
+}
+
+
+/*
+ * Apply op where the bitmap (LSB first, like XBM data) has its bits
+ * set, with the top left corner of the bitmap at (x, y).
+ */
+
+void
+gromit_raster_bitmap (GromitRaster *raster, gint x, gint y,
+                      gint width, gint height,
+                      const guchar *bits, gint bytes_per_line,
+                      guint32 pixel, GromitRasterOp op,
+                      GdkRectangle *dirty)
+{
+  const guchar *line;
+  gboolean      set;
+  gint          row, col, start;
+
+  for (row = 0; row < height; row++)
+    {
+      if (y + row < raster->clip.y ||
+          y + row >= raster->clip.y + raster->clip.height)
+        continue;
+
+      line = bits + row * bytes_per_line;
+      start = -1;
+
+      for (col = 0; col <= width; col++)
+        {
+          set = col < width && (line[col >> 3] & (1 << (col & 7)));
+
+          if (set && start < 0)
+            {
+              start = col;
+            }
+          else if (!set && start >= 0)
+            {
+              gromit_raster_span (raster, y + row, x + start, x + col - 1,
+                                  pixel, op);
+              start = -1;
+            }
+        }
+    }
+
+  gromit_raster_add_dirty (raster, x, y, x + width - 1, y + height - 1,
+                           dirty);
+}
+
+
+/*
+ * Converting the coverage to the 1 bpp shape bitmap (LSBFirst,
+ * 1 == painted). A pixel counts as painted if its coverage is >= 128,
+ * i.e. if the top bit is set - which is exactly what movemask extracts.
+ *
+ * The row kernels pack nbytes * 8 coverage values into bits and record
+ * the first and last byte that differ from what was there before, so
+ * the caller only has to upload what really changed.
+ */
+
+typedef void (*GromitPackRowFunc) (const guchar *cov, guchar *bits,
+                                   gint nbytes, gint *first, gint *last);
+
+static GromitPackRowFunc  gromit_pack_row = NULL;
+static const gchar       *gromit_pack_row_name = NULL;
+
+
+static inline guchar
+gromit_pack_byte (const guchar *cov, gint n)
+{
+  guchar byte = 0;
+  gint b;
+
+  for (b = 0; b < n; b++)
+    byte |= (cov[b] >> 7) << b;
+
+  return byte;
+}
+
+
+static inline void
+gromit_pack_store (guchar *bits, gint i, guchar byte, gint *first, gint *last)
+{
+  if (bits[i] != byte)
+    {
+      bits[i] = byte;
+      if (i < *first)
+        *first = i;
+      *last = i;
+    }
+}
+
+
+static void
+gromit_pack_row_c (const guchar *cov, guchar *bits,
+                   gint nbytes, gint *first, gint *last)
+{
+  gint i;
+
+  for (i = 0; i < nbytes; i++)
+    gromit_pack_store (bits, i, gromit_pack_byte (cov + 8 * i, 8),
+                       first, last);
+}
+
+
+#if defined (__GNUC__) && (defined (__x86_64__) || defined (__i386__))
+
+#include <immintrin.h>
+
+/* x86 is little endian, byte b of diff is the packed byte i + b */
+static inline void
+gromit_pack_note_diff (guint32 diff, gint i, gint n, gint *first, gint *last)
+{
+  gint b;
+
+  for (b = 0; b < n; b++)
+    if (diff & (0xffu << (8 * b)))
+      {
+        if (i + b < *first)
+          *first = i + b;
+        *last = i + b;
+      }
+}
+
+
+__attribute__ ((target ("sse2")))
+static void
+gromit_pack_row_sse2 (const guchar *cov, guchar *bits,
+                      gint nbytes, gint *first, gint *last)
+{
+  gint i = 0;
+
+  for (; i + 2 <= nbytes; i += 2)
+    {
+      __m128i  v = _mm_loadu_si128 ((const __m128i *) (cov + 8 * i));
+      guint16  mask = _mm_movemask_epi8 (v);
+      guint16  old;
+
+      memcpy (&old, bits + i, 2);
+      if (mask != old)
+        {
+          memcpy (bits + i, &mask, 2);
+          gromit_pack_note_diff (mask ^ old, i, 2, first, last);
+        }
+    }
+
+  for (; i < nbytes; i++)
+    gromit_pack_store (bits, i, gromit_pack_byte (cov + 8 * i, 8),
+                       first, last);
+}
+
+
+__attribute__ ((target ("avx2")))
+static void
+gromit_pack_row_avx2 (const guchar *cov, guchar *bits,
+                      gint nbytes, gint *first, gint *last)
+{
+  gint i = 0;
+
+  for (; i + 4 <= nbytes; i += 4)
+    {
+      __m256i  v = _mm256_loadu_si256 ((const __m256i *) (cov + 8 * i));
+      guint32  mask = _mm256_movemask_epi8 (v);
+      guint32  old;
+
+      memcpy (&old, bits + i, 4);
+      if (mask != old)
+        {
+          memcpy (bits + i, &mask, 4);
+          gromit_pack_note_diff (mask ^ old, i, 4, first, last);
+        }
+    }
+
+  for (; i < nbytes; i++)
+    gromit_pack_store (bits, i, gromit_pack_byte (cov + 8 * i, 8),
+                       first, last);
+}
+
+#endif
+
+
+static void
+gromit_pack_row_init (void)
+{
+  gromit_pack_row = gromit_pack_row_c;
+  gromit_pack_row_name = "C";
+
+#if defined (__GNUC__) && (defined (__x86_64__) || defined (__i386__))
+  __builtin_cpu_init ();
+  if (__builtin_cpu_supports ("avx2"))
+    {
+      gromit_pack_row = gromit_pack_row_avx2;
+      gromit_pack_row_name = "AVX2";
+    }
+  else if (__builtin_cpu_supports ("sse2"))
+    {
+      gromit_pack_row = gromit_pack_row_sse2;
+      gromit_pack_row_name = "SSE2";
+    }
+#endif
+}
+
+
+const gchar *
+gromit_raster_pack_kernel (void)
+{
+  if (!gromit_pack_row)
+    gromit_pack_row_init ();
+
+  return gromit_pack_row_name;
+}
+
+
+/*
+ * Update the 1 bpp bitmap in bits from the coverage inside rect. The
+ * rectangle is widened to whole bytes. Returns in changed the bounding
+ * box of the per-row spans that actually differ from the previous
+ * contents of bits (width 0 if nothing changed).
+ */
+
+void
+gromit_raster_pack_mask (GromitRaster *raster, const GdkRectangle *rect,
+                         guchar *bits, gint bytes_per_line,
+                         GdkRectangle *changed)
+{
+  gint y, x0, x1, nbytes, tail;
+  gint cfirst = G_MAXINT, clast = -1, ymin = -1, ymax = -1;
+
+  if (!gromit_pack_row)
+    gromit_pack_row_init ();
+
+  x0 = MAX (rect->x, 0) & ~7;
+  x1 = MIN ((rect->x + rect->width + 7) & ~7, raster->width);
+  nbytes = (x1 - x0) / 8;
+  tail = (x1 - x0) % 8;
+
+  for (y = MAX (rect->y, 0);
+       y < MIN (rect->y + rect->height, raster->height); y++)
+    {
+      const guchar *cov = raster->coverage + y * raster->width + x0;
+      guchar *out = bits + y * bytes_per_line + x0 / 8;
+      gint first = G_MAXINT, last = -1;
+
+      gromit_pack_row (cov, out, nbytes, &first, &last);
+
+      /* the last byte of a row that is not a multiple of 8 wide */
+      if (tail)
+        gromit_pack_store (out, nbytes, gromit_pack_byte (cov + 8 * nbytes,
+                                                          tail),
+                           &first, &last);
+
+      if (last >= 0)
+        {
+          cfirst = MIN (cfirst, first);
+          clast = MAX (clast, last);
+          if (ymin < 0)
+            ymin = y;
+          ymax = y;
+        }
+    }
+
+  if (!changed)
+    return;
+
+  if (clast < 0)
+    {
+      changed->x = changed->y = changed->width = changed->height = 0;
+      return;
+    }
+
+  changed->x = x0 + 8 * cfirst;
+  changed->y = ymin;
+  changed->width = MIN (x0 + 8 * (clast + 1), raster->width) - changed->x;
+  changed->height = ymax - ymin + 1;
+}
@@ -0,0 +1,114 @@
+/* Gromit -- a program for painting on the screen
+ * Copyright (C) 2000 Simon Budig <Simon.Budig@unix-ag.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __GROMIT_RASTER_H__
+#define __GROMIT_RASTER_H__
+
+#include <glib.h>
+#include <gdk/gdk.h>
+
+#include "stroke.h"
+
+/*
+ * A client side copy of the annotation layer. "pixels" holds the colors
+ * in the pixel format of the X visual (32 bits per pixel), "coverage"
+ * holds one byte per pixel: 0 is transparent, 255 is painted. The
+ * coverage plane is what ends up in the shape of the window.
+ *
+ * Drawing never leaves "clip". A view clipped to a tile shares the
+ * buffers with its raster, so that threads can draw into different
+ * tiles at the same time.
+ */
+
+typedef struct
+{
+  gint      width;
+  gint      height;
+  gint      stride;        /* in pixels */
+  guint32  *pixels;
+  guchar   *coverage;
+  gboolean  own_pixels;
+  GdkRectangle clip;
+} GromitRaster;
+
+typedef enum
+{
+  GROMIT_RASTER_PAINT,     /* set color and coverage */
+  GROMIT_RASTER_ERASE,     /* clear coverage */
+  GROMIT_RASTER_RECOLOR    /* set color, leave coverage alone */
+} GromitRasterOp;
+
+typedef void (*GromitSpanFunc) (gint y, gint x0, gint x1, gpointer user_data);
+
+
+void          gromit_line_spans      (gint x1, gint y1, gint x2, gint y2,
+                                      gint width,
+                                      GromitSpanFunc func,
+                                      gpointer user_data);
+void          gromit_region_span     (gint y, gint x0, gint x1,
+                                      gpointer user_data);
+void          gromit_arrowhead       (gint x, gint y, gint width,
+                                      gfloat direction, GdkPoint *points);
+GdkPoint     *gromit_shape_points    (GromitPaintType type,
+                                      gint x1, gint y1, gint x2, gint y2,
+                                      gint *npoints);
+
+GromitRaster *gromit_raster_new      (gint width, gint height,
+                                      guint32 *pixels, gint stride);
+void          gromit_raster_free     (GromitRaster *raster);
+void          gromit_raster_view     (GromitRaster *view,
+                                      const GromitRaster *raster,
+                                      const GdkRectangle *clip);
+void          gromit_raster_clear    (GromitRaster *raster, guint32 pixel);
+void          gromit_raster_shrink   (GromitRaster *raster,
+                                      gint width, gint height);
+void          gromit_raster_copy     (GromitRaster *dest,
+                                      const GromitRaster *src);
+void          gromit_raster_bounds   (GromitRaster *raster,
+                                      GdkRectangle *bounds);
+void          gromit_raster_coverage_spans (GromitRaster *raster,
+                                            GromitSpanFunc func,
+                                            gpointer user_data);
+
+void          gromit_raster_line     (GromitRaster *raster,
+                                      gint x1, gint y1, gint x2, gint y2,
+                                      gint width, guint32 pixel,
+                                      GromitRasterOp op,
+                                      GdkRectangle *dirty);
+void          gromit_raster_polygon  (GromitRaster *raster,
+                                      const GdkPoint *points, gint npoints,
+                                      guint32 pixel, GromitRasterOp op,
+                                      GdkRectangle *dirty);
+void          gromit_raster_bitmap   (GromitRaster *raster,
+                                      gint x, gint y,
+                                      gint width, gint height,
+                                      const guchar *bits,
+                                      gint bytes_per_line,
+                                      guint32 pixel, GromitRasterOp op,
+                                      GdkRectangle *dirty);
+
+void          gromit_raster_pack_mask (GromitRaster *raster,
+                                       const GdkRectangle *rect,
+                                       guchar *bits, gint bytes_per_line,
+                                       GdkRectangle *changed);
+const gchar  *gromit_raster_pack_kernel (void);
+
+void          gromit_rect_union      (GdkRectangle *dest,
+                                      const GdkRectangle *src);
+
+#endif /* __GROMIT_RASTER_H__ */
@@ -0,0 +1,859 @@
+/* Gromit -- a program for painting on the screen
+ * Copyright (C) 2000 Simon Budig <Simon.Budig@unix-ag.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <cairo.h>
+#include <pango/pangocairo.h>
+
+#include "glyph.h"
+#include "raster.h"
+#include "stroke.h"
+#include "stream.h"
+#include "render.h"
+
+#define GROMIT_RENDER_DEFAULT_WIDTH  1920
+#define GROMIT_RENDER_DEFAULT_HEIGHT 1080
+
+/*
+ * A script is a text file with one command per line, "#" starts a
+ * comment:
+ *
+ *   size 1280 720
+ *   background white
+ *   tool PEN color=red size=7 arrowsize=1
+ *   line 100,100 200,150 300,120,12
+ *   tool RECT color=blue size=3
+ *   line 400,300 600,400
+ *   clear
+ *
+ * The points of "line" may carry a width, they get the size of the tool
+ * otherwise. With a LINE, RECT or ELLIPSE tool "line" takes the two
+ * corners of the shape. A recording of "gromit --publish" works as well.
+ */
+
+typedef struct
+{
+  gint           width;
+  gint           height;
+  volatile gint  failed;
+} GromitRenderSettings;
+
+typedef struct
+{
+  const gchar     *path;
+  gint             lineno;
+  gint             width;
+  gint             height;
+  guint32          background;     /* 0 is transparent */
+  cairo_surface_t *surface;
+  GromitRaster    *raster;
+  gboolean         failed;
+
+  /* the page of a recording being drawn, paged once there are more */
+  gint             page;
+  gboolean         paged;
+
+  /* the current tool */
+  GromitPaintType  type;
+  guint32          pixel;
+  gint             size;
+  gfloat           arrowsize;
+  gfloat           opacity;
+  gchar           *font;           /* NULL for the default */
+
+  /* the current HIGHLIGHTER stroke, blended in once it is complete */
+  GromitRaster    *layer;
+  GdkRectangle     layer_dirty;
+} GromitCanvas;
+
+
+static guint32
+gromit_canvas_pixel (guint16 red, guint16 green, guint16 blue)
+{
+  return 0xff000000 | (red >> 8) << 16 | (green >> 8) << 8 | (blue >> 8);
+}
+
+
+static GromitRasterOp
+gromit_canvas_op (GromitCanvas *canvas)
+{
+  if (canvas->type == GROMIT_ERASER)
+    return GROMIT_RASTER_ERASE;
+  else if (canvas->type == GROMIT_RECOLOR)
+    return GROMIT_RASTER_RECOLOR;
+  else
+    return GROMIT_RASTER_PAINT;
+}
+
+
+/* the image gets created with the first thing drawn */
+static GromitRaster *
+gromit_canvas_raster (GromitCanvas *canvas)
+{
+  if (canvas->raster)
+    return canvas->raster;
+
+  canvas->surface = cairo_image_surface_create (CAIRO_FORMAT_ARGB32,
+                                                canvas->width,
+                                                canvas->height);
+  canvas->raster =
+    gromit_raster_new (canvas->width, canvas->height,
+                       (guint32 *) cairo_image_surface_get_data (canvas->surface),
+                       cairo_image_surface_get_stride (canvas->surface) / 4);
+  gromit_raster_clear (canvas->raster, 0);
+
+  return canvas->raster;
+}
+
+
+/*
+ * Like the HIGHLIGHTER on the screen, every pixel of a stroke gets
+ * blended only once, over the drawing or the background: the stroke
+ * goes into a layer of its own first.
+ */
+static GromitRaster *
+gromit_canvas_target (GromitCanvas *canvas, GdkRectangle **dirty)
+{
+  GromitRaster *raster = gromit_canvas_raster (canvas);
+
+  if (canvas->type != GROMIT_HIGHLIGHTER)
+    return raster;
+
+  if (!canvas->layer)
+    canvas->layer = gromit_raster_new (raster->width, raster->height,
+                                       NULL, 0);
+  *dirty = &canvas->layer_dirty;
+
+  return canvas->layer;
+}
+
+
+static guint32
+gromit_canvas_mix (guint32 src, guint32 dest, guint alpha)
+{
+  guint32 pixel = 0;
+  gint    shift;
+
+  /* premultiplied, like the cairo surface */
+  for (shift = 0; shift < 32; shift += 8)
+    pixel |= (guint32) ((((src >> shift) & 0xff) * alpha +
+                         ((dest >> shift) & 0xff) * (255 - alpha) + 127)
+                        / 255) << shift;
+
+  return pixel;
+}
+
+
+static void
+gromit_canvas_blend (GromitCanvas *canvas)
+{
+  GromitRaster *raster = canvas->raster;
+  GromitRaster *layer = canvas->layer;
+  GdkRectangle *rect = &canvas->layer_dirty;
+  guint32      *pixel;
+  guchar       *coverage;
+  guint         alpha = canvas->opacity * 255 + 0.5;
+  gint          x, y;
+
+  if (!layer || rect->width <= 0 || rect->height <= 0)
+    return;
+
+  for (y = rect->y; y < rect->y + rect->height; y++)
+    for (x = rect->x; x < rect->x + rect->width; x++)
+      {
+        if (!layer->coverage[y * layer->width + x])
+          continue;
+
+        pixel = raster->pixels + y * raster->stride + x;
+        coverage = raster->coverage + y * raster->width + x;
+
+        *pixel = gromit_canvas_mix (layer->pixels[y * layer->stride + x],
+                                    *coverage ? *pixel : canvas->background,
+                                    alpha);
+        *coverage = 255;
+        layer->coverage[y * layer->width + x] = 0;
+      }
+
+  rect->width = rect->height = 0;
+}
+
+
+/*
+ * What the drawing functions of Gromit do, minus the X server.
+ */
+
+static void
+gromit_canvas_clear (gpointer user_data)
+{
+  GromitCanvas *canvas = user_data;
+
+  gromit_canvas_blend (canvas);
+  if (canvas->raster)
+    gromit_raster_clear (canvas->raster, 0);
+}
+
+
+static gboolean gromit_canvas_write (GromitCanvas *canvas);
+
+/*
+ * A recording of several pages becomes one image per page. Switching to
+ * a page sends all of it again, so a page that comes back simply gets
+ * written anew.
+ */
+static void
+gromit_canvas_page (guint page, gpointer user_data)
+{
+  GromitCanvas *canvas = user_data;
+
+  if (canvas->page >= 0 && canvas->page != page)
+    {
+      canvas->paged = TRUE;
+      if (!gromit_canvas_write (canvas))
+        canvas->failed = TRUE;
+    }
+
+  canvas->page = page;
+  gromit_canvas_clear (canvas);
+}
+
+
+static void
+gromit_canvas_tool (const GromitStreamTool *tool, gpointer user_data)
+{
+  GromitCanvas *canvas = user_data;
+
+  gromit_canvas_blend (canvas);
+
+  canvas->type = tool->type;
+  canvas->pixel = gromit_canvas_pixel (tool->red, tool->green, tool->blue);
+  canvas->size = tool->width;
+  canvas->arrowsize = tool->arrowsize;
+  canvas->opacity = CLAMP (tool->opacity, 0, 1);
+
+  g_free (canvas->font);
+  canvas->font = g_strdup (tool->font);
+}
+
+
+static void
+gromit_canvas_segment (gint x1, gint y1, gint x2, gint y2, gint width,
+                       gpointer user_data)
+{
+  GromitCanvas *canvas = user_data;
+  GdkRectangle  rect = { 0, 0, 0, 0 };
+  GdkRectangle *dirty = &rect;
+  GromitRaster *raster = gromit_canvas_target (canvas, &dirty);
+
+  gromit_raster_line (raster, x1, y1, x2, y2, width,
+                      canvas->pixel, gromit_canvas_op (canvas), dirty);
+}
+
+
+static void
+gromit_canvas_arrow (gint x, gint y, gint width, gfloat direction,
+                     gpointer user_data)
+{
+  GromitCanvas *canvas = user_data;
+  GdkRectangle  rect = { 0, 0, 0, 0 };
+  GdkRectangle *dirty = &rect;
+  GromitRaster *raster = gromit_canvas_target (canvas, &dirty);
+  GdkPoint      arrowhead[4];
+  gint          i;
+
+  gromit_arrowhead (x, y, width, direction, arrowhead);
+
+  gromit_raster_polygon (raster, arrowhead, 4, canvas->pixel,
+                         gromit_canvas_op (canvas), dirty);
+  for (i = 0; i < 4; i++)
+    gromit_raster_line (raster,
+                        arrowhead[i].x, arrowhead[i].y,
+                        arrowhead[(i+1) % 4].x, arrowhead[(i+1) % 4].y,
+                        0, gromit_canvas_pixel (0, 0, 0),
+                        gromit_canvas_op (canvas), dirty);
+}
+
+
+/* one glyph with its top left at the pen, returns the advance */
+static gint
+gromit_canvas_glyph (GromitCanvas *canvas, PangoLayout *layout,
+                     const gchar *c, gint x, gint y)
+{
+  PangoRectangle   ink, logical;
+  cairo_surface_t *surface;
+  cairo_t         *cr;
+  GdkRectangle     dirty = { 0, 0, 0, 0 };
+  guchar          *pixels, *bits;
+  gint             stride, bytes_per_line, i, j;
+
+  pango_layout_set_text (layout, c, g_utf8_next_char (c) - c);
+  pango_layout_get_pixel_extents (layout, &ink, &logical);
+
+  if (ink.width <= 0 || ink.height <= 0)
+    return logical.width;
+
+  surface = cairo_image_surface_create (CAIRO_FORMAT_A8,
+                                        ink.width, ink.height);
+  cr = cairo_create (surface);
+  cairo_move_to (cr, -ink.x, -ink.y);
+  pango_cairo_show_layout (cr, layout);
+  cairo_destroy (cr);
+  cairo_surface_flush (surface);
+
+  /* the same threshold as the glyph cache of the screen */
+  pixels = cairo_image_surface_get_data (surface);
+  stride = cairo_image_surface_get_stride (surface);
+  bytes_per_line = (ink.width + 7) / 8;
+  bits = g_malloc0 (bytes_per_line * ink.height);
+
+  for (j = 0; j < ink.height; j++)
+    for (i = 0; i < ink.width; i++)
+      if (pixels[j * stride + i] >= 128)
+        bits[j * bytes_per_line + (i >> 3)] |= 1 << (i & 7);
+
+  gromit_raster_bitmap (gromit_canvas_raster (canvas),
+                        x + ink.x, y + ink.y, ink.width, ink.height,
+                        bits, bytes_per_line, canvas->pixel,
+                        GROMIT_RASTER_PAINT, &dirty);
+
+  g_free (bits);
+  cairo_surface_destroy (surface);
+
+  return logical.width;
+}
+
+
+/* lays out the label like gromit_draw_text (), glyph by glyph */
+static void
+gromit_canvas_text (gint x, gint y, const gchar *text, gpointer user_data)
+{
+  GromitCanvas         *canvas = user_data;
+  PangoContext         *context;
+  PangoFontDescription *desc;
+  PangoFontMetrics     *metrics;
+  PangoLayout          *layout;
+  cairo_font_options_t *options;
+  const gchar          *p;
+  gint                  pen_x = x;
+  gint                  height;
+
+  gromit_canvas_blend (canvas);
+
+  context = pango_font_map_create_context (pango_cairo_font_map_get_default ());
+  options = cairo_font_options_create ();
+  cairo_font_options_set_antialias (options, CAIRO_ANTIALIAS_NONE);
+  pango_cairo_context_set_font_options (context, options);
+  cairo_font_options_destroy (options);
+
+  desc = pango_font_description_from_string (canvas->font ? canvas->font
+                                                          : GROMIT_DEFAULT_FONT);
+  pango_font_description_set_absolute_size (desc, canvas->size * PANGO_SCALE);
+
+  metrics = pango_context_get_metrics (context, desc, NULL);
+  height = PANGO_PIXELS (pango_font_metrics_get_ascent (metrics) +
+                         pango_font_metrics_get_descent (metrics));
+  pango_font_metrics_unref (metrics);
+
+  layout = pango_layout_new (context);
+  pango_layout_set_font_description (layout, desc);
+
+  for (p = text; *p; p = g_utf8_next_char (p))
+    {
+      if (*p == '\n')
+        {
+          pen_x = x;
+          y += height;
+        }
+      else
+        pen_x += gromit_canvas_glyph (canvas, layout, p, pen_x, y);
+    }
+
+  g_object_unref (layout);
+  pango_font_description_free (desc);
+  g_object_unref (context);
+}
+
+
+static const GromitStreamHandler gromit_canvas_handler =
+{
+  gromit_canvas_clear,
+  gromit_canvas_page,
+  gromit_canvas_tool,
+  gromit_canvas_segment,
+  gromit_canvas_arrow,
+  gromit_canvas_text
+};
+
+
+/*
+ * Scripts
+ */
+
+static gboolean
+gromit_script_color (GromitCanvas *canvas, const gchar *name,
+                     guint32 *pixel)
+{
+  GdkColor color;
+
+  if (!gdk_color_parse (name, &color))
+    {
+      g_printerr ("%s:%d: unknown color \"%s\"\n",
+                  canvas->path, canvas->lineno, name);
+      return FALSE;
+    }
+
+  *pixel = gromit_canvas_pixel (color.red, color.green, color.blue);
+  return TRUE;
+}
+
+
+static gboolean
+gromit_script_tool (GromitCanvas *canvas, gchar **args)
+{
+  /* in the order of GromitPaintType */
+  static const gchar *types[] = { "PEN", "ERASER", "RECOLOR", "HIGHLIGHTER",
+                                  "TEXT", "LINE", "RECT", "ELLIPSE" };
+  gchar *value;
+  guint  i;
+
+  for (i = 0; i < G_N_ELEMENTS (types); i++)
+    if (args[0] && g_ascii_strcasecmp (args[0], types[i]) == 0)
+      break;
+
+  if (i == G_N_ELEMENTS (types) || i == GROMIT_TEXT)
+    {
+      g_printerr ("%s:%d: tool needs a type (PEN, ERASER, RECOLOR, "
+                  "HIGHLIGHTER, LINE, RECT or ELLIPSE), scripts have no "
+                  "labels\n", canvas->path, canvas->lineno);
+      return FALSE;
+    }
+
+  gromit_canvas_blend (canvas);
+
+  canvas->type = i;
+  canvas->pixel = gromit_canvas_pixel (0xffff, 0, 0);
+  canvas->size = 7;
+  canvas->arrowsize = 0;
+  canvas->opacity = (i == GROMIT_HIGHLIGHTER) ? 0.4 : 1.0;
+
+  for (args++; *args; args++)
+    {
+      value = strchr (*args, '=');
+      if (!value)
+        {
+          g_printerr ("%s:%d: \"%s\" is not an option=value pair\n",
+                      canvas->path, canvas->lineno, *args);
+          return FALSE;
+        }
+      *value++ = '\0';
+
+      if (strcmp (*args, "color") == 0)
+        {
+          if (!gromit_script_color (canvas, value, &canvas->pixel))
+            return FALSE;
+        }
+      else if (strcmp (*args, "size") == 0)
+        canvas->size = MAX (atoi (value), 1);
+      else if (strcmp (*args, "arrowsize") == 0)
+        canvas->arrowsize = MAX (g_ascii_strtod (value, NULL), 0);
+      else if (strcmp (*args, "opacity") == 0)
+        canvas->opacity = CLAMP (g_ascii_strtod (value, NULL), 0, 1);
+      else
+        {
+          g_printerr ("%s:%d: unknown option \"%s\"\n",
+                      canvas->path, canvas->lineno, *args);
+          return FALSE;
+        }
+    }
+
+  return TRUE;
+}
+
+
+/* like gromit_coord_list_get_arrow_param (), walking back from the end */
+static gboolean
+gromit_script_arrow_param (GromitCanvas *canvas, GArray *points,
+                           gint *ret_width, gfloat *ret_direction)
+{
+  GromitStrokeCoordinate *end, *cur, *valid = NULL;
+  gint   search_radius = canvas->arrowsize * canvas->size / 2 * 3;
+  gint   r2 = search_radius * search_radius;
+  gint   dist = 0;
+  gint   i;
+
+  end = &g_array_index (points, GromitStrokeCoordinate, points->len - 1);
+
+  for (i = points->len - 2; i >= 0 && dist < r2; i--)
+    {
+      cur = &g_array_index (points, GromitStrokeCoordinate, i);
+      dist = (cur->x - end->x) * (cur->x - end->x) +
+             (cur->y - end->y) * (cur->y - end->y);
+      if (cur->width * canvas->arrowsize * 2 <= dist &&
+          (!valid || valid->width < cur->width))
+        valid = cur;
+    }
+
+  if (!valid)
+    return FALSE;
+
+  *ret_width = MAX (valid->width * canvas->arrowsize, 2);
+  *ret_direction = atan2 (end->y - valid->y, end->x - valid->x);
+  return TRUE;
+}
+
+
+/* the outline from one corner to the other, like gromit_shape_commit () */
+static gboolean
+gromit_script_shape (GromitCanvas *canvas, GArray *points)
+{
+  GromitStrokeCoordinate *start, *end;
+  GdkPoint               *outline;
+  gint                    i, n;
+
+  if (points->len != 2)
+    {
+      g_printerr ("%s:%d: a LINE, RECT or ELLIPSE takes two corners\n",
+                  canvas->path, canvas->lineno);
+      return FALSE;
+    }
+
+  start = &g_array_index (points, GromitStrokeCoordinate, 0);
+  end = &g_array_index (points, GromitStrokeCoordinate, 1);
+
+  outline = gromit_shape_points (canvas->type, start->x, start->y,
+                                 end->x, end->y, &n);
+  for (i = 1; i < n; i++)
+    gromit_canvas_segment (outline[i-1].x, outline[i-1].y,
+                           outline[i].x, outline[i].y, canvas->size, canvas);
+  g_free (outline);
+
+  if (canvas->type == GROMIT_LINE && canvas->arrowsize != 0 &&
+      (start->x != end->x || start->y != end->y))
+    gromit_canvas_arrow (end->x, end->y,
+                         canvas->arrowsize * canvas->size / 2,
+                         atan2 (end->y - start->y, end->x - start->x),
+                         canvas);
+
+  return TRUE;
+}
+
+
+static gboolean
+gromit_script_line (GromitCanvas *canvas, gchar **args)
+{
+  GromitStrokeCoordinate  point, *prev;
+  GArray                 *points;
+  gint                    width;
+  gfloat                  direction;
+  gint                    i;
+
+  points = g_array_new (FALSE, FALSE, sizeof (GromitStrokeCoordinate));
+
+  for (; *args; args++)
+    {
+      point.width = canvas->size;
+      if (sscanf (*args, "%d,%d,%d", &point.x, &point.y, &point.width) < 2)
+        {
+          g_printerr ("%s:%d: \"%s\" is not a point (x,y or x,y,width)\n",
+                      canvas->path, canvas->lineno, *args);
+          g_array_free (points, TRUE);
+          return FALSE;
+        }
+      g_array_append_val (points, point);
+    }
+
+  if (canvas->type == GROMIT_LINE || canvas->type == GROMIT_RECT ||
+      canvas->type == GROMIT_ELLIPSE)
+    {
+      gboolean ok = gromit_script_shape (canvas, points);
+
+      g_array_free (points, TRUE);
+      return ok;
+    }
+
+  /* a single point makes a dot, like a click */
+  for (i = 0; i < points->len; i++)
+    {
+      prev = &g_array_index (points, GromitStrokeCoordinate, MAX (i - 1, 0));
+      point = g_array_index (points, GromitStrokeCoordinate, i);
+      if (i == 0 && points->len > 1)
+        continue;
+      gromit_canvas_segment (prev->x, prev->y, point.x, point.y,
+                             point.width, canvas);
+    }
+
+  if (canvas->arrowsize != 0 && points->len > 1 &&
+      gromit_script_arrow_param (canvas, points, &width, &direction))
+    {
+      point = g_array_index (points, GromitStrokeCoordinate, points->len - 1);
+      gromit_canvas_arrow (point.x, point.y, width, direction, canvas);
+    }
+
+  gromit_canvas_blend (canvas);
+
+  g_array_free (points, TRUE);
+  return TRUE;
+}
+
+
+static gboolean
+gromit_script_run (GromitCanvas *canvas, gchar *script)
+{
+  gchar    **lines, **args, *comment;
+  gint       i, j, n;
+  gboolean   ok = TRUE;
+
+  lines = g_strsplit (script, "\n", -1);
+
+  for (i = 0; ok && lines[i]; i++)
+    {
+      canvas->lineno = i + 1;
+
+      comment = strchr (lines[i], '#');
+      if (comment)
+        *comment = '\0';
+
+      /* drop the empty fields of repeated blanks */
+      args = g_strsplit_set (g_strstrip (lines[i]), " \t", -1);
+      for (j = n = 0; args[j]; j++)
+        if (*args[j])
+          args[n++] = args[j];
+        else
+          g_free (args[j]);
+      args[n] = NULL;
+
+      if (n == 0)
+        ;
+      else if (strcmp (args[0], "size") == 0)
+        {
+          if (canvas->raster || n != 3 ||
+              atoi (args[1]) <= 0 || atoi (args[2]) <= 0)
+            {
+              g_printerr ("%s:%d: size needs a width and a height and must "
+                          "come before the drawing\n",
+                          canvas->path, canvas->lineno);
+              ok = FALSE;
+            }
+          else
+            {
+              canvas->width = atoi (args[1]);
+              canvas->height = atoi (args[2]);
+            }
+        }
+      else if (strcmp (args[0], "background") == 0 && n == 2)
+        ok = gromit_script_color (canvas, args[1], &canvas->background);
+      else if (strcmp (args[0], "tool") == 0)
+        ok = gromit_script_tool (canvas, args + 1);
+      else if (strcmp (args[0], "line") == 0)
+        ok = gromit_script_line (canvas, args + 1);
+      else if (strcmp (args[0], "clear") == 0)
+        gromit_canvas_clear (canvas);
+      else
+        {
+          g_printerr ("%s:%d: unknown command \"%s\"\n",
+                      canvas->path, canvas->lineno, args[0]);
+          ok = FALSE;
+        }
+
+      g_strfreev (args);
+    }
+
+  g_strfreev (lines);
+
+  return ok;
+}
+
+
+/*
+ * Files
+ */
+
+/* script.txt becomes script.png, or script-<n>.png for page n */
+static gchar *
+gromit_render_output (const gchar *path, gint page)
+{
+  const gchar *dot = strrchr (path, '.');
+  gchar       *base, *output;
+
+  if (!dot || strchr (dot, '/'))
+    base = g_strdup (path);
+  else
+    base = g_strndup (path, dot - path);
+
+  if (page < 0)
+    output = g_strconcat (base, ".png", NULL);
+  else
+    output = g_strdup_printf ("%s-%d.png", base, page + 1);
+  g_free (base);
+
+  return output;
+}
+
+
+static gboolean
+gromit_canvas_write (GromitCanvas *canvas)
+{
+  GromitRaster   *raster = gromit_canvas_raster (canvas);
+  gchar          *output;
+  cairo_status_t  status;
+  gint            x, y;
+
+  gromit_canvas_blend (canvas);
+
+  /* the unpainted pixels show the background */
+  for (y = 0; y < raster->height; y++)
+    for (x = 0; x < raster->width; x++)
+      if (!raster->coverage[y * raster->width + x])
+        raster->pixels[y * raster->stride + x] = canvas->background;
+
+  cairo_surface_mark_dirty (canvas->surface);
+
+  output = gromit_render_output (canvas->path,
+                                 canvas->paged ? canvas->page : -1);
+  status = cairo_surface_write_to_png (canvas->surface, output);
+  if (status != CAIRO_STATUS_SUCCESS)
+    g_printerr ("%s: %s\n", output, cairo_status_to_string (status));
+  g_free (output);
+
+  return status == CAIRO_STATUS_SUCCESS;
+}
+
+
+static gboolean
+gromit_render_file (const gchar *path, GromitRenderSettings *settings)
+{
+  GromitCanvas     canvas;
+  GError          *error = NULL;
+  gchar           *contents;
+  gsize            len;
+  gboolean         ok;
+
+  if (!g_file_get_contents (path, &contents, &len, &error))
+    {
+      g_printerr ("%s\n", error->message);
+      g_error_free (error);
+      return FALSE;
+    }
+
+  memset (&canvas, 0, sizeof (GromitCanvas));
+  canvas.path = path;
+  canvas.width = settings->width;
+  canvas.height = settings->height;
+  canvas.pixel = gromit_canvas_pixel (0xffff, 0, 0);
+  canvas.size = 7;
+  canvas.opacity = 1.0;
+  canvas.page = -1;
+
+  if (gromit_stream_is_recording ((guchar *) contents, len))
+    {
+      ok = gromit_stream_decode ((guchar *) contents, len,
+                                 &gromit_canvas_handler, &canvas);
+      if (!ok)
+        g_printerr ("%s: the recording is cut off or garbled\n", path);
+    }
+  else
+    ok = gromit_script_run (&canvas, contents);
+
+  g_free (contents);
+
+  if (ok)
+    ok = gromit_canvas_write (&canvas) && !canvas.failed;
+
+  if (canvas.raster)
+    {
+      gromit_raster_free (canvas.raster);
+      cairo_surface_destroy (canvas.surface);
+    }
+  if (canvas.layer)
+    gromit_raster_free (canvas.layer);
+  g_free (canvas.font);
+
+  return ok;
+}
+
+
+static void
+gromit_render_job (gpointer job, gpointer user_data)
+{
+  GromitRenderSettings *settings = user_data;
+
+  if (!gromit_render_file (job, settings))
+    g_atomic_int_inc (&settings->failed);
+}
+
+
+gint
+gromit_render_main (gint argc, gchar **argv)
+{
+  GromitRenderSettings  settings;
+  GThreadPool          *pool;
+  GError               *error = NULL;
+  gint                  jobs = g_get_num_processors ();
+  gint                  i;
+
+  settings.width = GROMIT_RENDER_DEFAULT_WIDTH;
+  settings.height = GROMIT_RENDER_DEFAULT_HEIGHT;
+  settings.failed = 0;
+
+  for (i = 0; i < argc && argv[i][0] == '-'; i++)
+    {
+      if (strcmp (argv[i], "--size") == 0 && i+1 < argc &&
+          sscanf (argv[i+1], "%dx%d", &settings.width, &settings.height) == 2 &&
+          settings.width > 0 && settings.height > 0)
+        {
+          i++;
+        }
+      else if (strcmp (argv[i], "--jobs") == 0 && i+1 < argc &&
+               atoi (argv[i+1]) > 0)
+        {
+          jobs = atoi (argv[i+1]);
+          i++;
+        }
+      else
+        {
+          g_printerr ("Unknown or incomplete option \"%s\"\n", argv[i]);
+          argc = 0;
+        }
+    }
+
+  if (i >= argc)
+    {
+      g_printerr ("Usage: gromit --render [--size <width>x<height>] "
+                  "[--jobs <n>] <script>...\n");
+      return 1;
+    }
+
+  pool = g_thread_pool_new (gromit_render_job, &settings, jobs, TRUE, &error);
+  if (!pool)
+    {
+      g_printerr ("Cannot start the render threads: %s\n", error->message);
+      g_error_free (error);
+      return 1;
+    }
+
+  for (; i < argc; i++)
+    g_thread_pool_push (pool, argv[i], NULL);
+
+  /* waits for the queued files */
+  g_thread_pool_free (pool, FALSE, TRUE);
+
+  return settings.failed ? 1 : 0;
+}
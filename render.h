@@ -0,0 +1,32 @@
+/* Gromit -- a program for painting on the screen
+ * Copyright (C) 2000 Simon Budig <Simon.Budig@unix-ag.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+
+#ifndef __GROMIT_RENDER_H__
+#define __GROMIT_RENDER_H__
+
+#include <glib.h>
+
+/*
+ * "gromit --render": draws stroke scripts into PNG files, without an X
+ * display. The arguments are the ones following "--render".
+ */
+
+gint gromit_render_main (gint argc, gchar **argv);
+
+#endif /* __GROMIT_RENDER_H__ */
@@ -0,0 +1,346 @@
+/* Gromit -- a program for painting on the screen
+ * Copyright (C) 2000 Simon Budig <Simon.Budig@unix-ag.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#define _GNU_SOURCE /* for fallocate () */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "session.h"
+
+/* the first bytes of a session file, unlike those of a recording */
+#define GROMIT_SESSION_MAGIC "GRP1"
+
+/* the header and every page start on a boundary of this */
+#define GROMIT_SESSION_ALIGN 4096
+
+typedef struct
+{
+  gchar   magic[4];
+  guint32 width;
+  guint32 height;
+  guint32 format[4];
+  guint32 n_pages;
+  guint32 cur_page;
+} GromitSessionHeader;
+
+/*
+ * A page is its flag, padded to GROMIT_SESSION_ALIGN, followed by the
+ * pixels and then the coverage, both without padding between the rows.
+ */
+typedef struct
+{
+  guint32 stored;
+} GromitSessionPage;
+
+struct _GromitSession
+{
+  gint     fd;
+  guchar  *map;
+  gsize    size;
+  gsize    page_size;
+  gint     width;
+  gint     height;
+  guint    n_pages;
+};
+
+
+static GromitSessionHeader *
+gromit_session_header (GromitSession *session)
+{
+  return (GromitSessionHeader *) session->map;
+}
+
+
+static GromitSessionPage *
+gromit_session_page (GromitSession *session, guint page)
+{
+  return (GromitSessionPage *) (session->map + GROMIT_SESSION_ALIGN +
+                                page * session->page_size);
+}
+
+
+static guint32 *
+gromit_session_pixels (GromitSession *session, guint page)
+{
+  return (guint32 *) ((guchar *) gromit_session_page (session, page) +
+                      GROMIT_SESSION_ALIGN);
+}
+
+
+static guchar *
+gromit_session_coverage (GromitSession *session, guint page)
+{
+  return (guchar *) (gromit_session_pixels (session, page) +
+                     session->width * session->height);
+}
+
+
+GromitSession *
+gromit_session_open (const gchar *filename, gint width, gint height,
+                     const guint32 *format, guint n_pages)
+{
+  gint fd;
+
+  fd = open (filename, O_RDWR | O_CREAT, 0600);
+  if (fd < 0)
+    {
+      g_printerr ("Unable to open %s: %s\n", filename, g_strerror (errno));
+      return NULL;
+    }
+
+  return gromit_session_open_fd (fd, filename, width, height,
+                                 format, n_pages);
+}
+
+
+/* takes over fd, which is open for reading and writing */
+GromitSession *
+gromit_session_open_fd (gint fd, const gchar *filename,
+                        gint width, gint height,
+                        const guint32 *format, guint n_pages)
+{
+  GromitSession       *session;
+  GromitSessionHeader *header, old;
+  struct stat          st;
+  gboolean             fresh = TRUE;
+
+  if (fstat (fd, &st) < 0)
+    {
+      g_printerr ("Unable to open %s: %s\n", filename, g_strerror (errno));
+      close (fd);
+      return NULL;
+    }
+
+  /* only an empty file or a session file may be overwritten */
+  if (st.st_size > 0 &&
+      (st.st_size < sizeof (old) ||
+       pread (fd, &old, sizeof (old), 0) != sizeof (old) ||
+       memcmp (old.magic, GROMIT_SESSION_MAGIC, 4) != 0))
+    {
+      g_printerr ("%s is not a Gromit session file, leaving it alone\n",
+                  filename);
+      close (fd);
+      return NULL;
+    }
+
+  /* a file for another screen or pixel format is of no use */
+  if (st.st_size > 0)
+    {
+      fresh = old.width != width || old.height != height ||
+              memcmp (old.format, format, sizeof (old.format)) != 0;
+      if (fresh)
+        g_printerr ("%s does not fit this screen, starting over\n",
+                    filename);
+    }
+
+  session = g_new0 (GromitSession, 1);
+  session->fd = fd;
+  session->width = width;
+  session->height = height;
+  session->n_pages = n_pages;
+  session->page_size = (GROMIT_SESSION_ALIGN + (gsize) width * height * 5 +
+                        GROMIT_SESSION_ALIGN - 1) & ~(GROMIT_SESSION_ALIGN - 1);
+  session->size = GROMIT_SESSION_ALIGN + n_pages * session->page_size;
+
+  /* pages the file did not hold come in zeroed, i.e. not stored */
+  if ((fresh && ftruncate (fd, 0) < 0) || ftruncate (fd, session->size) < 0)
+    {
+      g_printerr ("Unable to resize %s: %s\n", filename, g_strerror (errno));
+      close (fd);
+      g_free (session);
+      return NULL;
+    }
+
+  session->map = mmap (NULL, session->size, PROT_READ | PROT_WRITE,
+                       MAP_SHARED, fd, 0);
+  if (session->map == MAP_FAILED)
+    {
+      g_printerr ("Unable to map %s: %s\n", filename, g_strerror (errno));
+      close (fd);
+      g_free (session);
+      return NULL;
+    }
+
+  header = gromit_session_header (session);
+  if (fresh)
+    {
+      memcpy (header->magic, GROMIT_SESSION_MAGIC, 4);
+      header->width = width;
+      header->height = height;
+      memcpy (header->format, format, sizeof (header->format));
+      header->cur_page = 0;
+    }
+  header->n_pages = n_pages;
+
+  return session;
+}
+
+
+void
+gromit_session_free (GromitSession *session)
+{
+  munmap (session->map, session->size);
+  close (session->fd);
+  g_free (session);
+}
+
+
+guint
+gromit_session_cur_page (GromitSession *session)
+{
+  return MIN (gromit_session_header (session)->cur_page,
+              session->n_pages - 1);
+}
+
+
+void
+gromit_session_set_cur_page (GromitSession *session, guint page)
+{
+  gromit_session_header (session)->cur_page = page;
+}
+
+
+gboolean
+gromit_session_stored (GromitSession *session, guint page)
+{
+  return page < session->n_pages &&
+         gromit_session_page (session, page)->stored;
+}
+
+
+/* copies a stored page into raster, FALSE if there is none */
+gboolean
+gromit_session_restore (GromitSession *session, guint page,
+                        GromitRaster *raster)
+{
+  const guint32 *pixels;
+  gint           y;
+
+  if (!gromit_session_stored (session, page))
+    return FALSE;
+
+  pixels = gromit_session_pixels (session, page);
+  for (y = 0; y < session->height; y++)
+    memcpy (raster->pixels + y * raster->stride,
+            pixels + y * session->width, session->width * 4);
+  memcpy (raster->coverage, gromit_session_coverage (session, page),
+          session->width * session->height);
+
+  return TRUE;
+}
+
+
+/*
+ * Starts storing page from scratch, it is not stored until it is done.
+ * Pixels without coverage never show, so only the coverage has to be
+ * cleared. Where the file system can, the old page is dropped instead.
+ */
+void
+gromit_session_begin (GromitSession *session, guint page)
+{
+  if (page >= session->n_pages)
+    return;
+
+  gromit_session_page (session, page)->stored = FALSE;
+
+#ifdef FALLOC_FL_PUNCH_HOLE
+  if (fallocate (session->fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+                 (guchar *) gromit_session_pixels (session, page) -
+                 session->map,
+                 session->page_size - GROMIT_SESSION_ALIGN) == 0)
+    return;
+#endif
+
+  memset (gromit_session_coverage (session, page), 0,
+          session->width * session->height);
+}
+
+
+void
+gromit_session_store (GromitSession *session, guint page,
+                      const GromitRaster *raster, const GdkRectangle *rect)
+{
+  GdkRectangle all = { 0, 0, session->width, session->height };
+  GdkRectangle area;
+  guint32     *pixels;
+  guchar      *coverage;
+  gint         y;
+
+  if (page >= session->n_pages || !gdk_rectangle_intersect (rect, &all, &area))
+    return;
+
+  pixels = gromit_session_pixels (session, page);
+  coverage = gromit_session_coverage (session, page);
+
+  for (y = area.y; y < area.y + area.height; y++)
+    {
+      memcpy (pixels + y * session->width + area.x,
+              raster->pixels + y * raster->stride + area.x, area.width * 4);
+      memcpy (coverage + y * session->width + area.x,
+              raster->coverage + y * raster->width + area.x, area.width);
+    }
+}
+
+
+void
+gromit_session_done (GromitSession *session, guint page)
+{
+  if (page < session->n_pages)
+    gromit_session_page (session, page)->stored = TRUE;
+}
+
+
+void
+gromit_session_forget (GromitSession *session, guint page)
+{
+  if (page < session->n_pages)
+    gromit_session_page (session, page)->stored = FALSE;
+}
+
+
+/*
+ * Copies a stored page into a session for another screen size, as far
+ * as it fits. What is new to the page stays unpainted.
+ */
+void
+gromit_session_migrate (GromitSession *from, GromitSession *to, guint page)
+{
+  gint width = MIN (from->width, to->width);
+  gint height = MIN (from->height, to->height);
+  gint y;
+
+  if (page >= to->n_pages || !gromit_session_stored (from, page))
+    return;
+
+  gromit_session_begin (to, page);
+  for (y = 0; y < height; y++)
+    {
+      memcpy (gromit_session_pixels (to, page) + y * to->width,
+              gromit_session_pixels (from, page) + y * from->width,
+              width * 4);
+      memcpy (gromit_session_coverage (to, page) + y * to->width,
+              gromit_session_coverage (from, page) + y * from->width,
+              width);
+    }
+  gromit_session_done (to, page);
+}
@@ -0,0 +1,68 @@
+/* Gromit -- a program for painting on the screen
+ * Copyright (C) 2000 Simon Budig <Simon.Budig@unix-ag.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __GROMIT_SESSION_H__
+#define __GROMIT_SESSION_H__
+
+#include <glib.h>
+#include <gdk/gdk.h>
+
+#include "raster.h"
+
+/*
+ * Sessions: the client side rasters of all pages in a memory mapped
+ * file. Everything that gets uploaded to the X server is copied into
+ * the mapping as well, the kernel writes it back whenever it likes. A
+ * Gromit started on the same screen takes the pages from the file
+ * instead of redrawing them from their strokes.
+ *
+ * A page only counts as stored once its raster has been complete, a
+ * page that was still being redrawn when Gromit went away is lost.
+ */
+
+typedef struct _GromitSession GromitSession;
+
+/* format tells the pixel formats apart, e.g. the visual's masks */
+GromitSession *gromit_session_open     (const gchar *filename,
+                                        gint width, gint height,
+                                        const guint32 *format,
+                                        guint n_pages);
+GromitSession *gromit_session_open_fd  (gint fd, const gchar *filename,
+                                        gint width, gint height,
+                                        const guint32 *format,
+                                        guint n_pages);
+void           gromit_session_free     (GromitSession *session);
+
+guint          gromit_session_cur_page (GromitSession *session);
+void           gromit_session_set_cur_page (GromitSession *session,
+                                            guint page);
+
+gboolean       gromit_session_stored   (GromitSession *session, guint page);
+gboolean       gromit_session_restore  (GromitSession *session, guint page,
+                                        GromitRaster *raster);
+
+void           gromit_session_begin    (GromitSession *session, guint page);
+void           gromit_session_store    (GromitSession *session, guint page,
+                                        const GromitRaster *raster,
+                                        const GdkRectangle *rect);
+void           gromit_session_done     (GromitSession *session, guint page);
+void           gromit_session_migrate  (GromitSession *from,
+                                        GromitSession *to, guint page);
+void           gromit_session_forget   (GromitSession *session, guint page);
+
+#endif /* __GROMIT_SESSION_H__ */
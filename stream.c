@@ -0,0 +1,861 @@
+/* Gromit -- a program for painting on the screen
+ * Copyright (C) 2000 Simon Budig <Simon.Budig@unix-ag.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "stream.h"
+#include "varint.h"
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+/* sent first, so that a mirror notices talking to something else */
+#define GROMIT_STREAM_MAGIC        "GRS1"
+
+/* a mirror that falls further behind than this gets dropped */
+#define GROMIT_STREAM_MAX_BACKLOG  (1 << 20)
+
+/* far more than the longest packet, a mirror never buffers more */
+#define GROMIT_STREAM_MAX_INPUT    (1 << 16)
+
+#define GROMIT_STREAM_RETRY        1    /* seconds */
+
+/* what comes off the wire gets clamped to this, X coordinates are 16 bit */
+#define GROMIT_STREAM_MAX_COORD    32767
+#define GROMIT_STREAM_MAX_WIDTH    1000
+
+typedef enum
+{
+  GROMIT_PACKET_CLEAR   = 'X',
+  GROMIT_PACKET_PAGE    = 'G',
+  GROMIT_PACKET_STROKE  = 'S',
+  GROMIT_PACKET_MOVE    = 'M',    /* a segment starting somewhere else */
+  GROMIT_PACKET_LINE    = 'L',    /* a segment continuing the last one */
+  GROMIT_PACKET_ARROW   = 'A',
+  GROMIT_PACKET_TEXT    = 'T'
+} GromitPacketType;
+
+/* the delta coding state, the same on both ends of a connection */
+typedef struct
+{
+  gint  x;
+  gint  y;
+  gint  width;
+} GromitStreamPen;
+
+typedef struct
+{
+  GromitStream    *stream;
+  gint             fd;
+  guint            watch;
+  guint            out_watch;
+  GString         *out;
+  GromitStreamPen  pen;
+} GromitSubscriber;
+
+struct _GromitStream
+{
+  gchar               *path;
+  gint                 fd;
+  guint                watch;
+
+  /* publisher */
+  GList               *subscribers;
+  GromitSubscriber    *target;
+  GromitSubscribeFunc  subscribe;
+
+  /* mirror */
+  GromitStreamHandler  handler;
+  GString             *in;
+  gboolean             connected;
+  guint                retry_id;
+  GromitStreamPen      pen;
+
+  gpointer             user_data;
+};
+
+
+/*
+ * Publisher
+ */
+
+static gboolean gromit_subscriber_write (GIOChannel *source,
+                                         GIOCondition condition,
+                                         gpointer user_data);
+
+static void
+gromit_subscriber_free (GromitSubscriber *sub)
+{
+  GromitStream *stream = sub->stream;
+
+  stream->subscribers = g_list_remove (stream->subscribers, sub);
+
+  if (sub->watch)
+    g_source_remove (sub->watch);
+  if (sub->out_watch)
+    g_source_remove (sub->out_watch);
+  close (sub->fd);
+  g_string_free (sub->out, TRUE);
+  g_free (sub);
+}
+
+
+/* FALSE if the subscriber is gone */
+static gboolean
+gromit_subscriber_flush (GromitSubscriber *sub)
+{
+  GIOChannel *channel;
+  gssize      written;
+
+  while (sub->out->len)
+    {
+      written = send (sub->fd, sub->out->str, sub->out->len, MSG_NOSIGNAL);
+      if (written < 0)
+        {
+          if (errno == EINTR)
+            continue;
+          if (errno == EAGAIN || errno == EWOULDBLOCK)
+            break;
+
+          gromit_subscriber_free (sub);
+          return FALSE;
+        }
+      g_string_erase (sub->out, 0, written);
+    }
+
+  if (sub->out->len > GROMIT_STREAM_MAX_BACKLOG)
+    {
+      g_printerr ("A mirror does not keep up, disconnecting it\n");
+      gromit_subscriber_free (sub);
+      return FALSE;
+    }
+
+  if (sub->out->len && !sub->out_watch)
+    {
+      channel = g_io_channel_unix_new (sub->fd);
+      sub->out_watch = g_io_add_watch (channel, G_IO_OUT,
+                                       gromit_subscriber_write, sub);
+      g_io_channel_unref (channel);
+    }
+
+  return TRUE;
+}
+
+
+static gboolean
+gromit_subscriber_write (GIOChannel *source, GIOCondition condition,
+                         gpointer user_data)
+{
+  GromitSubscriber *sub = user_data;
+
+  if (!gromit_subscriber_flush (sub))
+    return FALSE;
+
+  if (sub->out->len)
+    return TRUE;
+
+  sub->out_watch = 0;
+  return FALSE;
+}
+
+
+/* mirrors never talk, anything readable means they hung up */
+static gboolean
+gromit_subscriber_read (GIOChannel *source, GIOCondition condition,
+                        gpointer user_data)
+{
+  GromitSubscriber *sub = user_data;
+  gchar             buf[256];
+
+  if (condition & G_IO_IN && read (sub->fd, buf, sizeof (buf)) > 0)
+    return TRUE;
+
+  sub->watch = 0;
+  gromit_subscriber_free (sub);
+  return FALSE;
+}
+
+
+static gboolean
+gromit_stream_accept (GIOChannel *source, GIOCondition condition,
+                      gpointer user_data)
+{
+  GromitStream     *stream = user_data;
+  GromitSubscriber *sub;
+  GIOChannel       *channel;
+  gint              fd;
+
+  fd = accept (stream->fd, NULL, NULL);
+  if (fd < 0)
+    return TRUE;
+
+  fcntl (fd, F_SETFL, fcntl (fd, F_GETFL) | O_NONBLOCK);
+
+  sub = g_new0 (GromitSubscriber, 1);
+  sub->stream = stream;
+  sub->fd = fd;
+  sub->out = g_string_new (GROMIT_STREAM_MAGIC);
+
+  channel = g_io_channel_unix_new (fd);
+  sub->watch = g_io_add_watch (channel, G_IO_IN | G_IO_HUP | G_IO_ERR,
+                               gromit_subscriber_read, sub);
+  g_io_channel_unref (channel);
+
+  stream->subscribers = g_list_prepend (stream->subscribers, sub);
+
+  /* bring the new mirror up to date */
+  stream->target = sub;
+  if (stream->subscribe)
+    stream->subscribe (stream, stream->user_data);
+  stream->target = NULL;
+
+  gromit_subscriber_flush (sub);
+
+  return TRUE;
+}
+
+
+static gint
+gromit_stream_socket (const gchar *path, struct sockaddr_un *addr)
+{
+  if (strlen (path) >= sizeof (addr->sun_path))
+    {
+      g_printerr ("Socket path too long: %s\n", path);
+      return -1;
+    }
+
+  memset (addr, 0, sizeof (struct sockaddr_un));
+  addr->sun_family = AF_UNIX;
+  strcpy (addr->sun_path, path);
+
+  return socket (AF_UNIX, SOCK_STREAM, 0);
+}
+
+
+/*
+ * Removes a socket left over by a Gromit that did not exit cleanly.
+ * Anything else at path, or a socket somebody still listens on, is not
+ * ours to remove.
+ */
+static gboolean
+gromit_stream_clear_path (const gchar *path, struct sockaddr_un *addr)
+{
+  struct stat st;
+  gint        probe;
+  gboolean    alive;
+
+  if (lstat (path, &st) < 0)
+    {
+      if (errno == ENOENT)
+        return TRUE;
+      g_printerr ("Cannot publish on %s: %s\n", path, g_strerror (errno));
+      return FALSE;
+    }
+
+  if (!S_ISSOCK (st.st_mode))
+    {
+      g_printerr ("%s exists and is not a socket, not publishing there\n",
+                  path);
+      return FALSE;
+    }
+
+  probe = socket (AF_UNIX, SOCK_STREAM, 0);
+  alive = probe >= 0 &&
+          connect (probe, (struct sockaddr *) addr, sizeof (*addr)) == 0;
+  if (probe >= 0)
+    close (probe);
+
+  if (alive)
+    {
+      g_printerr ("%s is in use already\n", path);
+      return FALSE;
+    }
+
+  unlink (path);
+  return TRUE;
+}
+
+
+GromitStream *
+gromit_stream_publish (const gchar *path,
+                       GromitSubscribeFunc subscribe,
+                       gpointer user_data)
+{
+  GromitStream       *stream;
+  GIOChannel         *channel;
+  struct sockaddr_un  addr;
+  gint                fd;
+
+  fd = gromit_stream_socket (path, &addr);
+  if (fd < 0)
+    return NULL;
+
+  if (!gromit_stream_clear_path (path, &addr))
+    {
+      close (fd);
+      return NULL;
+    }
+
+  if (bind (fd, (struct sockaddr *) &addr, sizeof (addr)) < 0 ||
+      listen (fd, 4) < 0)
+    {
+      g_printerr ("Cannot listen on %s: %s\n", path, g_strerror (errno));
+      close (fd);
+      return NULL;
+    }
+
+  stream = g_new0 (GromitStream, 1);
+  stream->path = g_strdup (path);
+  stream->fd = fd;
+  stream->subscribe = subscribe;
+  stream->user_data = user_data;
+
+  channel = g_io_channel_unix_new (fd);
+  stream->watch = g_io_add_watch (channel, G_IO_IN,
+                                  gromit_stream_accept, stream);
+  g_io_channel_unref (channel);
+
+  return stream;
+}
+
+
+/*
+ * Mirror
+ */
+
+static gboolean gromit_stream_connect (gpointer user_data);
+
+static void
+gromit_stream_disconnect (GromitStream *stream)
+{
+  if (stream->watch)
+    g_source_remove (stream->watch);
+  stream->watch = 0;
+
+  if (stream->fd >= 0)
+    close (stream->fd);
+  stream->fd = -1;
+
+  stream->connected = FALSE;
+  g_string_truncate (stream->in, 0);
+}
+
+
+static gint
+gromit_stream_coord (gint64 value)
+{
+  return CLAMP (value, -GROMIT_STREAM_MAX_COORD, GROMIT_STREAM_MAX_COORD);
+}
+
+
+static gint
+gromit_stream_width (gint64 value)
+{
+  return CLAMP (value, 0, GROMIT_STREAM_MAX_WIDTH);
+}
+
+
+/*
+ * The length of the packet at p, 0 if it is not complete yet, -1 if it
+ * makes no sense.
+ */
+static gsize
+gromit_stream_packet (const GromitStreamHandler *handler,
+                      GromitStreamPen *pen, gpointer user_data,
+                      const guchar *p, const guchar *end)
+{
+  const guchar     *start = p;
+  GromitStreamTool  tool;
+  gint              x1, y1, dx, dy, width;
+  guint             u[7];
+  gchar            *string;
+  gint              ok;
+
+  switch (*p++)
+    {
+      case GROMIT_PACKET_CLEAR:
+        handler->clear (user_data);
+        break;
+
+      case GROMIT_PACKET_PAGE:
+        if ((ok = gromit_read_uint (&p, end, &u[0])) <= 0)
+          return ok < 0 ? (gsize) -1 : 0;
+        handler->page (u[0], user_data);
+        break;
+
+      case GROMIT_PACKET_STROKE:
+        if ((ok = gromit_read_uint (&p, end, &u[0])) <= 0 ||
+            (ok = gromit_read_uint (&p, end, &u[1])) <= 0 ||
+            (ok = gromit_read_uint (&p, end, &u[2])) <= 0 ||
+            (ok = gromit_read_uint (&p, end, &u[3])) <= 0 ||
+            (ok = gromit_read_uint (&p, end, &u[4])) <= 0 ||
+            (ok = gromit_read_uint (&p, end, &u[5])) <= 0 ||
+            (ok = gromit_read_uint (&p, end, &u[6])) <= 0 ||
+            (ok = gromit_read_string (&p, end, &string)) <= 0)
+          return ok < 0 ? (gsize) -1 : 0;
+
+        tool.type = u[0];
+        tool.red = u[1];
+        tool.green = u[2];
+        tool.blue = u[3];
+        tool.width = gromit_stream_width (u[4]);
+        tool.arrowsize = u[5] / 1000.0;
+        tool.opacity = u[6] / 1000.0;
+        tool.font = *string ? string : NULL;
+        handler->stroke (&tool, user_data);
+        g_free (string);
+        break;
+
+      case GROMIT_PACKET_MOVE:
+        if ((ok = gromit_read_int (&p, end, &x1)) <= 0 ||
+            (ok = gromit_read_int (&p, end, &y1)) <= 0 ||
+            (ok = gromit_read_int (&p, end, &dx)) <= 0 ||
+            (ok = gromit_read_int (&p, end, &dy)) <= 0 ||
+            (ok = gromit_read_uint (&p, end, &u[0])) <= 0)
+          return ok < 0 ? (gsize) -1 : 0;
+
+        x1 = gromit_stream_coord (x1);
+        y1 = gromit_stream_coord (y1);
+        pen->x = gromit_stream_coord ((gint64) x1 + dx);
+        pen->y = gromit_stream_coord ((gint64) y1 + dy);
+        pen->width = gromit_stream_width (u[0]);
+        handler->segment (x1, y1, pen->x, pen->y, pen->width,
+                          user_data);
+        break;
+
+      case GROMIT_PACKET_LINE:
+        if ((ok = gromit_read_int (&p, end, &dx)) <= 0 ||
+            (ok = gromit_read_int (&p, end, &dy)) <= 0 ||
+            (ok = gromit_read_int (&p, end, &width)) <= 0)
+          return ok < 0 ? (gsize) -1 : 0;
+
+        x1 = pen->x;
+        y1 = pen->y;
+        pen->x = gromit_stream_coord ((gint64) pen->x + dx);
+        pen->y = gromit_stream_coord ((gint64) pen->y + dy);
+        pen->width = gromit_stream_width ((gint64) pen->width + width);
+        handler->segment (x1, y1, pen->x, pen->y, pen->width,
+                          user_data);
+        break;
+
+      case GROMIT_PACKET_ARROW:
+        if ((ok = gromit_read_int (&p, end, &x1)) <= 0 ||
+            (ok = gromit_read_int (&p, end, &y1)) <= 0 ||
+            (ok = gromit_read_uint (&p, end, &u[0])) <= 0 ||
+            (ok = gromit_read_int (&p, end, &dx)) <= 0)
+          return ok < 0 ? (gsize) -1 : 0;
+        handler->arrow (gromit_stream_coord (x1), gromit_stream_coord (y1),
+                        gromit_stream_width (u[0]), dx / 10000.0, user_data);
+        break;
+
+      case GROMIT_PACKET_TEXT:
+        if ((ok = gromit_read_int (&p, end, &x1)) <= 0 ||
+            (ok = gromit_read_int (&p, end, &y1)) <= 0 ||
+            (ok = gromit_read_string (&p, end, &string)) <= 0)
+          return ok < 0 ? (gsize) -1 : 0;
+        handler->text (gromit_stream_coord (x1), gromit_stream_coord (y1),
+                       string, user_data);
+        g_free (string);
+        break;
+
+      default:
+        return (gsize) -1;
+    }
+
+  return p - start;
+}
+
+
+static gboolean
+gromit_stream_read (GIOChannel *source, GIOCondition condition,
+                    gpointer user_data)
+{
+  GromitStream *stream = user_data;
+  guchar        buf[4096];
+  const guchar *p, *end;
+  gssize        len;
+  gsize         n;
+
+  len = read (stream->fd, buf, sizeof (buf));
+  if (len < 0 && (errno == EINTR || errno == EAGAIN))
+    return TRUE;
+
+  if (len <= 0)
+    {
+      g_printerr ("Lost the connection to %s\n", stream->path);
+      stream->watch = 0;
+      gromit_stream_disconnect (stream);
+      stream->retry_id = g_timeout_add_seconds (GROMIT_STREAM_RETRY,
+                                                gromit_stream_connect,
+                                                stream);
+      return FALSE;
+    }
+
+  g_string_append_len (stream->in, (gchar *) buf, len);
+
+  p = (const guchar *) stream->in->str;
+  end = p + stream->in->len;
+
+  if (!stream->connected)
+    {
+      if (end - p < strlen (GROMIT_STREAM_MAGIC))
+        return TRUE;
+
+      if (memcmp (p, GROMIT_STREAM_MAGIC, strlen (GROMIT_STREAM_MAGIC)))
+        {
+          g_printerr ("%s does not talk the Gromit stream protocol\n",
+                      stream->path);
+          stream->watch = 0;
+          gromit_stream_disconnect (stream);
+          return FALSE;
+        }
+
+      p += strlen (GROMIT_STREAM_MAGIC);
+      stream->connected = TRUE;
+    }
+
+  while (p < end)
+    {
+      n = gromit_stream_packet (&stream->handler, &stream->pen,
+                                stream->user_data, p, end);
+      if (n == 0)
+        break;
+      if (n == (gsize) -1)
+        {
+          g_printerr ("Garbled stream from %s\n", stream->path);
+          stream->watch = 0;
+          gromit_stream_disconnect (stream);
+          return FALSE;
+        }
+      p += n;
+    }
+
+  g_string_erase (stream->in, 0, p - (const guchar *) stream->in->str);
+
+  if (stream->in->len > GROMIT_STREAM_MAX_INPUT)
+    {
+      g_printerr ("Garbled stream from %s\n", stream->path);
+      stream->watch = 0;
+      gromit_stream_disconnect (stream);
+      return FALSE;
+    }
+
+  return TRUE;
+}
+
+
+static gboolean
+gromit_stream_connect (gpointer user_data)
+{
+  GromitStream       *stream = user_data;
+  GIOChannel         *channel;
+  struct sockaddr_un  addr;
+
+  stream->retry_id = 0;
+
+  stream->fd = gromit_stream_socket (stream->path, &addr);
+  if (stream->fd < 0)
+    return FALSE;
+
+  if (connect (stream->fd, (struct sockaddr *) &addr, sizeof (addr)) < 0)
+    {
+      gromit_stream_disconnect (stream);
+      stream->retry_id = g_timeout_add_seconds (GROMIT_STREAM_RETRY,
+                                                gromit_stream_connect,
+                                                stream);
+      return FALSE;
+    }
+
+  memset (&stream->pen, 0, sizeof (GromitStreamPen));
+
+  channel = g_io_channel_unix_new (stream->fd);
+  stream->watch = g_io_add_watch (channel, G_IO_IN | G_IO_HUP | G_IO_ERR,
+                                  gromit_stream_read, stream);
+  g_io_channel_unref (channel);
+
+  return FALSE;
+}
+
+
+/* plays back a recorded stream, FALSE if it is cut off or garbled */
+gboolean
+gromit_stream_decode (const guchar *buf, gsize len,
+                      const GromitStreamHandler *handler,
+                      gpointer user_data)
+{
+  GromitStreamPen  pen = { 0, 0, 0 };
+  const guchar    *p = buf, *end = buf + len;
+  gsize            n;
+
+  if (len < strlen (GROMIT_STREAM_MAGIC) ||
+      memcmp (p, GROMIT_STREAM_MAGIC, strlen (GROMIT_STREAM_MAGIC)))
+    return FALSE;
+
+  p += strlen (GROMIT_STREAM_MAGIC);
+  while (p < end)
+    {
+      n = gromit_stream_packet (handler, &pen, user_data, p, end);
+      if (n == 0 || n == (gsize) -1)
+        return FALSE;
+      p += n;
+    }
+
+  return TRUE;
+}
+
+
+gboolean
+gromit_stream_is_recording (const guchar *buf, gsize len)
+{
+  return (len >= strlen (GROMIT_STREAM_MAGIC) &&
+          !memcmp (buf, GROMIT_STREAM_MAGIC, strlen (GROMIT_STREAM_MAGIC)));
+}
+
+
+GromitStream *
+gromit_stream_mirror (const gchar *path,
+                      const GromitStreamHandler *handler,
+                      gpointer user_data)
+{
+  GromitStream *stream;
+
+  stream = g_new0 (GromitStream, 1);
+  stream->path = g_strdup (path);
+  stream->fd = -1;
+  stream->handler = *handler;
+  stream->in = g_string_new (NULL);
+  stream->user_data = user_data;
+
+  /* the publisher may come up later, keep trying */
+  gromit_stream_connect (stream);
+
+  return stream;
+}
+
+
+void
+gromit_stream_free (GromitStream *stream)
+{
+  if (stream->in)
+    {
+      if (stream->retry_id)
+        g_source_remove (stream->retry_id);
+      gromit_stream_disconnect (stream);
+      g_string_free (stream->in, TRUE);
+    }
+  else
+    {
+      while (stream->subscribers)
+        gromit_subscriber_free (stream->subscribers->data);
+      g_source_remove (stream->watch);
+      close (stream->fd);
+      unlink (stream->path);
+    }
+
+  g_free (stream->path);
+  g_free (stream);
+}
+
+
+/*
+ * Sending. Every packet gets encoded for each mirror separately, since
+ * each one has its own delta coding state.
+ */
+
+typedef void (*GromitEncodeFunc) (GString *out, GromitStreamPen *pen,
+                                  gconstpointer packet);
+
+static void
+gromit_stream_send (GromitStream *stream, GromitEncodeFunc encode,
+                    gconstpointer packet)
+{
+  GromitSubscriber *sub;
+  GList            *ptr, *next;
+
+  if (stream->target)
+    {
+      encode (stream->target->out, &stream->target->pen, packet);
+      return;
+    }
+
+  for (ptr = stream->subscribers; ptr; ptr = next)
+    {
+      next = ptr->next;
+      sub = ptr->data;
+
+      encode (sub->out, &sub->pen, packet);
+      if (!sub->out_watch)
+        gromit_subscriber_flush (sub);
+    }
+}
+
+
+static void
+gromit_encode_clear (GString *out, GromitStreamPen *pen,
+                     gconstpointer packet)
+{
+  g_string_append_c (out, GROMIT_PACKET_CLEAR);
+}
+
+
+void
+gromit_stream_clear (GromitStream *stream)
+{
+  gromit_stream_send (stream, gromit_encode_clear, NULL);
+}
+
+
+static void
+gromit_encode_page (GString *out, GromitStreamPen *pen,
+                    gconstpointer packet)
+{
+  g_string_append_c (out, GROMIT_PACKET_PAGE);
+  gromit_put_uint (out, *(const guint *) packet);
+}
+
+
+void
+gromit_stream_page (GromitStream *stream, guint page)
+{
+  gromit_stream_send (stream, gromit_encode_page, &page);
+}
+
+
+static void
+gromit_encode_stroke (GString *out, GromitStreamPen *pen,
+                      gconstpointer packet)
+{
+  const GromitStreamTool *tool = packet;
+
+  g_string_append_c (out, GROMIT_PACKET_STROKE);
+  gromit_put_uint (out, tool->type);
+  gromit_put_uint (out, tool->red);
+  gromit_put_uint (out, tool->green);
+  gromit_put_uint (out, tool->blue);
+  gromit_put_uint (out, tool->width);
+  gromit_put_uint (out, MAX (tool->arrowsize, 0) * 1000 + 0.5);
+  gromit_put_uint (out, CLAMP (tool->opacity, 0, 1) * 1000 + 0.5);
+  gromit_put_string (out, tool->font);
+}
+
+
+void
+gromit_stream_stroke (GromitStream *stream, const GromitStreamTool *tool)
+{
+  gromit_stream_send (stream, gromit_encode_stroke, tool);
+}
+
+
+static void
+gromit_encode_segment (GString *out, GromitStreamPen *pen,
+                       gconstpointer packet)
+{
+  const gint *s = packet;
+
+  if (s[0] == pen->x && s[1] == pen->y)
+    {
+      g_string_append_c (out, GROMIT_PACKET_LINE);
+      gromit_put_int (out, s[2] - s[0]);
+      gromit_put_int (out, s[3] - s[1]);
+      gromit_put_int (out, s[4] - pen->width);
+    }
+  else
+    {
+      g_string_append_c (out, GROMIT_PACKET_MOVE);
+      gromit_put_int (out, s[0]);
+      gromit_put_int (out, s[1]);
+      gromit_put_int (out, s[2] - s[0]);
+      gromit_put_int (out, s[3] - s[1]);
+      gromit_put_uint (out, s[4]);
+    }
+
+  pen->x = s[2];
+  pen->y = s[3];
+  pen->width = s[4];
+}
+
+
+void
+gromit_stream_segment (GromitStream *stream,
+                       gint x1, gint y1, gint x2, gint y2, gint width)
+{
+  gint segment[5] = { x1, y1, x2, y2, width };
+
+  gromit_stream_send (stream, gromit_encode_segment, segment);
+}
+
+
+static void
+gromit_encode_arrow (GString *out, GromitStreamPen *pen,
+                     gconstpointer packet)
+{
+  const gdouble *a = packet;
+
+  g_string_append_c (out, GROMIT_PACKET_ARROW);
+  gromit_put_int (out, a[0]);
+  gromit_put_int (out, a[1]);
+  gromit_put_uint (out, a[2]);
+  gromit_put_int (out, a[3] * 10000);
+}
+
+
+void
+gromit_stream_arrow (GromitStream *stream, gint x, gint y, gint width,
+                     gfloat direction)
+{
+  gdouble arrow[4] = { x, y, width, direction };
+
+  gromit_stream_send (stream, gromit_encode_arrow, arrow);
+}
+
+
+typedef struct
+{
+  gint         x;
+  gint         y;
+  const gchar *text;
+} GromitTextPacket;
+
+static void
+gromit_encode_text (GString *out, GromitStreamPen *pen,
+                    gconstpointer packet)
+{
+  const GromitTextPacket *t = packet;
+
+  g_string_append_c (out, GROMIT_PACKET_TEXT);
+  gromit_put_int (out, t->x);
+  gromit_put_int (out, t->y);
+  gromit_put_string (out, t->text);
+}
+
+
+void
+gromit_stream_text (GromitStream *stream, gint x, gint y, const gchar *text)
+{
+  GromitTextPacket packet = { x, y, text };
+
+  gromit_stream_send (stream, gromit_encode_text, &packet);
+}
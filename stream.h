@@ -0,0 +1,93 @@
+/* Gromit -- a program for painting on the screen
+ * Copyright (C) 2000 Simon Budig <Simon.Budig@unix-ag.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+
+#ifndef __GROMIT_STREAM_H__
+#define __GROMIT_STREAM_H__
+
+#include <glib.h>
+
+/*
+ * Streams the strokes of one Gromit to others over a Unix socket. The
+ * publisher sends every segment as it gets drawn, mirrors feed them to
+ * their own drawing code. Coordinates are sent as variable length
+ * deltas, a segment continuing the previous one takes 4 bytes or less.
+ */
+
+typedef struct
+{
+  gint          type;           /* GromitPaintType */
+  guint16       red;
+  guint16       green;
+  guint16       blue;
+  gint          width;
+  gfloat        arrowsize;
+  gfloat        opacity;
+  const gchar  *font;           /* NULL for the default */
+} GromitStreamTool;
+
+/* what a mirror does with the packets */
+typedef struct
+{
+  void (*clear)   (gpointer user_data);
+  void (*page)    (guint page, gpointer user_data);
+  void (*stroke)  (const GromitStreamTool *tool, gpointer user_data);
+  void (*segment) (gint x1, gint y1, gint x2, gint y2, gint width,
+                   gpointer user_data);
+  void (*arrow)   (gint x, gint y, gint width, gfloat direction,
+                   gpointer user_data);
+  void (*text)    (gint x, gint y, const gchar *text, gpointer user_data);
+} GromitStreamHandler;
+
+typedef struct _GromitStream GromitStream;
+
+/* called when a mirror connects, everything sent from it goes only
+ * to the new mirror
+ */
+typedef void (*GromitSubscribeFunc) (GromitStream *stream,
+                                     gpointer user_data);
+
+
+GromitStream *gromit_stream_publish  (const gchar *path,
+                                      GromitSubscribeFunc subscribe,
+                                      gpointer user_data);
+GromitStream *gromit_stream_mirror   (const gchar *path,
+                                      const GromitStreamHandler *handler,
+                                      gpointer user_data);
+void          gromit_stream_free     (GromitStream *stream);
+
+/* a stream recorded into a file, e.g. with socat */
+gboolean      gromit_stream_is_recording (const guchar *buf, gsize len);
+gboolean      gromit_stream_decode   (const guchar *buf, gsize len,
+                                      const GromitStreamHandler *handler,
+                                      gpointer user_data);
+
+void          gromit_stream_clear    (GromitStream *stream);
+void          gromit_stream_page     (GromitStream *stream, guint page);
+void          gromit_stream_stroke   (GromitStream *stream,
+                                      const GromitStreamTool *tool);
+void          gromit_stream_segment  (GromitStream *stream,
+                                      gint x1, gint y1, gint x2, gint y2,
+                                      gint width);
+void          gromit_stream_arrow    (GromitStream *stream,
+                                      gint x, gint y, gint width,
+                                      gfloat direction);
+void          gromit_stream_text     (GromitStream *stream,
+                                      gint x, gint y, const gchar *text);
+
+#endif /* __GROMIT_STREAM_H__ */
@@ -0,0 +1,237 @@
+/* Gromit -- a program for painting on the screen
+ * Copyright (C) 2000 Simon Budig <Simon.Budig@unix-ag.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include "stroke.h"
+#include "varint.h"
+
+#define GROMIT_STROKE_CHUNK_MIN  64
+#define GROMIT_STROKE_CHUNK_MAX  (16 * 1024)
+
+/* the room a point needs at most */
+#define GROMIT_STROKE_POINT_MAX  (3 * GROMIT_VARINT_MAX)
+
+struct _GromitStrokeChunk
+{
+  GromitStrokeChunk *next;
+  guint              size;
+  guint              used;
+  guchar             data[1];
+};
+
+
+GromitStroke *
+gromit_stroke_new (gpointer context)
+{
+  GromitStroke *stroke;
+
+  stroke = g_malloc (sizeof (GromitStroke));
+
+  stroke->context = context;
+  stroke->chunks = NULL;
+  stroke->last_chunk = NULL;
+  stroke->n_points = 0;
+  stroke->last_x = 0;
+  stroke->last_y = 0;
+  stroke->last_width = 0;
+  stroke->x1 = G_MAXINT;
+  stroke->y1 = G_MAXINT;
+  stroke->x2 = G_MININT;
+  stroke->y2 = G_MININT;
+  stroke->has_arrow = FALSE;
+  stroke->text = NULL;
+
+  return stroke;
+}
+
+
+void
+gromit_stroke_free (GromitStroke *stroke)
+{
+  GromitStrokeChunk *chunk, *next;
+
+  for (chunk = stroke->chunks; chunk; chunk = next)
+    {
+      next = chunk->next;
+      g_free (chunk);
+    }
+
+  if (stroke->text)
+    g_string_free (stroke->text, TRUE);
+  g_free (stroke);
+}
+
+
+static void
+gromit_stroke_extend (GromitStroke *stroke, gint x, gint y, gint margin)
+{
+  stroke->x1 = MIN (stroke->x1, x - margin);
+  stroke->y1 = MIN (stroke->y1, y - margin);
+  stroke->x2 = MAX (stroke->x2, x + margin);
+  stroke->y2 = MAX (stroke->y2, y + margin);
+}
+
+
+static void
+gromit_stroke_append (GromitStroke *stroke, gint x, gint y, gint width)
+{
+  GromitStrokeChunk *chunk = stroke->last_chunk;
+  guchar            *p;
+
+  if (!chunk || chunk->size - chunk->used < GROMIT_STROKE_POINT_MAX)
+    {
+      guint size = chunk ? MIN (chunk->size * 2, GROMIT_STROKE_CHUNK_MAX)
+                         : GROMIT_STROKE_CHUNK_MIN;
+
+      chunk = g_malloc (G_STRUCT_OFFSET (GromitStrokeChunk, data) + size);
+      chunk->next = NULL;
+      chunk->size = size;
+      chunk->used = 0;
+
+      if (stroke->last_chunk)
+        stroke->last_chunk->next = chunk;
+      else
+        stroke->chunks = chunk;
+      stroke->last_chunk = chunk;
+    }
+
+  p = chunk->data + chunk->used;
+  p = gromit_write_int (p, x - stroke->last_x);
+  p = gromit_write_int (p, y - stroke->last_y);
+  p = gromit_write_int (p, width - stroke->last_width);
+  chunk->used = p - chunk->data;
+
+  stroke->last_x = x;
+  stroke->last_y = y;
+  stroke->last_width = width;
+  stroke->n_points++;
+
+  gromit_stroke_extend (stroke, x, y, width > 0 ? width / 2 + 1 : 1);
+}
+
+
+void
+gromit_stroke_add_segment (GromitStroke *stroke,
+                           gint x1, gint y1, gint x2, gint y2, gint width)
+{
+  if (stroke->n_points == 0 ||
+      stroke->last_x != x1 || stroke->last_y != y1)
+    gromit_stroke_append (stroke, x1, y1, GROMIT_STROKE_MOVE);
+
+  gromit_stroke_append (stroke, x2, y2, width);
+}
+
+
+void
+gromit_stroke_set_arrow (GromitStroke *stroke,
+                         gint x, gint y, gint width, gfloat direction)
+{
+  stroke->has_arrow = TRUE;
+  stroke->arrow_x = x;
+  stroke->arrow_y = y;
+  stroke->arrow_width = width;
+  stroke->arrow_direction = direction;
+
+  gromit_stroke_extend (stroke, x, y, 3 * width + 1);
+}
+
+
+void
+gromit_stroke_iter_init (GromitStroke *stroke, GromitStrokeIter *iter)
+{
+  iter->chunk = stroke->chunks;
+  iter->offset = 0;
+  iter->n = 0;
+  iter->x = 0;
+  iter->y = 0;
+  iter->width = 0;
+}
+
+
+/*
+ * Returns the next segment of the stroke, FALSE when there is none left.
+ */
+
+gboolean
+gromit_stroke_iter_next (GromitStrokeIter *iter,
+                         gint *x1, gint *y1, gint *x2, gint *y2, gint *width)
+{
+  const guchar *p, *end;
+  gint          dx, dy, dwidth;
+
+  while (iter->chunk)
+    {
+      p = iter->chunk->data + iter->offset;
+      end = iter->chunk->data + iter->chunk->used;
+
+      while (p < end &&
+             gromit_get_int (&p, end, &dx) &&
+             gromit_get_int (&p, end, &dy) &&
+             gromit_get_int (&p, end, &dwidth))
+        {
+          gboolean segment;
+
+          iter->width += dwidth;
+          segment = iter->n++ > 0 && iter->width != GROMIT_STROKE_MOVE;
+
+          *x1 = iter->x;
+          *y1 = iter->y;
+          iter->x += dx;
+          iter->y += dy;
+
+          if (segment)
+            {
+              iter->offset = p - iter->chunk->data;
+              *x2 = iter->x;
+              *y2 = iter->y;
+              *width = iter->width;
+              return TRUE;
+            }
+        }
+
+      iter->chunk = iter->chunk->next;
+      iter->offset = 0;
+    }
+
+  return FALSE;
+}
+
+
+void
+gromit_stroke_foreach_segment (GromitStroke *stroke,
+                               GromitSegmentFunc func, gpointer user_data)
+{
+  GromitStrokeIter iter;
+  gint             x1, y1, x2, y2, width;
+
+  gromit_stroke_iter_init (stroke, &iter);
+
+  while (gromit_stroke_iter_next (&iter, &x1, &y1, &x2, &y2, &width))
+    func (x1, y1, x2, y2, width, user_data);
+}
+
+
+void
+gromit_stroke_list_free (GList *strokes)
+{
+  GList *ptr;
+
+  for (ptr = strokes; ptr; ptr = ptr->next)
+    gromit_stroke_free (ptr->data);
+
+  g_list_free (strokes);
+}
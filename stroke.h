@@ -0,0 +1,116 @@
+/* Gromit -- a program for painting on the screen
+ * Copyright (C) 2000 Simon Budig <Simon.Budig@unix-ag.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __GROMIT_STROKE_H__
+#define __GROMIT_STROKE_H__
+
+#include <glib.h>
+
+typedef enum
+{
+  GROMIT_PEN,
+  GROMIT_ERASER,
+  GROMIT_RECOLOR,
+  GROMIT_HIGHLIGHTER,
+  GROMIT_TEXT,
+  GROMIT_LINE,
+  GROMIT_RECT,
+  GROMIT_ELLIPSE
+} GromitPaintType;
+
+typedef struct
+{
+  gint x;
+  gint y;
+  gint width;
+} GromitStrokeCoordinate;
+
+/* a point with this width starts a new, unconnected part of the stroke */
+#define GROMIT_STROKE_MOVE (-1)
+
+/*
+ * The geometry of a stroke as it was drawn, kept so that the drawing
+ * can be reproduced without the pixmaps. The points are stored as
+ * variable length deltas to the previous point, in chunks that double
+ * in size up to 16k. A point continuing a line takes 3 or 4 bytes.
+ */
+
+typedef struct _GromitStrokeChunk GromitStrokeChunk;
+
+typedef struct
+{
+  gpointer  context;        /* the GromitPaintContext it was drawn with */
+  GromitStrokeChunk *chunks;
+  GromitStrokeChunk *last_chunk;
+  guint     n_points;
+  gint      last_x;         /* the last point, the base of the next delta */
+  gint      last_y;
+  gint      last_width;
+
+  gint      x1;             /* bounding box of the points and the arrow, */
+  gint      y1;             /* line width included. Empty while x1 > x2 */
+  gint      x2;
+  gint      y2;
+
+  gboolean  has_arrow;
+  gint      arrow_x;
+  gint      arrow_y;
+  gint      arrow_width;
+  gfloat    arrow_direction;
+
+  GString  *text;           /* a label of the TEXT tool instead of points */
+  gint      text_x;
+  gint      text_y;
+} GromitStroke;
+
+/* walks the segments of a stroke one at a time */
+typedef struct
+{
+  const GromitStrokeChunk *chunk;
+  guint                    offset;
+  guint                    n;
+  gint                     x;
+  gint                     y;
+  gint                     width;
+} GromitStrokeIter;
+
+typedef void (*GromitSegmentFunc) (gint x1, gint y1, gint x2, gint y2,
+                                   gint width, gpointer user_data);
+
+
+GromitStroke *gromit_stroke_new             (gpointer context);
+void          gromit_stroke_free            (GromitStroke *stroke);
+void          gromit_stroke_add_segment     (GromitStroke *stroke,
+                                             gint x1, gint y1,
+                                             gint x2, gint y2, gint width);
+void          gromit_stroke_set_arrow       (GromitStroke *stroke,
+                                             gint x, gint y, gint width,
+                                             gfloat direction);
+void          gromit_stroke_foreach_segment (GromitStroke *stroke,
+                                             GromitSegmentFunc func,
+                                             gpointer user_data);
+void          gromit_stroke_iter_init       (GromitStroke *stroke,
+                                             GromitStrokeIter *iter);
+gboolean      gromit_stroke_iter_next       (GromitStrokeIter *iter,
+                                             gint *x1, gint *y1,
+                                             gint *x2, gint *y2,
+                                             gint *width);
+
+void          gromit_stroke_list_free       (GList *strokes);
+
+#endif /* __GROMIT_STROKE_H__ */
@@ -0,0 +1,361 @@
+/* Gromit -- a program for painting on the screen
+ * Copyright (C) 2000 Simon Budig <Simon.Budig@unix-ag.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include "tiles.h"
+
+typedef enum
+{
+  GROMIT_TILE_PENDING,
+  GROMIT_TILE_RUNNING,
+  GROMIT_TILE_DONE
+} GromitTileState;
+
+typedef struct
+{
+  GromitTilePool *pool;
+  GMutex          mutex;
+  guint          *tiles;
+  guint           head;
+  guint           tail;
+} GromitTileDeque;
+
+struct _GromitTilePool
+{
+  GThread         **threads;
+  GromitTileDeque  *deques;        /* one per thread */
+  guint             n_deques;
+  guint             n_threads;     /* the ones that did start */
+
+  GMutex            mutex;         /* for the conditions below */
+  GCond             work_cond;     /* tiles got queued, or quit */
+  GCond             done_cond;     /* a tile is done or a thread idles */
+  gboolean          quit;
+  guint             busy;          /* threads taking from the deques */
+  volatile gint     queued;        /* tiles left in the deques */
+
+  GromitTileFunc    func;
+  gpointer          user_data;
+  volatile gint    *state;         /* GromitTileState, NULL without a run */
+  guint             n_tiles;
+
+  GAsyncQueue      *finished;      /* tile + 1 */
+  GSourceFunc       notify;
+  gpointer          notify_data;
+  volatile gint     notify_pending;
+};
+
+
+/* the own deque is worked from the front, the others from the back */
+static gboolean
+gromit_tile_take (GromitTilePool *pool, guint own, guint *tile)
+{
+  GromitTileDeque *deque;
+  guint            i;
+
+  for (i = 0; i < pool->n_threads; i++)
+    {
+      deque = &pool->deques[(own + i) % pool->n_threads];
+
+      g_mutex_lock (&deque->mutex);
+      if (deque->head < deque->tail)
+        {
+          *tile = i == 0 ? deque->tiles[deque->head++]
+                         : deque->tiles[--deque->tail];
+          g_mutex_unlock (&deque->mutex);
+          g_atomic_int_add (&pool->queued, -1);
+          return TRUE;
+        }
+      g_mutex_unlock (&deque->mutex);
+    }
+
+  return FALSE;
+}
+
+
+/* renders tile unless someone else does or did already */
+static void
+gromit_tile_render (GromitTilePool *pool, guint tile)
+{
+  if (!g_atomic_int_compare_and_exchange (&pool->state[tile],
+                                          GROMIT_TILE_PENDING,
+                                          GROMIT_TILE_RUNNING))
+    return;
+
+  pool->func (tile, pool->user_data);
+
+  g_mutex_lock (&pool->mutex);
+  g_atomic_int_set (&pool->state[tile], GROMIT_TILE_DONE);
+  g_cond_broadcast (&pool->done_cond);
+  g_mutex_unlock (&pool->mutex);
+
+  g_async_queue_push (pool->finished, GUINT_TO_POINTER (tile + 1));
+  if (g_atomic_int_compare_and_exchange (&pool->notify_pending, 0, 1))
+    g_idle_add (pool->notify, pool->notify_data);
+}
+
+
+static gpointer
+gromit_tile_thread (gpointer user_data)
+{
+  GromitTileDeque *deque = user_data;
+  GromitTilePool  *pool = deque->pool;
+  guint            own = deque - pool->deques;
+  guint            tile;
+
+  for (;;)
+    {
+      g_mutex_lock (&pool->mutex);
+      while (!pool->quit && g_atomic_int_get (&pool->queued) == 0)
+        g_cond_wait (&pool->work_cond, &pool->mutex);
+      if (pool->quit)
+        {
+          g_mutex_unlock (&pool->mutex);
+          return NULL;
+        }
+      pool->busy++;
+      g_mutex_unlock (&pool->mutex);
+
+      while (gromit_tile_take (pool, own, &tile))
+        gromit_tile_render (pool, tile);
+
+      g_mutex_lock (&pool->mutex);
+      pool->busy--;
+      g_cond_broadcast (&pool->done_cond);
+      g_mutex_unlock (&pool->mutex);
+    }
+}
+
+
+/*
+ * "notify" gets called from the main loop when tiles are finished, it
+ * should call gromit_tile_pool_drain (). Returns NULL if not even one
+ * thread could be started.
+ */
+
+GromitTilePool *
+gromit_tile_pool_new (guint n_threads, GSourceFunc notify, gpointer user_data)
+{
+  GromitTilePool *pool;
+  GError         *error = NULL;
+  guint           i;
+
+  pool = g_malloc (sizeof (GromitTilePool));
+
+  pool->threads = g_new0 (GThread *, n_threads);
+  pool->deques = g_new0 (GromitTileDeque, n_threads);
+  pool->n_deques = n_threads;
+  for (i = 0; i < n_threads; i++)
+    {
+      pool->deques[i].pool = pool;
+      g_mutex_init (&pool->deques[i].mutex);
+    }
+
+  g_mutex_init (&pool->mutex);
+  g_cond_init (&pool->work_cond);
+  g_cond_init (&pool->done_cond);
+  pool->quit = FALSE;
+  pool->busy = 0;
+  pool->queued = 0;
+  pool->func = NULL;
+  pool->user_data = NULL;
+  pool->state = NULL;
+  pool->n_tiles = 0;
+  pool->finished = g_async_queue_new ();
+  pool->notify = notify;
+  pool->notify_data = user_data;
+  pool->notify_pending = 0;
+
+  /* the threads only look at n_threads once there is work */
+  pool->n_threads = n_threads;
+  for (i = 0; i < n_threads; i++)
+    {
+      pool->threads[i] = g_thread_try_new ("gromit-tiles", gromit_tile_thread,
+                                           &pool->deques[i], &error);
+      if (!pool->threads[i])
+        {
+          g_printerr ("Unable to start a render thread: %s\n",
+                      error->message);
+          g_error_free (error);
+          break;
+        }
+    }
+  pool->n_threads = i;
+
+  if (pool->n_threads == 0)
+    {
+      gromit_tile_pool_free (pool);
+      return NULL;
+    }
+
+  return pool;
+}
+
+
+void
+gromit_tile_pool_free (GromitTilePool *pool)
+{
+  guint i;
+
+  gromit_tile_pool_cancel (pool);
+
+  g_mutex_lock (&pool->mutex);
+  pool->quit = TRUE;
+  g_cond_broadcast (&pool->work_cond);
+  g_mutex_unlock (&pool->mutex);
+
+  for (i = 0; i < pool->n_threads; i++)
+    g_thread_join (pool->threads[i]);
+
+  for (i = 0; i < pool->n_deques; i++)
+    {
+      g_mutex_clear (&pool->deques[i].mutex);
+      g_free (pool->deques[i].tiles);
+    }
+
+  g_mutex_clear (&pool->mutex);
+  g_cond_clear (&pool->work_cond);
+  g_cond_clear (&pool->done_cond);
+  g_async_queue_unref (pool->finished);
+  g_free (pool->threads);
+  g_free (pool->deques);
+  g_free (pool);
+}
+
+
+guint
+gromit_tile_pool_threads (GromitTilePool *pool)
+{
+  return pool->n_threads;
+}
+
+
+/*
+ * Renders the n_run tiles listed in tiles, the first ones first, out of
+ * n_tiles in all. A run that is still going gets cancelled.
+ */
+
+void
+gromit_tile_pool_run (GromitTilePool *pool,
+                      const guint *tiles, guint n_run, guint n_tiles,
+                      GromitTileFunc func, gpointer user_data)
+{
+  GromitTileDeque *deque;
+  guint            i, t;
+
+  gromit_tile_pool_cancel (pool);
+
+  pool->state = g_new (gint, n_tiles);
+  pool->n_tiles = n_tiles;
+  for (i = 0; i < n_tiles; i++)
+    pool->state[i] = GROMIT_TILE_DONE;
+  for (i = 0; i < n_run; i++)
+    pool->state[tiles[i]] = GROMIT_TILE_PENDING;
+  pool->func = func;
+  pool->user_data = user_data;
+
+  /* dealt out in turns, so that every thread starts near the front */
+  for (t = 0; t < pool->n_threads; t++)
+    {
+      deque = &pool->deques[t];
+
+      g_mutex_lock (&deque->mutex);
+      g_free (deque->tiles);
+      deque->tiles = g_new (guint, n_run / pool->n_threads + 1);
+      deque->head = 0;
+      deque->tail = 0;
+      for (i = t; i < n_run; i += pool->n_threads)
+        deque->tiles[deque->tail++] = tiles[i];
+      g_mutex_unlock (&deque->mutex);
+    }
+
+  g_mutex_lock (&pool->mutex);
+  g_atomic_int_set (&pool->queued, n_run);
+  g_cond_broadcast (&pool->work_cond);
+  g_mutex_unlock (&pool->mutex);
+}
+
+
+/*
+ * Makes sure tile is done when this returns: renders it on the calling
+ * thread if nobody started it yet, or waits for the thread that did.
+ */
+
+void
+gromit_tile_pool_claim (GromitTilePool *pool, guint tile)
+{
+  if (!pool->state || tile >= pool->n_tiles)
+    return;
+
+  gromit_tile_render (pool, tile);
+
+  g_mutex_lock (&pool->mutex);
+  while (g_atomic_int_get (&pool->state[tile]) == GROMIT_TILE_RUNNING)
+    g_cond_wait (&pool->done_cond, &pool->mutex);
+  g_mutex_unlock (&pool->mutex);
+}
+
+
+/* hand the finished tiles to func, NULL just drops them */
+void
+gromit_tile_pool_drain (GromitTilePool *pool,
+                        GromitTileFunc func, gpointer user_data)
+{
+  gpointer tile;
+
+  /* reset first: a tile finished from now on schedules a new notify */
+  g_atomic_int_set (&pool->notify_pending, 0);
+
+  while ((tile = g_async_queue_try_pop (pool->finished)))
+    if (func)
+      func (GPOINTER_TO_UINT (tile) - 1, user_data);
+}
+
+
+/*
+ * Drops the tiles nobody started yet and waits for the others. The
+ * finished ones are not handed back any more.
+ */
+
+void
+gromit_tile_pool_cancel (GromitTilePool *pool)
+{
+  GromitTileDeque *deque;
+  guint            t;
+
+  for (t = 0; t < pool->n_threads; t++)
+    {
+      deque = &pool->deques[t];
+
+      g_mutex_lock (&deque->mutex);
+      g_atomic_int_add (&pool->queued, - (gint) (deque->tail - deque->head));
+      deque->head = deque->tail;
+      g_mutex_unlock (&deque->mutex);
+    }
+
+  g_mutex_lock (&pool->mutex);
+  while (pool->busy > 0)
+    g_cond_wait (&pool->done_cond, &pool->mutex);
+  g_mutex_unlock (&pool->mutex);
+
+  while (g_async_queue_try_pop (pool->finished))
+    ;
+
+  g_free ((gpointer) pool->state);
+  pool->state = NULL;
+  pool->n_tiles = 0;
+}
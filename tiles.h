@@ -0,0 +1,54 @@
+/* Gromit -- a program for painting on the screen
+ * Copyright (C) 2000 Simon Budig <Simon.Budig@unix-ag.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __GROMIT_TILES_H__
+#define __GROMIT_TILES_H__
+
+#include <glib.h>
+
+/*
+ * A pool of threads for rendering a screen in tiles. Each thread has a
+ * deque of tiles to work on, front to back, and steals from the back
+ * of the others when its own is empty. The main thread can claim a
+ * tile to have it finished right away. Finished tiles are handed back
+ * to the main loop like the results of the geometry worker.
+ */
+
+typedef struct _GromitTilePool GromitTilePool;
+
+typedef void (*GromitTileFunc) (guint tile, gpointer user_data);
+
+
+GromitTilePool *gromit_tile_pool_new     (guint n_threads,
+                                          GSourceFunc notify,
+                                          gpointer user_data);
+void            gromit_tile_pool_free    (GromitTilePool *pool);
+guint           gromit_tile_pool_threads (GromitTilePool *pool);
+
+void            gromit_tile_pool_run     (GromitTilePool *pool,
+                                          const guint *tiles, guint n_run,
+                                          guint n_tiles,
+                                          GromitTileFunc func,
+                                          gpointer user_data);
+void            gromit_tile_pool_claim   (GromitTilePool *pool, guint tile);
+void            gromit_tile_pool_drain   (GromitTilePool *pool,
+                                          GromitTileFunc func,
+                                          gpointer user_data);
+void            gromit_tile_pool_cancel  (GromitTilePool *pool);
+
+#endif /* __GROMIT_TILES_H__ */
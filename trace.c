@@ -0,0 +1,697 @@
+/* Gromit -- a program for painting on the screen
+ * Copyright (C) 2000 Simon Budig <Simon.Budig@unix-ag.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include "trace.h"
+#include "varint.h"
+
+/* the first bytes of a trace file */
+#define GROMIT_TRACE_MAGIC   "GRT1"
+
+/* coordinates and axes are stored in units of 1/4096 */
+#define GROMIT_TRACE_SCALE   4096.0
+
+/* bytes collected before they get written, a release writes anyway */
+#define GROMIT_TRACE_BUFFER  (1 << 16)
+
+typedef enum
+{
+  GROMIT_RECORD_DEVICE        = 'D',
+  GROMIT_RECORD_PRESS         = 'P',
+  GROMIT_RECORD_2BUTTON_PRESS = '2',
+  GROMIT_RECORD_3BUTTON_PRESS = '3',
+  GROMIT_RECORD_RELEASE       = 'R',
+  GROMIT_RECORD_MOTION        = 'M',
+  GROMIT_RECORD_PROXIMITY_IN  = 'I',
+  GROMIT_RECORD_PROXIMITY_OUT = 'O',
+  GROMIT_RECORD_HISTORY       = 'H'
+} GromitRecordType;
+
+/* a device and its delta coding state, the same on both ends */
+typedef struct
+{
+  guint      id;
+  GdkDevice *device;
+  gint       x;
+  gint       y;
+  gint      *axes;
+} GromitTraceDevice;
+
+struct _GromitTrace
+{
+  gchar         *filename;
+  GPtrArray     *devices;         /* by id */
+  guint32        time;
+  guint32        history_time;
+  guint          state;
+
+  /* recording */
+  FILE          *file;
+  GString       *out;
+
+  /* replay */
+  GdkDisplay    *display;
+  guchar        *buf;
+  const guchar  *p;
+  const guchar  *end;
+};
+
+
+static gint
+gromit_trace_fixed (gdouble value)
+{
+  return (gint) floor (value * GROMIT_TRACE_SCALE + 0.5);
+}
+
+
+static GromitTraceDevice *
+gromit_trace_device_new (GromitTrace *trace, GdkDevice *device)
+{
+  GromitTraceDevice *dev = g_new0 (GromitTraceDevice, 1);
+
+  dev->id = trace->devices->len;
+  dev->device = device;
+  dev->axes = g_new0 (gint, device->num_axes);
+  g_ptr_array_add (trace->devices, dev);
+
+  return dev;
+}
+
+
+void
+gromit_trace_free (GromitTrace *trace)
+{
+  guint i;
+
+  if (trace->file)
+    {
+      if (trace->out->len &&
+          fwrite (trace->out->str, 1, trace->out->len, trace->file)
+          != trace->out->len)
+        g_printerr ("Unable to write %s: %s\n", trace->filename,
+                    g_strerror (errno));
+      fclose (trace->file);
+      g_string_free (trace->out, TRUE);
+    }
+
+  for (i = 0; i < trace->devices->len; i++)
+    {
+      GromitTraceDevice *dev = g_ptr_array_index (trace->devices, i);
+
+      g_free (dev->axes);
+      g_free (dev);
+    }
+  g_ptr_array_free (trace->devices, TRUE);
+
+  g_free (trace->buf);
+  g_free (trace->filename);
+  g_free (trace);
+}
+
+
+/*
+ * Recording
+ */
+
+GromitTrace *
+gromit_trace_record (const gchar *filename)
+{
+  GromitTrace *trace;
+  FILE        *file;
+
+  file = fopen (filename, "wb");
+  if (!file)
+    {
+      g_printerr ("Unable to create %s: %s\n", filename, g_strerror (errno));
+      return NULL;
+    }
+
+  trace = g_new0 (GromitTrace, 1);
+  trace->filename = g_strdup (filename);
+  trace->devices = g_ptr_array_new ();
+  trace->file = file;
+  trace->out = g_string_new (GROMIT_TRACE_MAGIC);
+
+  return trace;
+}
+
+
+static void
+gromit_trace_flush (GromitTrace *trace)
+{
+  if (fwrite (trace->out->str, 1, trace->out->len, trace->file)
+      != trace->out->len || fflush (trace->file) != 0)
+    g_printerr ("Unable to write %s: %s\n", trace->filename,
+                g_strerror (errno));
+
+  g_string_truncate (trace->out, 0);
+}
+
+
+/* the device of an event, described in the trace the first time */
+static GromitTraceDevice *
+gromit_trace_put_device (GromitTrace *trace, GdkDevice *device)
+{
+  GromitTraceDevice *dev;
+  GString           *out = trace->out;
+  guint              i;
+  gint               j;
+
+  for (i = 0; i < trace->devices->len; i++)
+    {
+      dev = g_ptr_array_index (trace->devices, i);
+      if (dev->device == device)
+        return dev;
+    }
+
+  dev = gromit_trace_device_new (trace, device);
+
+  g_string_append_c (out, GROMIT_RECORD_DEVICE);
+  gromit_put_string (out, device->name);
+  gromit_put_uint (out, device->source);
+  gromit_put_uint (out, device->num_axes);
+  for (j = 0; j < device->num_axes; j++)
+    {
+      gromit_put_uint (out, device->axes[j].use);
+      gromit_put_int (out, gromit_trace_fixed (device->axes[j].min));
+      gromit_put_int (out, gromit_trace_fixed (device->axes[j].max));
+    }
+
+  return dev;
+}
+
+
+static void
+gromit_trace_put_axes (GString *out, GromitTraceDevice *dev,
+                       const gdouble *axes)
+{
+  gint i, value;
+
+  for (i = 0; i < dev->device->num_axes; i++)
+    {
+      value = gromit_trace_fixed (axes[i]);
+      gromit_put_int (out, value - dev->axes[i]);
+      dev->axes[i] = value;
+    }
+}
+
+
+void
+gromit_trace_write_event (GromitTrace *trace, GdkEvent *event, guint state)
+{
+  GromitTraceDevice *dev;
+  GString           *out = trace->out;
+  GdkDevice         *device;
+  gdouble            x = 0, y = 0, *axes = NULL;
+  guint32            time;
+  guchar             type;
+  gint               value;
+
+  switch (event->type)
+    {
+    case GDK_BUTTON_PRESS:
+    case GDK_2BUTTON_PRESS:
+    case GDK_3BUTTON_PRESS:
+    case GDK_BUTTON_RELEASE:
+      if (event->type == GDK_BUTTON_PRESS)
+        type = GROMIT_RECORD_PRESS;
+      else if (event->type == GDK_2BUTTON_PRESS)
+        type = GROMIT_RECORD_2BUTTON_PRESS;
+      else if (event->type == GDK_3BUTTON_PRESS)
+        type = GROMIT_RECORD_3BUTTON_PRESS;
+      else
+        type = GROMIT_RECORD_RELEASE;
+      device = event->button.device;
+      time = event->button.time;
+      x = event->button.x;
+      y = event->button.y;
+      axes = event->button.axes;
+      break;
+    case GDK_MOTION_NOTIFY:
+      type = GROMIT_RECORD_MOTION;
+      device = event->motion.device;
+      time = event->motion.time;
+      x = event->motion.x;
+      y = event->motion.y;
+      axes = event->motion.axes;
+      break;
+    case GDK_PROXIMITY_IN:
+    case GDK_PROXIMITY_OUT:
+      type = event->type == GDK_PROXIMITY_IN ? GROMIT_RECORD_PROXIMITY_IN
+                                             : GROMIT_RECORD_PROXIMITY_OUT;
+      device = event->proximity.device;
+      time = event->proximity.time;
+      break;
+    default:
+      return;
+    }
+
+  dev = gromit_trace_put_device (trace, device);
+
+  g_string_append_c (out, type);
+  gromit_put_uint (out, dev->id);
+  gromit_put_int (out, (gint32) (time - trace->time));
+  gromit_put_uint (out, state);
+  trace->time = time;
+
+  if (type != GROMIT_RECORD_PROXIMITY_IN &&
+      type != GROMIT_RECORD_PROXIMITY_OUT)
+    {
+      if (type != GROMIT_RECORD_MOTION)
+        gromit_put_uint (out, event->button.button);
+
+      value = gromit_trace_fixed (x);
+      gromit_put_int (out, value - dev->x);
+      dev->x = value;
+      value = gromit_trace_fixed (y);
+      gromit_put_int (out, value - dev->y);
+      dev->y = value;
+
+      gromit_put_uint (out, axes != NULL);
+      if (axes)
+        gromit_trace_put_axes (out, dev, axes);
+    }
+
+  if (type == GROMIT_RECORD_RELEASE || out->len >= GROMIT_TRACE_BUFFER)
+    gromit_trace_flush (trace);
+}
+
+
+void
+gromit_trace_write_history (GromitTrace *trace, GdkDevice *device,
+                            GdkTimeCoord **coords, gint ncoords)
+{
+  GromitTraceDevice *dev = gromit_trace_put_device (trace, device);
+  GString           *out = trace->out;
+  gint               i;
+
+  g_string_append_c (out, GROMIT_RECORD_HISTORY);
+  gromit_put_uint (out, dev->id);
+  gromit_put_uint (out, MAX (ncoords, 0));
+
+  for (i = 0; i < ncoords; i++)
+    {
+      gromit_put_int (out, (gint32) (coords[i]->time - trace->history_time));
+      trace->history_time = coords[i]->time;
+      gromit_trace_put_axes (out, dev, coords[i]->axes);
+    }
+}
+
+
+/*
+ * Replay
+ */
+
+GromitTrace *
+gromit_trace_replay (const gchar *filename, GdkDisplay *display)
+{
+  GromitTrace *trace;
+  GError      *error = NULL;
+  gchar       *buf;
+  gsize        len;
+
+  if (!g_file_get_contents (filename, &buf, &len, &error))
+    {
+      g_printerr ("Unable to read %s: %s\n", filename, error->message);
+      g_error_free (error);
+      return NULL;
+    }
+
+  if (len < strlen (GROMIT_TRACE_MAGIC) ||
+      memcmp (buf, GROMIT_TRACE_MAGIC, strlen (GROMIT_TRACE_MAGIC)) != 0)
+    {
+      g_printerr ("%s is not an input trace\n", filename);
+      g_free (buf);
+      return NULL;
+    }
+
+  trace = g_new0 (GromitTrace, 1);
+  trace->filename = g_strdup (filename);
+  trace->devices = g_ptr_array_new ();
+  trace->display = display;
+  trace->buf = (guchar *) buf;
+  trace->p = trace->buf + strlen (GROMIT_TRACE_MAGIC);
+  trace->end = trace->buf + len;
+
+  return trace;
+}
+
+
+/* a device of the display that looks the same, or a made up one */
+static GdkDevice *
+gromit_trace_find_device (GromitTrace *trace, const gchar *name,
+                          GdkInputSource source,
+                          const GdkDeviceAxis *axes, gint naxes)
+{
+  GdkDevice *device;
+  GList     *list;
+  gint       i;
+
+  for (list = gdk_display_list_devices (trace->display);
+       list;
+       list = list->next)
+    {
+      device = (GdkDevice *) list->data;
+
+      if (strcmp (device->name, name) != 0 || device->num_axes != naxes)
+        continue;
+
+      for (i = 0; i < naxes; i++)
+        if (device->axes[i].use != axes[i].use)
+          break;
+
+      if (i == naxes)
+        return device;
+    }
+
+  device = g_object_new (GDK_TYPE_DEVICE, NULL);
+  device->name = g_strdup (name);
+  device->source = source;
+  device->mode = GDK_MODE_SCREEN;
+  device->has_cursor = FALSE;
+  device->num_axes = naxes;
+  device->axes = g_memdup (axes, naxes * sizeof (GdkDeviceAxis));
+  device->num_keys = 0;
+  device->keys = NULL;
+
+  return device;
+}
+
+
+static gboolean
+gromit_trace_get_device (GromitTrace *trace)
+{
+  GdkDeviceAxis *axes;
+  GdkDevice     *device;
+  gchar         *name;
+  guint          source, naxes, use;
+  gint           min, max;
+  guint          i;
+
+  if (!gromit_get_string (&trace->p, trace->end, &name))
+    return FALSE;
+
+  if (!gromit_get_uint (&trace->p, trace->end, &source) ||
+      !gromit_get_uint (&trace->p, trace->end, &naxes) ||
+      naxes > GDK_MAX_TIMECOORD_AXES)
+    {
+      g_free (name);
+      return FALSE;
+    }
+
+  axes = g_new0 (GdkDeviceAxis, naxes);
+  for (i = 0; i < naxes; i++)
+    {
+      if (!gromit_get_uint (&trace->p, trace->end, &use) ||
+          !gromit_get_int (&trace->p, trace->end, &min) ||
+          !gromit_get_int (&trace->p, trace->end, &max))
+        {
+          g_free (axes);
+          g_free (name);
+          return FALSE;
+        }
+      axes[i].use = use;
+      axes[i].min = min / GROMIT_TRACE_SCALE;
+      axes[i].max = max / GROMIT_TRACE_SCALE;
+    }
+
+  device = gromit_trace_find_device (trace, name, source, axes, naxes);
+  gromit_trace_device_new (trace, device);
+
+  g_free (axes);
+  g_free (name);
+
+  return TRUE;
+}
+
+
+static GromitTraceDevice *
+gromit_trace_get_device_id (GromitTrace *trace)
+{
+  guint id;
+
+  if (!gromit_get_uint (&trace->p, trace->end, &id) ||
+      id >= trace->devices->len)
+    return NULL;
+
+  return g_ptr_array_index (trace->devices, id);
+}
+
+
+static gboolean
+gromit_trace_get_axes (GromitTrace *trace, GromitTraceDevice *dev,
+                       gdouble *axes)
+{
+  gint i, delta;
+
+  for (i = 0; i < dev->device->num_axes; i++)
+    {
+      if (!gromit_get_int (&trace->p, trace->end, &delta))
+        return FALSE;
+      dev->axes[i] += delta;
+      axes[i] = dev->axes[i] / GROMIT_TRACE_SCALE;
+    }
+
+  return TRUE;
+}
+
+
+static gboolean
+gromit_trace_get_history (GromitTrace *trace,
+                          GdkTimeCoord ***coords, gint *ncoords)
+{
+  GromitTraceDevice *dev;
+  guint              n, i;
+  gint               delta;
+
+  *coords = NULL;
+  *ncoords = 0;
+
+  dev = gromit_trace_get_device_id (trace);
+  if (!dev || !gromit_get_uint (&trace->p, trace->end, &n) ||
+      n > trace->end - trace->p)
+    return FALSE;
+
+  *coords = g_new0 (GdkTimeCoord *, n);
+  for (i = 0; i < n; i++)
+    {
+      (*coords)[i] = g_new0 (GdkTimeCoord, 1);
+      *ncoords = i + 1;
+
+      if (!gromit_get_int (&trace->p, trace->end, &delta) ||
+          !gromit_trace_get_axes (trace, dev, (*coords)[i]->axes))
+        return FALSE;
+
+      trace->history_time += delta;
+      (*coords)[i]->time = trace->history_time;
+    }
+
+  return TRUE;
+}
+
+
+static GdkEvent *
+gromit_trace_get_event (GromitTrace *trace, guchar type)
+{
+  GromitTraceDevice *dev;
+  GdkEvent          *event;
+  gdouble           *axes = NULL;
+  guint              state, button = 0, has_axes;
+  gint               delta, dx, dy;
+
+  dev = gromit_trace_get_device_id (trace);
+  if (!dev ||
+      !gromit_get_int (&trace->p, trace->end, &delta) ||
+      !gromit_get_uint (&trace->p, trace->end, &state))
+    return NULL;
+
+  trace->time += delta;
+  trace->state = state;
+
+  if (type == GROMIT_RECORD_PROXIMITY_IN || type == GROMIT_RECORD_PROXIMITY_OUT)
+    {
+      event = gdk_event_new (type == GROMIT_RECORD_PROXIMITY_IN
+                             ? GDK_PROXIMITY_IN : GDK_PROXIMITY_OUT);
+      event->proximity.time = trace->time;
+      event->proximity.device = dev->device;
+      return event;
+    }
+
+  if (type != GROMIT_RECORD_MOTION &&
+      !gromit_get_uint (&trace->p, trace->end, &button))
+    return NULL;
+
+  if (!gromit_get_int (&trace->p, trace->end, &dx) ||
+      !gromit_get_int (&trace->p, trace->end, &dy) ||
+      !gromit_get_uint (&trace->p, trace->end, &has_axes))
+    return NULL;
+
+  dev->x += dx;
+  dev->y += dy;
+
+  if (has_axes)
+    {
+      axes = g_new0 (gdouble, MAX (dev->device->num_axes, 1));
+      if (!gromit_trace_get_axes (trace, dev, axes))
+        {
+          g_free (axes);
+          return NULL;
+        }
+    }
+
+  if (type == GROMIT_RECORD_MOTION)
+    {
+      event = gdk_event_new (GDK_MOTION_NOTIFY);
+      event->motion.time = trace->time;
+      event->motion.x = event->motion.x_root = dev->x / GROMIT_TRACE_SCALE;
+      event->motion.y = event->motion.y_root = dev->y / GROMIT_TRACE_SCALE;
+      event->motion.axes = axes;
+      event->motion.state = state;
+      event->motion.device = dev->device;
+    }
+  else
+    {
+      if (type == GROMIT_RECORD_PRESS)
+        event = gdk_event_new (GDK_BUTTON_PRESS);
+      else if (type == GROMIT_RECORD_2BUTTON_PRESS)
+        event = gdk_event_new (GDK_2BUTTON_PRESS);
+      else if (type == GROMIT_RECORD_3BUTTON_PRESS)
+        event = gdk_event_new (GDK_3BUTTON_PRESS);
+      else
+        event = gdk_event_new (GDK_BUTTON_RELEASE);
+      event->button.time = trace->time;
+      event->button.x = event->button.x_root = dev->x / GROMIT_TRACE_SCALE;
+      event->button.y = event->button.y_root = dev->y / GROMIT_TRACE_SCALE;
+      event->button.axes = axes;
+      event->button.state = state;
+      event->button.button = button;
+      event->button.device = dev->device;
+    }
+
+  return event;
+}
+
+
+static void
+gromit_trace_damaged (GromitTrace *trace)
+{
+  g_printerr ("%s is damaged at byte %d, stopping the replay\n",
+              trace->filename, (gint) (trace->p - trace->buf));
+  trace->p = trace->end;
+}
+
+
+GdkEvent *
+gromit_trace_read_event (GromitTrace *trace)
+{
+  GdkTimeCoord **coords;
+  GdkEvent      *event;
+  gint           ncoords;
+  guchar         type;
+
+  while (trace->p < trace->end)
+    {
+      type = *trace->p++;
+
+      switch (type)
+        {
+        case GROMIT_RECORD_DEVICE:
+          if (!gromit_trace_get_device (trace))
+            {
+              gromit_trace_damaged (trace);
+              return NULL;
+            }
+          break;
+
+        case GROMIT_RECORD_HISTORY:
+          /* the handlers did not ask for it, still keep the deltas right */
+          if (!gromit_trace_get_history (trace, &coords, &ncoords))
+            {
+              gdk_device_free_history (coords, ncoords);
+              gromit_trace_damaged (trace);
+              return NULL;
+            }
+          gdk_device_free_history (coords, ncoords);
+          break;
+
+        case GROMIT_RECORD_PRESS:
+        case GROMIT_RECORD_2BUTTON_PRESS:
+        case GROMIT_RECORD_3BUTTON_PRESS:
+        case GROMIT_RECORD_RELEASE:
+        case GROMIT_RECORD_MOTION:
+        case GROMIT_RECORD_PROXIMITY_IN:
+        case GROMIT_RECORD_PROXIMITY_OUT:
+          event = gromit_trace_get_event (trace, type);
+          if (!event)
+            gromit_trace_damaged (trace);
+          return event;
+
+        default:
+          trace->p--;
+          gromit_trace_damaged (trace);
+          return NULL;
+        }
+    }
+
+  return NULL;
+}
+
+
+/* the modifier and button state of the last event */
+guint
+gromit_trace_state (GromitTrace *trace)
+{
+  return trace->state;
+}
+
+
+/* the motion history that was recorded at this point, if any */
+void
+gromit_trace_read_history (GromitTrace *trace,
+                           GdkTimeCoord ***coords, gint *ncoords)
+{
+  *coords = NULL;
+  *ncoords = 0;
+
+  while (trace->p < trace->end && *trace->p == GROMIT_RECORD_DEVICE)
+    {
+      trace->p++;
+      if (!gromit_trace_get_device (trace))
+        {
+          gromit_trace_damaged (trace);
+          return;
+        }
+    }
+
+  if (trace->p < trace->end && *trace->p == GROMIT_RECORD_HISTORY)
+    {
+      trace->p++;
+      if (!gromit_trace_get_history (trace, coords, ncoords))
+        {
+          gdk_device_free_history (*coords, *ncoords);
+          *coords = NULL;
+          *ncoords = 0;
+          gromit_trace_damaged (trace);
+        }
+    }
+}
@@ -0,0 +1,57 @@
+/* Gromit -- a program for painting on the screen
+ * Copyright (C) 2000 Simon Budig <Simon.Budig@unix-ag.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+
+#ifndef __GROMIT_TRACE_H__
+#define __GROMIT_TRACE_H__
+
+#include <glib.h>
+#include <gdk/gdk.h>
+
+/*
+ * Input traces: the events reaching the drawing handlers, written into
+ * a file so that they can be fed through the handlers again, without
+ * the devices they came from. Coordinates and axes are stored as
+ * variable length deltas with a resolution of 1/4096, times in ms.
+ *
+ * Next to the events a trace holds the motion history the handlers
+ * fetched from the X server, a replay hands it out in the same order.
+ */
+
+typedef struct _GromitTrace GromitTrace;
+
+GromitTrace *gromit_trace_record        (const gchar *filename);
+GromitTrace *gromit_trace_replay        (const gchar *filename,
+                                         GdkDisplay *display);
+void         gromit_trace_free          (GromitTrace *trace);
+
+void         gromit_trace_write_event   (GromitTrace *trace,
+                                         GdkEvent *event, guint state);
+void         gromit_trace_write_history (GromitTrace *trace,
+                                         GdkDevice *device,
+                                         GdkTimeCoord **coords,
+                                         gint ncoords);
+
+/* NULL at the end of the trace, free the event with gdk_event_free () */
+GdkEvent    *gromit_trace_read_event    (GromitTrace *trace);
+guint        gromit_trace_state         (GromitTrace *trace);
+void         gromit_trace_read_history  (GromitTrace *trace,
+                                         GdkTimeCoord ***coords,
+                                         gint *ncoords);
+
+#endif /* __GROMIT_TRACE_H__ */
@@ -0,0 +1,151 @@
+/* Gromit -- a program for painting on the screen
+ * Copyright (C) 2000 Simon Budig <Simon.Budig@unix-ag.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+
+#include <string.h>
+
+#include "varint.h"
+
+
+guchar *
+gromit_write_uint (guchar *buf, guint value)
+{
+  while (value >= 0x80)
+    {
+      *buf++ = (value & 0x7f) | 0x80;
+      value >>= 7;
+    }
+  *buf++ = value;
+
+  return buf;
+}
+
+
+guchar *
+gromit_write_int (guchar *buf, gint value)
+{
+  return gromit_write_uint (buf, ((guint) value << 1) ^ (guint) (value >> 31));
+}
+
+
+void
+gromit_put_uint (GString *out, guint value)
+{
+  guchar buf[GROMIT_VARINT_MAX];
+
+  g_string_append_len (out, (gchar *) buf,
+                       gromit_write_uint (buf, value) - buf);
+}
+
+
+void
+gromit_put_int (GString *out, gint value)
+{
+  gromit_put_uint (out, ((guint) value << 1) ^ (guint) (value >> 31));
+}
+
+
+void
+gromit_put_string (GString *out, const gchar *string)
+{
+  gsize len = string ? strlen (string) : 0;
+
+  /* a longer one would be refused, cut it at a character boundary */
+  if (len > GROMIT_VARINT_MAX_STRING)
+    len = g_utf8_find_prev_char (string,
+                                 string + GROMIT_VARINT_MAX_STRING + 1) - string;
+
+  gromit_put_uint (out, len);
+  g_string_append_len (out, string, len);
+}
+
+
+/* 1 for a number, 0 if the input ends too early, -1 if it is too long */
+gint
+gromit_read_uint (const guchar **p, const guchar *end, guint *value)
+{
+  guint shift = 0;
+
+  *value = 0;
+  while (*p < end)
+    {
+      guchar c = *(*p)++;
+
+      *value |= (guint) (c & 0x7f) << shift;
+      if (!(c & 0x80))
+        return 1;
+
+      shift += 7;
+      if (shift >= 7 * GROMIT_VARINT_MAX)
+        return -1;
+    }
+
+  return 0;
+}
+
+
+gint
+gromit_read_int (const guchar **p, const guchar *end, gint *value)
+{
+  guint v;
+  gint  ok = gromit_read_uint (p, end, &v);
+
+  if (ok > 0)
+    *value = (gint) (v >> 1) ^ -(gint) (v & 1);
+  return ok;
+}
+
+
+gint
+gromit_read_string (const guchar **p, const guchar *end, gchar **string)
+{
+  guint len;
+  gint  ok = gromit_read_uint (p, end, &len);
+
+  if (ok <= 0)
+    return ok;
+  if (len > GROMIT_VARINT_MAX_STRING)
+    return -1;
+  if (len > end - *p)
+    return 0;
+
+  *string = g_strndup ((const gchar *) *p, len);
+  *p += len;
+  return 1;
+}
+
+
+gboolean
+gromit_get_uint (const guchar **p, const guchar *end, guint *value)
+{
+  return gromit_read_uint (p, end, value) > 0;
+}
+
+
+gboolean
+gromit_get_int (const guchar **p, const guchar *end, gint *value)
+{
+  return gromit_read_int (p, end, value) > 0;
+}
+
+
+gboolean
+gromit_get_string (const guchar **p, const guchar *end, gchar **string)
+{
+  return gromit_read_string (p, end, string) > 0;
+}
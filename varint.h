@@ -0,0 +1,63 @@
+/* Gromit -- a program for painting on the screen
+ * Copyright (C) 2000 Simon Budig <Simon.Budig@unix-ag.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+
+#ifndef __GROMIT_VARINT_H__
+#define __GROMIT_VARINT_H__
+
+#include <glib.h>
+
+/*
+ * Variable length numbers for the binary formats. Numbers are stored
+ * 7 bits at a time, low bits first, signed ones zigzag coded so that
+ * small negative values stay short.
+ */
+
+/* the most bytes a number takes */
+#define GROMIT_VARINT_MAX 5
+
+/* the longest string, e.g. a font name or a text label */
+#define GROMIT_VARINT_MAX_STRING 4096
+
+/* these write into buf and return the end of the number */
+guchar   *gromit_write_uint (guchar *buf, guint value);
+guchar   *gromit_write_int  (guchar *buf, gint value);
+
+void      gromit_put_uint   (GString *out, guint value);
+void      gromit_put_int    (GString *out, gint value);
+void      gromit_put_string (GString *out, const gchar *string);
+
+/* the get functions return FALSE if the input ends too early or if a
+ * number is too long */
+gboolean  gromit_get_uint   (const guchar **p, const guchar *end,
+                             guint *value);
+gboolean  gromit_get_int    (const guchar **p, const guchar *end,
+                             gint *value);
+gboolean  gromit_get_string (const guchar **p, const guchar *end,
+                             gchar **string);
+
+/* the same, but they tell input that ends too early (0) from numbers
+ * and strings that are too long to make sense (-1) */
+gint      gromit_read_uint  (const guchar **p, const guchar *end,
+                             guint *value);
+gint      gromit_read_int   (const guchar **p, const guchar *end,
+                             gint *value);
+gint      gromit_read_string (const guchar **p, const guchar *end,
+                              gchar **string);
+
+#endif /* __GROMIT_VARINT_H__ */
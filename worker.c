@@ -0,0 +1,350 @@
+/* Gromit -- a program for painting on the screen
+ * Copyright (C) 2000 Simon Budig <Simon.Budig@unix-ag.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include <string.h>
+
+#include "queue.h"
+#include "worker.h"
+
+#define GROMIT_WORK_QUEUE_SIZE   4096
+#define GROMIT_RESULT_QUEUE_SIZE 64
+
+/* hand back a batch at least every that many items */
+#define GROMIT_WORK_BATCH        64
+
+#define GROMIT_WORK_MAX_POINTS   8
+
+typedef enum
+{
+  GROMIT_WORK_LINE,
+  GROMIT_WORK_POLYGON
+} GromitWorkType;
+
+typedef struct
+{
+  GromitWorkType  type;
+  guint           flags;
+  GromitRaster   *raster;
+  guint32         pixel;
+  guint32         outline;
+  GromitRasterOp  op;
+  gint            width;
+  gint            npoints;
+  GdkPoint        points[GROMIT_WORK_MAX_POINTS];
+} GromitWorkItem;
+
+struct _GromitWorker
+{
+  GThread       *thread;
+  GromitQueue   *input;         /* GromitWorkItem, main thread -> worker */
+  GromitQueue   *output;        /* GromitWorkResult, worker -> main thread */
+
+  /* only used to sleep while there is nothing to do */
+  GMutex         mutex;
+  GCond          cond;
+  volatile gint  sleeping;
+
+  GSourceFunc    notify;
+  gpointer       notify_data;
+  volatile gint  notify_pending;
+
+  guint          submitted;     /* only touched by the main thread */
+  volatile gint  completed;
+};
+
+
+static void
+gromit_work_result_init (GromitWorkResult *result)
+{
+  memset (result, 0, sizeof (GromitWorkResult));
+}
+
+
+/* keep shape_add and shape_sub disjoint, like gromit_region_add () */
+static void
+gromit_work_add_region (GromitWorkResult *batch, GdkRegion *delta,
+                        gboolean erase)
+{
+  GdkRegion **add = erase ? &batch->shape_sub : &batch->shape_add;
+  GdkRegion  *sub = erase ? batch->shape_add : batch->shape_sub;
+
+  if (sub)
+    gdk_region_subtract (sub, delta);
+
+  if (*add)
+    gdk_region_union (*add, delta);
+  else
+    *add = gdk_region_copy (delta);
+}
+
+
+static void
+gromit_work_process (GromitWorkItem *item, GromitWorkResult *batch)
+{
+  GdkRectangle  dirty = { 0, 0, 0, 0 };
+  GdkRegion    *delta = NULL;
+  GdkPoint     *p = item->points;
+  gint          i;
+
+  switch (item->type)
+    {
+      case GROMIT_WORK_LINE:
+        gromit_raster_line (item->raster, p[0].x, p[0].y, p[1].x, p[1].y,
+                            item->width, item->pixel, item->op, &dirty);
+
+        if (item->flags & GROMIT_WORK_REGION)
+          {
+            delta = gdk_region_new ();
+            gromit_line_spans (p[0].x, p[0].y, p[1].x, p[1].y, item->width,
+                               gromit_region_span, delta);
+          }
+        break;
+
+      case GROMIT_WORK_POLYGON:
+        gromit_raster_polygon (item->raster, p, item->npoints,
+                               item->pixel, item->op, &dirty);
+
+        if (item->flags & GROMIT_WORK_OUTLINE)
+          for (i = 0; i < item->npoints; i++)
+            gromit_raster_line (item->raster, p[i].x, p[i].y,
+                                p[(i+1) % item->npoints].x,
+                                p[(i+1) % item->npoints].y,
+                                0, item->outline, item->op, &dirty);
+
+        if (item->flags & GROMIT_WORK_REGION)
+          delta = gdk_region_polygon (p, item->npoints, GDK_WINDING_RULE);
+        break;
+    }
+
+  if (item->flags & GROMIT_WORK_PAINT)
+    gromit_rect_union (&batch->paint_dirty, &dirty);
+
+  if (item->flags & GROMIT_WORK_SHAPE)
+    gromit_rect_union (&batch->shape_dirty, &dirty);
+
+  if (delta)
+    {
+      gromit_work_add_region (batch, delta,
+                              item->flags & GROMIT_WORK_ERASE);
+      gdk_region_destroy (delta);
+    }
+}
+
+
+static gpointer
+gromit_worker_thread (gpointer user_data)
+{
+  GromitWorker     *worker = user_data;
+  GromitWorkResult  batch;
+  GromitWorkItem    item;
+  guint             n_items = 0;
+
+  gromit_work_result_init (&batch);
+
+  while (TRUE)
+    {
+      if (gromit_queue_pop (worker->input, &item))
+        {
+          gromit_work_process (&item, &batch);
+          n_items++;
+
+          if (n_items < GROMIT_WORK_BATCH &&
+              !gromit_queue_empty (worker->input))
+            continue;
+        }
+
+      if (n_items > 0)
+        {
+          if (gromit_queue_push (worker->output, &batch))
+            {
+              g_atomic_int_add (&worker->completed, n_items);
+              n_items = 0;
+              gromit_work_result_init (&batch);
+
+              if (g_atomic_int_compare_and_exchange (&worker->notify_pending,
+                                                     0, 1))
+                g_idle_add (worker->notify, worker->notify_data);
+            }
+          else if (gromit_queue_empty (worker->input))
+            {
+              /* the main thread has not caught up yet */
+              g_usleep (1000);
+            }
+          continue;
+        }
+
+      g_mutex_lock (&worker->mutex);
+      g_atomic_int_set (&worker->sleeping, 1);
+      while (gromit_queue_empty (worker->input))
+        g_cond_wait (&worker->cond, &worker->mutex);
+      g_atomic_int_set (&worker->sleeping, 0);
+      g_mutex_unlock (&worker->mutex);
+    }
+
+  return NULL;
+}
+
+
+/*
+ * "notify" gets called from the main loop when results are waiting,
+ * it should call gromit_worker_drain ().
+ */
+
+GromitWorker *
+gromit_worker_new (GSourceFunc notify, gpointer user_data)
+{
+  GromitWorker *worker;
+  GError       *error = NULL;
+
+  worker = g_malloc (sizeof (GromitWorker));
+
+  worker->input = gromit_queue_new (GROMIT_WORK_QUEUE_SIZE,
+                                    sizeof (GromitWorkItem));
+  worker->output = gromit_queue_new (GROMIT_RESULT_QUEUE_SIZE,
+                                     sizeof (GromitWorkResult));
+  g_mutex_init (&worker->mutex);
+  g_cond_init (&worker->cond);
+  worker->sleeping = 0;
+  worker->notify = notify;
+  worker->notify_data = user_data;
+  worker->notify_pending = 0;
+  worker->submitted = 0;
+  worker->completed = 0;
+
+  worker->thread = g_thread_try_new ("gromit-geometry", gromit_worker_thread,
+                                     worker, &error);
+  if (!worker->thread)
+    {
+      g_printerr ("Unable to start the geometry thread: %s\n",
+                  error->message);
+      g_error_free (error);
+      gromit_queue_free (worker->input);
+      gromit_queue_free (worker->output);
+      g_mutex_clear (&worker->mutex);
+      g_cond_clear (&worker->cond);
+      g_free (worker);
+      return NULL;
+    }
+
+  return worker;
+}
+
+
+static void
+gromit_worker_wakeup (GromitWorker *worker)
+{
+  if (g_atomic_int_get (&worker->sleeping))
+    {
+      g_mutex_lock (&worker->mutex);
+      g_cond_signal (&worker->cond);
+      g_mutex_unlock (&worker->mutex);
+    }
+}
+
+
+static void
+gromit_worker_submit (GromitWorker *worker, GromitWorkItem *item)
+{
+  while (!gromit_queue_push (worker->input, item))
+    {
+      gromit_worker_wakeup (worker);
+      g_thread_yield ();
+    }
+
+  worker->submitted++;
+  gromit_worker_wakeup (worker);
+}
+
+
+void
+gromit_worker_line (GromitWorker *worker, GromitRaster *raster,
+                    gint x1, gint y1, gint x2, gint y2,
+                    gint width, guint32 pixel,
+                    GromitRasterOp op, guint flags)
+{
+  GromitWorkItem item;
+
+  item.type = GROMIT_WORK_LINE;
+  item.flags = flags;
+  item.raster = raster;
+  item.pixel = pixel;
+  item.outline = pixel;
+  item.op = op;
+  item.width = width;
+  item.npoints = 2;
+  item.points[0].x = x1;
+  item.points[0].y = y1;
+  item.points[1].x = x2;
+  item.points[1].y = y2;
+
+  gromit_worker_submit (worker, &item);
+}
+
+
+void
+gromit_worker_polygon (GromitWorker *worker, GromitRaster *raster,
+                       const GdkPoint *points, gint npoints,
+                       guint32 pixel, guint32 outline,
+                       GromitRasterOp op, guint flags)
+{
+  GromitWorkItem item;
+
+  g_return_if_fail (npoints <= GROMIT_WORK_MAX_POINTS);
+
+  item.type = GROMIT_WORK_POLYGON;
+  item.flags = flags;
+  item.raster = raster;
+  item.pixel = pixel;
+  item.outline = outline;
+  item.op = op;
+  item.width = 0;
+  item.npoints = npoints;
+  memcpy (item.points, points, npoints * sizeof (GdkPoint));
+
+  gromit_worker_submit (worker, &item);
+}
+
+
+/* hand the finished batches to func, in the order they were drawn */
+void
+gromit_worker_drain (GromitWorker *worker,
+                     GromitResultFunc func, gpointer user_data)
+{
+  GromitWorkResult result;
+
+  /* reset first: a batch finished from now on schedules a new notify */
+  g_atomic_int_set (&worker->notify_pending, 0);
+
+  while (gromit_queue_pop (worker->output, &result))
+    func (&result, user_data);
+}
+
+
+/* wait until everything submitted so far is drawn and drained */
+void
+gromit_worker_sync (GromitWorker *worker,
+                    GromitResultFunc func, gpointer user_data)
+{
+  while ((guint) g_atomic_int_get (&worker->completed) != worker->submitted)
+    {
+      gromit_worker_drain (worker, func, user_data);
+      g_thread_yield ();
+    }
+
+  gromit_worker_drain (worker, func, user_data);
+}
@@ -0,0 +1,78 @@
+/* Gromit -- a program for painting on the screen
+ * Copyright (C) 2000 Simon Budig <Simon.Budig@unix-ag.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __GROMIT_WORKER_H__
+#define __GROMIT_WORKER_H__
+
+#include <glib.h>
+#include <gdk/gdk.h>
+
+#include "raster.h"
+
+/*
+ * The geometry worker rasterizes the strokes on a separate thread. The
+ * main thread queues the segments, the worker collects what they
+ * changed in batches and hands those back, so that the main thread
+ * only has to upload them to the X server.
+ */
+
+typedef enum
+{
+  GROMIT_WORK_PAINT   = 1 << 0,   /* the colors changed, upload them */
+  GROMIT_WORK_SHAPE   = 1 << 1,   /* the coverage changed, repack the shape */
+  GROMIT_WORK_REGION  = 1 << 2,   /* collect the covered area as region */
+  GROMIT_WORK_ERASE   = 1 << 3,   /* ... which gets removed from the shape */
+  GROMIT_WORK_OUTLINE = 1 << 4    /* draw the outline of a polygon */
+} GromitWorkFlags;
+
+typedef struct
+{
+  GdkRectangle  paint_dirty;
+  GdkRectangle  shape_dirty;
+  GdkRegion    *shape_add;      /* NULL if nothing was added */
+  GdkRegion    *shape_sub;      /* NULL if nothing was erased */
+} GromitWorkResult;
+
+typedef struct _GromitWorker GromitWorker;
+
+/* the regions of the result belong to the callback */
+typedef void (*GromitResultFunc) (GromitWorkResult *result,
+                                  gpointer user_data);
+
+
+GromitWorker *gromit_worker_new     (GSourceFunc notify, gpointer user_data);
+
+void          gromit_worker_line    (GromitWorker *worker,
+                                     GromitRaster *raster,
+                                     gint x1, gint y1, gint x2, gint y2,
+                                     gint width, guint32 pixel,
+                                     GromitRasterOp op, guint flags);
+void          gromit_worker_polygon (GromitWorker *worker,
+                                     GromitRaster *raster,
+                                     const GdkPoint *points, gint npoints,
+                                     guint32 pixel, guint32 outline,
+                                     GromitRasterOp op, guint flags);
+
+void          gromit_worker_drain   (GromitWorker *worker,
+                                     GromitResultFunc func,
+                                     gpointer user_data);
+void          gromit_worker_sync    (GromitWorker *worker,
+                                     GromitResultFunc func,
+                                     gpointer user_data);
+
+#endif /* __GROMIT_WORKER_H__ */